@@ -0,0 +1,316 @@
+#ifndef JOB_SYSTEM_HPP
+#define JOB_SYSTEM_HPP
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class job_system;
+
+// Jobs of a group that have not finished yet. Waiting on a counter runs other jobs meanwhile, and jobs can be
+// queued to start only once a counter drops to zero. A counter must outlive the jobs it counts.
+class job_counter {
+public:
+    job_counter() = default;
+
+    job_counter(const job_counter& other) = delete;
+
+    job_counter& operator=(const job_counter& other) = delete;
+
+    [[nodiscard]]
+    bool done() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return pending == 0;
+    }
+
+private:
+    friend class job_system;
+
+    struct continuation {
+        std::function<void()> work;
+        job_counter* done;
+    };
+
+    // Guards everything, a job finishing releases it last so that a waiter seeing zero may destroy the counter.
+    std::mutex mutex;
+    size_t pending = 0;
+    std::vector<continuation> continuations;
+};
+
+// Threads kept for the whole run that execute small jobs. Every thread has its own deque: it pushes and pops
+// its jobs at the back, idle threads steal from the front of the others. Threads outside the system, like the
+// main thread, share the first deque unless they attach_thread() for one of their own, and help running jobs while
+// they wait for a counter: their own and the workers', but never the deque of another outside thread, so that a
+// thread waiting for short jobs does not pick up a long one another thread queued.
+class job_system {
+public:
+    struct worker_stats {
+        size_t jobs = 0;
+        // Jobs taken from the deque of another thread.
+        size_t stolen = 0;
+        float busy_ms = 0.0f;
+        // Share of the time since the last reset_stats() spent running jobs.
+        float utilization = 0.0f;
+    };
+
+    // Outside threads that can attach_thread(), besides the ones sharing the first deque.
+    static constexpr size_t max_attached_threads = 4;
+
+    explicit job_system(size_t threads = std::max(1u, std::thread::hardware_concurrency())):
+        thread_count(threads), slots(threads + max_attached_threads), active_slots(threads) {
+        for (auto& target: slots) {
+            target = std::make_unique<slot>();
+        }
+        for (size_t index = 1; index < threads; index += 1) {
+            workers.emplace_back([this, index]() {
+                work(index);
+            });
+        }
+    }
+
+    job_system(const job_system& other) = delete;
+
+    job_system& operator=(const job_system& other) = delete;
+
+    // Jobs still queued are dropped, wait for their counters first.
+    ~job_system() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker: workers) {
+            worker.join();
+        }
+    }
+
+    // Queues a job on the deque of the calling thread; `done` counts it until it has finished.
+    void run(std::function<void()> work, job_counter* done = nullptr) {
+        if (done != nullptr) {
+            std::lock_guard<std::mutex> lock(done->mutex);
+            done->pending += 1;
+        }
+        push({std::move(work), done});
+    }
+
+    // Queues a job that starts once `dependency` drops to zero, right away if it already is.
+    void run_after(job_counter& dependency, std::function<void()> work, job_counter* done = nullptr) {
+        if (done != nullptr) {
+            std::lock_guard<std::mutex> lock(done->mutex);
+            done->pending += 1;
+        }
+        {
+            std::lock_guard<std::mutex> lock(dependency.mutex);
+            if (dependency.pending != 0) {
+                dependency.continuations.push_back({std::move(work), done});
+                return;
+            }
+        }
+        push({std::move(work), done});
+    }
+
+    // Runs queued jobs on the calling thread until `done` drops to zero.
+    void wait(job_counter& done) {
+        while (!done.done()) {
+            if (!run_one()) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // Gives the calling thread outside the system a deque of its own for as long as it runs. Does nothing on
+    // workers and threads that already attached.
+    void attach_thread() {
+        if (current_system == this) {
+            return;
+        }
+        auto index = active_slots.load();
+        do {
+            if (index == slots.size()) {
+                throw std::runtime_error("Too many threads attached to the job system");
+            }
+        } while (!active_slots.compare_exchange_weak(index, index + 1));
+        current_system = this;
+        thread_slot = index;
+    }
+
+    // Calls body(begin, end) for consecutive ranges of at most `grain` indices below count, and waits for all of them.
+    template <typename F>
+    void parallel_for(size_t count, size_t grain, F&& body) {
+        job_counter done;
+        grain = std::max<size_t>(1, grain);
+        for (size_t begin = 0; begin < count; begin += grain) {
+            auto end = std::min(count, begin + grain);
+            run([&body, begin, end]() { body(begin, end); }, &done);
+        }
+        wait(done);
+    }
+
+    // Threads running jobs, the calling one included.
+    [[nodiscard]]
+    size_t size() const {
+        return thread_count;
+    }
+
+    // What every thread did since the last call: the first entry is shared by the threads outside the system that
+    // did not attach, the attached ones follow the workers.
+    std::vector<worker_stats> reset_stats() {
+        auto now = std::chrono::steady_clock::now();
+        auto elapsed_ms = std::chrono::duration<float, std::milli>(now - stats_start).count();
+        stats_start = now;
+        std::vector<worker_stats> result;
+        for (size_t index = 0; index < active_slots; index += 1) {
+            auto& target = slots[index];
+            worker_stats stats;
+            stats.jobs = target->jobs.exchange(0);
+            stats.stolen = target->stolen.exchange(0);
+            stats.busy_ms = (float)target->busy_ns.exchange(0) / 1e6f;
+            stats.utilization = elapsed_ms > 0.0f ? std::min(1.0f, stats.busy_ms / elapsed_ms) : 0.0f;
+            result.push_back(stats);
+        }
+        return result;
+    }
+
+private:
+    struct job {
+        std::function<void()> work;
+        job_counter* done;
+    };
+
+    struct slot {
+        std::mutex mutex;
+        std::deque<job> queue;
+        std::atomic<size_t> jobs = 0;
+        std::atomic<size_t> stolen = 0;
+        std::atomic<int64_t> busy_ns = 0;
+    };
+
+    // Slot of the calling thread, 0 for threads outside the system that did not attach.
+    size_t current_slot() const {
+        return current_system == this ? thread_slot : 0;
+    }
+
+    // Whether a slot belongs to threads outside the system rather than to a worker.
+    bool is_outside(size_t index) const {
+        return index == 0 || index >= thread_count;
+    }
+
+    void push(job target) {
+        auto& own = *slots[current_slot()];
+        {
+            std::lock_guard<std::mutex> lock(own.mutex);
+            own.queue.push_back(std::move(target));
+        }
+        queued += 1;
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+        }
+        wake.notify_one();
+    }
+
+    // Own jobs newest first, then the oldest job of another thread. Outside threads only take from workers, unless
+    // there are none and a job could otherwise be left behind in the deque of an outside thread that is gone.
+    bool take(size_t self, job& target, bool& stolen) {
+        const size_t count = active_slots;
+        const bool skip_outside = is_outside(self) && thread_count > 1;
+        for (size_t offset = 0; offset < count; offset += 1) {
+            const auto index = (self + offset) % count;
+            if (offset != 0 && skip_outside && is_outside(index)) {
+                continue;
+            }
+            auto& other = *slots[index];
+            std::lock_guard<std::mutex> lock(other.mutex);
+            if (other.queue.empty()) {
+                continue;
+            }
+            if (offset == 0) {
+                target = std::move(other.queue.back());
+                other.queue.pop_back();
+            } else {
+                target = std::move(other.queue.front());
+                other.queue.pop_front();
+            }
+            queued -= 1;
+            stolen = offset != 0;
+            return true;
+        }
+        return false;
+    }
+
+    bool run_one() {
+        const auto self = current_slot();
+        job target;
+        bool stolen = false;
+        if (!take(self, target, stolen)) {
+            return false;
+        }
+        auto start = std::chrono::steady_clock::now();
+        target.work();
+        auto& stats = *slots[self];
+        stats.busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        stats.jobs += 1;
+        stats.stolen += stolen ? 1 : 0;
+        if (target.done != nullptr) {
+            finish(*target.done);
+        }
+        return true;
+    }
+
+    void finish(job_counter& done) {
+        std::vector<job_counter::continuation> ready;
+        {
+            std::lock_guard<std::mutex> lock(done.mutex);
+            done.pending -= 1;
+            if (done.pending == 0) {
+                ready.swap(done.continuations);
+            }
+        }
+        for (auto& next: ready) {
+            push({std::move(next.work), next.done});
+        }
+    }
+
+    void work(size_t index) {
+        current_system = this;
+        thread_slot = index;
+        while (true) {
+            if (run_one()) {
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            wake.wait(lock, [&]() { return stopping || queued > 0; });
+            if (stopping) {
+                return;
+            }
+        }
+    }
+
+    static inline thread_local const job_system* current_system = nullptr;
+    static inline thread_local size_t thread_slot = 0;
+
+    const size_t thread_count;
+    // Workers' slots come first after the shared one, then those of attached threads; only the active ones are used.
+    std::vector<std::unique_ptr<slot>> slots;
+    std::atomic<size_t> active_slots;
+    // Jobs sitting in any deque, sleeping workers wake up when it is not zero.
+    std::atomic<size_t> queued = 0;
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::chrono::steady_clock::time_point stats_start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+};
+
+#endif
@@ -1,5 +1,6 @@
 #include <iostream>
 #include <vector>
+#include <algorithm>
 #include <chrono>
 
 #include <fmt/format.h>
@@ -12,9 +13,11 @@
 
 #include <GLFW/glfw3.h>
 
+#include <glm/glm.hpp>
 #include <glm/gtc/constants.hpp>
 
 #include "opengl_shader.h"
+#include "job_system.hpp"
 
 #include <tuple>
 #include <array>
@@ -80,6 +83,42 @@ void bind_shader_attributes(shader_t& shader_program) {
     glEnableVertexAttribArray(ipos);
 }
 
+// Escape values computed on the CPU are uploaded into a single channel float texture the shader colors.
+GLuint create_values_texture() {
+    GLuint values;
+    glGenTextures(1, &values);
+    glBindTexture(GL_TEXTURE_2D, values);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return values;
+}
+
+const int cpu_tile_size = 64;
+
+// The iteration of the fragment shader for one square tile of the framebuffer, rows from the bottom like GL.
+void compute_tile(std::vector<float>& values, int width, int height, int tile,
+                  float zoom, glm::vec2 center, glm::vec2 shift, float max_radius, int max_iterations) {
+    const int tiles_x = (width + cpu_tile_size - 1) / cpu_tile_size;
+    const int first_x = tile % tiles_x * cpu_tile_size;
+    const int first_y = tile / tiles_x * cpu_tile_size;
+    for (int y = first_y; y < std::min(height, first_y + cpu_tile_size); y++) {
+        for (int x = first_x; x < std::min(width, first_x + cpu_tile_size); x++) {
+            auto pos = glm::vec2((x + 0.5f) / width * 2.0f - 1.0f, (y + 0.5f) / height * 2.0f - 1.0f);
+            auto nm = (pos + center) * zoom + shift;
+            auto c = nm;
+            float value = 0.0f;
+            for (int i = 0; i < max_iterations && value < max_radius; ++i) {
+                nm = glm::vec2(nm.x * nm.x - nm.y * nm.y, nm.x * nm.y + nm.y * nm.x) + c;
+                value = nm.x * nm.x + nm.y * nm.y;
+            }
+            values[y * width + x] = value;
+        }
+    }
+}
+
 auto get_window_size(GLFWwindow* window) {
     int width = 0;
     int height = 0;
@@ -143,6 +182,7 @@ int main(int, char **) {
     }
 
     auto [vbo, vao, ebo, tex] = create_buffers();
+    auto values_texture = create_values_texture();
     shader_t shader_program("vertex.glsl", "fragment.glsl");
     bind_shader_attributes(shader_program);
 
@@ -160,6 +200,11 @@ int main(int, char **) {
     int max_iterations = 25;
     float shiftx = 0.0f;
     float shifty = 0.0f;
+    bool cpu_tiles = false;
+    std::vector<float> values;
+    int values_width = 0;
+    int values_height = 0;
+    job_system jobs;
 
     while (!glfwWindowShouldClose(window)) {
         glfwPollEvents();
@@ -190,7 +235,7 @@ int main(int, char **) {
         }
 
         ImGui::Begin("Fractal props");
-        ImGui::SetWindowSize(ImVec2(300, 200));
+        ImGui::SetWindowSize(ImVec2(300, 320));
         ImGui::SliderFloat("Zoom out", &zoom, 0.01, 100);
         ImGui::SliderFloat("Max Radius", &max_radius, 0, 20);
         ImGui::SliderInt("Max Iterations", &max_iterations, 1, 100);
@@ -200,6 +245,34 @@ int main(int, char **) {
             shiftx = 0.0;
             shifty = 0.0;
         }
+        ImGui::Checkbox("CPU tiles", &cpu_tiles);
+
+        if (cpu_tiles) {
+            // Every tile is a job, the shader only colors the uploaded values.
+            auto start = std::chrono::steady_clock::now();
+            values.resize((size_t)display_w * display_h);
+            const int tiles = ((display_w + cpu_tile_size - 1) / cpu_tile_size) * ((display_h + cpu_tile_size - 1) / cpu_tile_size);
+            jobs.parallel_for(tiles, 1, [&](size_t first, size_t last) {
+                for (auto tile = first; tile < last; tile++) {
+                    compute_tile(values, display_w, display_h, (int)tile, zoom, glm::vec2(centerx, centery), glm::vec2(shiftx, shifty), max_radius, max_iterations);
+                }
+            });
+            auto tiles_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, values_texture);
+            if (values_width != display_w || values_height != display_h) {
+                values_width = display_w;
+                values_height = display_h;
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, display_w, display_h, 0, GL_RED, GL_FLOAT, values.data());
+            } else {
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, display_w, display_h, GL_RED, GL_FLOAT, values.data());
+            }
+            ImGui::Text("%d tiles in %.2f ms on %zu threads", tiles, tiles_ms, jobs.size());
+        }
+        auto job_stats = jobs.reset_stats();
+        for (size_t thread = 0; thread < job_stats.size(); thread++) {
+            ImGui::Text("Thread %zu: %.0f%% busy, %zu jobs, %zu stolen", thread, job_stats[thread].utilization * 100.0f, job_stats[thread].jobs, job_stats[thread].stolen);
+        }
         ImGui::End();
 
 
@@ -209,6 +282,8 @@ int main(int, char **) {
         shader_program.set_uniform("shift", shiftx, shifty);
         shader_program.set_uniform("max_radius", max_radius);
         shader_program.set_uniform("tex", 0);
+        shader_program.set_uniform("cpu_values", cpu_tiles);
+        shader_program.set_uniform("values", 1);
         shader_program.use();
         glBindVertexArray(vao);
         glActiveTexture(GL_TEXTURE0);
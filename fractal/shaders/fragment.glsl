@@ -9,6 +9,9 @@ uniform vec2 center;
 uniform vec2 shift;
 uniform float max_radius;
 uniform sampler1D tex;
+// Set when the escape values were computed on the CPU and uploaded into `values`.
+uniform bool cpu_values;
+uniform sampler2D values;
 
 const vec4 fcolor = vec4(1, 0, 0, 1);
 const vec4 scolor = vec4(0, 0, 1, 1);
@@ -19,9 +22,14 @@ void main() {
 	vec2 c = nm;
 	float value = 0.0;
 	int i = 0;
-	for (; i < max_iterations && value < max_radius; ++i) {
-		nm = vec2(nm.x * nm.x - nm.y * nm.y, nm.x * nm.y + nm.y * nm.x) + c;
-		value = nm.x * nm.x + nm.y * nm.y;
+	if (cpu_values) {
+		value = texture(values, pos.xy * 0.5 + 0.5).r;
+	}
+	else {
+		for (; i < max_iterations && value < max_radius; ++i) {
+			nm = vec2(nm.x * nm.x - nm.y * nm.y, nm.x * nm.y + nm.y * nm.x) + c;
+			value = nm.x * nm.x + nm.y * nm.y;
+		}
 	}
 	if (value < max_radius) {
 		// out_color = mix(fcolor, scolor, distance(nm, c) * 1.5);
@@ -5,16 +5,21 @@
 #include <fmt/format.h>
 #include <optional>
 #include <array>
+#include <chrono>
 
 #include <imgui.h>
 #include "../bindings/imgui_impl_glfw.h"
 #include "../bindings/imgui_impl_opengl3.h"
 
 #include "shader_program.hpp"
+#include "shader_watcher.hpp"
+#include "gl_state.hpp"
 #include "mesh.hpp"
 #include "model.hpp"
+#include "texture_registry.hpp"
 #include "camera.hpp"
 #include "skybox.hpp"
+#include "job_system.hpp"
 
 
 const unsigned int initial_width = 1080;
@@ -64,7 +69,7 @@ std::optional<GLFWwindow*> init() {
         return std::nullopt;
     }
     glfwSetFramebufferSizeCallback(window, [](GLFWwindow* window, int width, int height) {
-        glViewport(0, 0, width, height);
+        gl_state::viewport(0, 0, width, height);
     });
     glfwSetCursorPosCallback(window, [](GLFWwindow* window, double xpos, double ypos) {
         if (first_mouse) {
@@ -119,23 +124,38 @@ int main(int argc, char** argv) {
         return 1;
     }
     auto window = init_result.value();
-    glEnable(GL_DEPTH_TEST);
+    gl_state::enable(GL_DEPTH_TEST);
 
     auto model_shader = shader_program(
         "../shaders/scene_vertex.glsl",
         "../shaders/scene_fragment.glsl"
     );
+    job_system jobs;
     std::array<model, 3> models = {
-        model("assets/models/lemur", "lemur.obj"),
-        model("assets/models/cat", "12221_Cat_v1_l3.obj"),
-        model("assets/models/astronaut", "Astronaut.obj")
+        model("assets/models/lemur", "lemur.obj", jobs),
+        model("assets/models/cat", "12221_Cat_v1_l3.obj", jobs),
+        model("assets/models/astronaut", "Astronaut.obj", jobs)
     };
+    texture_registry::print_usage();
+    auto skyboxes_start = std::chrono::steady_clock::now();
     std::array<std::tuple<GLuint, GLuint, GLuint, shader_program>, 4> skyboxes = {
-        skybox::create_skybox("assets/skyboxes/water", "jpg"),
-        skybox::create_skybox("assets/skyboxes/debug", "jpg"),
-        skybox::create_skybox("assets/skyboxes/forest1", "jpg"),
-        skybox::create_skybox("assets/skyboxes/forest2", "jpg"),
+        skybox::create_skybox("assets/skyboxes/water", "jpg", jobs),
+        skybox::create_skybox("assets/skyboxes/debug", "jpg", jobs),
+        skybox::create_skybox("assets/skyboxes/forest1", "jpg", jobs),
+        skybox::create_skybox("assets/skyboxes/forest2", "jpg", jobs),
     };
+    fmt::print(
+        "Loaded {} skyboxes in {} ms on {} threads\n",
+        skyboxes.size(),
+        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - skyboxes_start).count(),
+        jobs.size()
+    );
+    for (const auto& stats: jobs.reset_stats()) {
+        fmt::print("  {} jobs, {} stolen, {:.1f} ms busy\n", stats.jobs, stats.stolen, stats.busy_ms);
+    }
+
+    shader_watcher shaders_watcher({"../shaders"});
+    shaders_watcher.watch(model_shader);
 
     auto delta_time = 0.0f;
     auto last_frame = 0.0f;
@@ -153,16 +173,15 @@ int main(int argc, char** argv) {
         delta_time = current_time - last_frame;
         last_frame = current_time;
 
-        if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS) {
-            model_shader = shader_program("../shaders/scene_vertex.glsl", "../shaders/scene_fragment.glsl");
-        }
+        shaders_watcher.update();
         if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS) {
             break;
         }
         process_input(window, delta_time);
+        const auto gl_call_stats = gl_state::reset_stats();
 
         auto [display_width, display_height] = get_window_size(window);
-        glViewport(0, 0, display_width, display_height);
+        gl_state::viewport(0, 0, display_width, display_height);
         glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -177,6 +196,7 @@ int main(int argc, char** argv) {
         ImGui::Combo("Model", &model_index, "lemur\0cat\0astronaut\0\0");
         ImGui::Combo("Skybox", &skybox_index, "water\0debug\0forest1\0forest2\0\0");
         ImGui::Checkbox("Rotation", &rotation_enabled);
+        ImGui::Text("GL state calls: %zu requested, %zu issued", gl_call_stats.requested, gl_call_stats.issued);
         ImGui::End();
         if (!ImGui::IsAnyWindowFocused()) {
             auto delta = ImGui::GetMouseDragDelta(0, 0);
@@ -218,8 +238,7 @@ int main(int argc, char** argv) {
         model_shader.set_uniform("refraction_ratio", refraction_ratio);
         model_shader.set_uniform("texture_balance", texture_balance);
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, skybox_texture);
+        gl_state::bind_texture(0, GL_TEXTURE_CUBE_MAP, skybox_texture);
         actual_model.draw(model_shader);
 
         skybox::draw(
@@ -232,6 +251,8 @@ int main(int argc, char** argv) {
 
         ImGui::Render();
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        // ImGui sets up its own program, textures and blending behind the cache.
+        gl_state::invalidate();
         glfwSwapBuffers(window);
     }
     dispose_ui();
@@ -8,6 +8,9 @@
 #include <vector>
 #include <string>
 #include <iostream>
+#include <memory>
+
+#include "gl_state.hpp"
 
 struct vertex {
     vertex(glm::vec3 position, glm::vec3 normal, glm::vec2 texcoords):
@@ -19,10 +22,12 @@ struct vertex {
 };
 
 struct texture {
-    texture(GLuint id, std::string type): id(id), type(std::move(type)) {}
+    texture(GLuint id, std::string type, std::shared_ptr<const void> owner = nullptr): id(id), type(std::move(type)), owner(std::move(owner)) {}
 
     GLuint id;
     std::string type;
+    // Keeps what the id belongs to alive while a mesh has it, such as a texture of the texture registry.
+    std::shared_ptr<const void> owner;
 };
 
 class mesh {
@@ -38,7 +43,6 @@ public:
         int specular_textures = 1;
         int normal_textures = 1;
         for (size_t index = 0; index < textures.size(); index += 1) {
-            glActiveTexture(GL_TEXTURE1 + index);
             std::string number;
             auto name = textures[index].type;
             if(name == "texture_diffuse") {
@@ -47,12 +51,10 @@ public:
                 number = std::to_string(normal_textures++);
             }
             shader.set_uniform(name + number, (int)(index + 1));
-            glBindTexture(GL_TEXTURE_2D, textures[index].id);
+            gl_state::bind_texture(index + 1, GL_TEXTURE_2D, textures[index].id);
         }
-        glActiveTexture(GL_TEXTURE0);
-        glBindVertexArray(vao);
+        gl_state::bind_vertex_array(vao);
         glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
     }
 
     std::vector<vertex> vertices;
@@ -65,7 +67,7 @@ private:
         glGenVertexArrays(1, &vao);
         glGenBuffers(1, &vbo);
         glGenBuffers(1, &ebo);
-        glBindVertexArray(vao);
+        gl_state::bind_vertex_array(vao);
         glBindBuffer(GL_ARRAY_BUFFER, vbo);
         glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(vertex), vertices.data(), GL_STATIC_DRAW);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
@@ -77,7 +79,7 @@ private:
         glEnableVertexAttribArray(2);
         glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)offsetof(vertex, texcoords));
 
-        glBindVertexArray(0);
+        gl_state::bind_vertex_array(0);
     }
 
     GLuint vao;
@@ -15,8 +15,12 @@
 #include <assimp/postprocess.h>
 #include <fmt/format.h>
 #include "stb_image_wrapper.hpp"
-#include <map>
+#include "gl_state.hpp"
+#include "mesh_cache.hpp"
+#include "obj_loader.hpp"
+#include "texture_registry.hpp"
 #include <limits>
+#include <chrono>
 
 namespace details {
     GLuint load_texture(const std::string& path, bool gamma = true) {
@@ -42,7 +46,7 @@ namespace details {
             format = GL_RGBA;
         }
 
-        glBindTexture(GL_TEXTURE_2D, textureID);
+        gl_state::bind_texture(GL_TEXTURE_2D, textureID);
         glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
         glGenerateMipmap(GL_TEXTURE_2D);
 
@@ -57,13 +61,22 @@ namespace details {
 
 class model {
 public:
-    explicit model(const std::string& path, const std::string& filename): path(path) {
-        Assimp::Importer importer;
-        auto scene = importer.ReadFile(fmt::format("{}/{}", path, filename), aiProcess_Triangulate | aiProcess_FlipUVs);
-        if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
-            throw std::runtime_error(importer.GetErrorString());
+    // Meshes come from the mesh cache next to the file when it is up to date, otherwise from the OBJ loader or Assimp,
+    // and the cache is written for the next run.
+    model(const std::string& path, const std::string& filename, job_system& jobs): path(path) {
+        const auto source = fmt::format("{}/{}", path, filename);
+        const auto start = std::chrono::steady_clock::now();
+        auto cached = mesh_cache::read(source);
+        if (cached.has_value()) {
+            fmt::print("Read {} meshes from the mesh cache in {:.1f} ms\n", cached->size(), milliseconds_since(start));
+        } else {
+            cached = import_meshes(source, jobs);
+            fmt::print("Imported {} meshes in {:.1f} ms\n", cached->size(), milliseconds_since(start));
+            mesh_cache::write(source, *cached);
+        }
+        for (auto& source_mesh: *cached) {
+            meshes.push_back(create_mesh(std::move(source_mesh)));
         }
-        process_node(scene->mRootNode, scene);
     }
 
     void draw(shader_program& shader) {
@@ -78,15 +91,33 @@ public:
 private:
     std::string path;
     std::vector<mesh> meshes;
-    std::map<std::string, texture> texture_cache;
 
-    void process_node(aiNode* node, const aiScene* scene) {
+    static float milliseconds_since(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // OBJ files go through the native loader, everything else through Assimp.
+    std::vector<mesh_cache::cached_mesh> import_meshes(const std::string& source, job_system& jobs) {
+        if (obj_loader::is_obj(source)) {
+            return obj_loader::load(source, jobs);
+        }
+        Assimp::Importer importer;
+        auto scene = importer.ReadFile(source, aiProcess_Triangulate | aiProcess_FlipUVs);
+        if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
+            throw std::runtime_error(importer.GetErrorString());
+        }
+        std::vector<mesh_cache::cached_mesh> result;
+        process_node(scene->mRootNode, scene, result);
+        return result;
+    }
+
+    void process_node(aiNode* node, const aiScene* scene, std::vector<mesh_cache::cached_mesh>& result) {
         for (size_t mesh_index = 0; mesh_index < node->mNumMeshes; mesh_index += 1) {
             aiMesh* mesh = scene->mMeshes[node->mMeshes[mesh_index]];
-            meshes.push_back(process_mesh(mesh, scene));
+            result.push_back(process_mesh(mesh, scene));
         }
         for (size_t index = 0; index < node->mNumChildren; index += 1) {
-            process_node(node->mChildren[index], scene);
+            process_node(node->mChildren[index], scene, result);
         }
     }
 
@@ -97,57 +128,74 @@ private:
         return glm::vec2(0, 0);
     }
 
-    mesh process_mesh(const aiMesh* raw_mesh, const aiScene* raw_scene) {
-        std::vector<vertex> vertices;
+    // Everything the model needs from Assimp, which is also what the mesh cache keeps.
+    mesh_cache::cached_mesh process_mesh(const aiMesh* raw_mesh, const aiScene* raw_scene) {
+        mesh_cache::cached_mesh result;
         for (size_t vertex_index = 0; vertex_index < raw_mesh->mNumVertices; vertex_index += 1) {
             auto vertex = glm::vec3(
                 raw_mesh->mVertices[vertex_index].x,
                 raw_mesh->mVertices[vertex_index].y,
                 raw_mesh->mVertices[vertex_index].z
             );
-            min_values = glm::min(min_values, vertex);
-            max_values = glm::max(max_values, vertex);
-            vertices.emplace_back(
+            result.min_values = glm::min(result.min_values, vertex);
+            result.max_values = glm::max(result.max_values, vertex);
+            result.vertices.emplace_back(
                 vertex,
                 glm::vec3(raw_mesh->mNormals[vertex_index].x, raw_mesh->mNormals[vertex_index].y,
                           raw_mesh->mNormals[vertex_index].z),
                 get_texture_corrdinats_for_vertex(raw_mesh, vertex_index)
             );
         }
-        std::vector<GLuint> indices;
         for (size_t face_index = 0; face_index < raw_mesh->mNumFaces; face_index += 1) {
             auto face = raw_mesh->mFaces[face_index];
             for (size_t index = 0; index < face.mNumIndices; index += 1) {
-                indices.push_back(face.mIndices[index]);
+                result.indices.push_back(face.mIndices[index]);
             }
         }
-        std::vector<texture> textures;
         if (raw_mesh->mMaterialIndex >= 0) {
             auto material = raw_scene->mMaterials[raw_mesh->mMaterialIndex];
-            auto diffuse = load_material_textures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-            auto normals = load_material_textures(material, aiTextureType_HEIGHT, "texture_normal");
-            textures.insert(textures.end(), diffuse.begin(), diffuse.end());
-            textures.insert(textures.end(), normals.begin(), normals.end());
+            result.diffuse_textures = get_texture_names(material, aiTextureType_DIFFUSE);
+            result.normal_textures = get_texture_names(material, aiTextureType_HEIGHT);
         }
-        return mesh(vertices, indices, textures);
+        return result;
     }
 
-    std::vector<texture> load_material_textures(const aiMaterial* mat, aiTextureType type, std::string type_name) {
+    mesh create_mesh(mesh_cache::cached_mesh source) {
+        min_values = glm::min(min_values, source.min_values);
+        max_values = glm::max(max_values, source.max_values);
         std::vector<texture> textures;
+        load_textures(source.diffuse_textures, "texture_diffuse", textures);
+        load_textures(source.normal_textures, "texture_normal", textures);
+        return mesh(std::move(source.vertices), std::move(source.indices), std::move(textures));
+    }
+
+    // File names of the material's textures of the type, relative to the model's directory.
+    static std::vector<std::string> get_texture_names(const aiMaterial* mat, aiTextureType type) {
+        std::vector<std::string> names;
         for (unsigned int i = 0; i < mat->GetTextureCount(type); i++) {
             aiString str;
             mat->GetTexture(type, i, &str);
-            auto texture_path = fmt::format("{}/{}", path, str.C_Str());
-            auto cache_entry = texture_cache.find(texture_path);
-            if (cache_entry != texture_cache.end()) {
-                textures.emplace_back(cache_entry->second);
-            } else {
-                auto actual_texture = texture(details::load_texture(texture_path), type_name);
-                textures.emplace_back(actual_texture);
-                texture_cache.insert_or_assign(texture_path, actual_texture);
+            names.emplace_back(str.C_Str());
+        }
+        return names;
+    }
+
+    // Textures of the texture registry, shared with the other models; the ones none of them loaded yet are loaded here.
+    void load_textures(const std::vector<std::string>& names, const std::string& type_name, std::vector<texture>& textures) {
+        std::vector<std::string> paths;
+        for (const auto& name: names) {
+            paths.push_back(fmt::format("{}/{}", path, name));
+        }
+        auto references = texture_registry::acquire(paths, {}, [](const std::vector<std::string>& missing, const std::vector<bool>& gamma) {
+            std::vector<GLuint> ids;
+            for (size_t index = 0; index < missing.size(); index += 1) {
+                ids.push_back(details::load_texture(missing[index], gamma[index]));
             }
+            return ids;
+        });
+        for (const auto& reference: references) {
+            textures.emplace_back(texture_registry::id_of(reference), type_name, reference);
         }
-        return textures;
     }
 };
 
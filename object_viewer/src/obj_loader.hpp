@@ -0,0 +1,484 @@
+#ifndef OBJ_LOADER_HPP
+#define OBJ_LOADER_HPP
+
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <glm/glm.hpp>
+#include <fmt/core.h>
+
+#include "file_io.hpp"
+#include "job_system.hpp"
+#include "mesh_cache.hpp"
+
+// Wavefront OBJ and MTL loader for the models the programs ship with, producing the meshes models otherwise get from
+// Assimp with aiProcess_Triangulate | aiProcess_FlipUVs. The file is mapped and cut at line boundaries into chunks
+// that are parsed on the job system in two passes: the first counts the positions, texture coordinates and normals of
+// every chunk, so that the second knows where to store its own and how to resolve negative indices. Faces are fan
+// triangulated and split into one mesh per group and material, in the order they first appear. Corners with the same
+// position, texture coordinate and normal share a vertex within a chunk and mesh; the few used on both sides of a chunk
+// border are stored twice.
+// Understood: v, vt, vn, f, o, g, usemtl and mtllib, in libraries newmtl, Kd, map_Kd, map_bump and bump.
+namespace obj_loader {
+    namespace details {
+        // Corner without a texture coordinate or normal, and one referring to an element the file does not have.
+        constexpr uint32_t missing = UINT32_MAX;
+        constexpr uint32_t out_of_range = UINT32_MAX - 1;
+
+        struct corner {
+            uint32_t position;
+            uint32_t texcoord;
+            uint32_t normal;
+
+            bool operator==(const corner& other) const {
+                return position == other.position && texcoord == other.texcoord && normal == other.normal;
+            }
+        };
+
+        // Faces between two o, g or usemtl lines; the first run of a chunk continues whatever the chunks before set.
+        struct run {
+            bool sets_object = false;
+            bool sets_material = false;
+            std::string object;
+            std::string material;
+            std::vector<corner> corners;
+        };
+
+        struct chunk {
+            const char* begin;
+            const char* end;
+            size_t positions = 0;
+            size_t texcoords = 0;
+            size_t normals = 0;
+            std::vector<run> runs;
+            std::vector<std::string> libraries;
+            std::string error;
+        };
+
+        struct material {
+            // The default of Assimp's OBJ importer, also used for faces without a known material.
+            glm::vec3 diffuse = glm::vec3(0.6f);
+            std::string diffuse_texture;
+            std::string normal_texture;
+        };
+
+        struct line {
+            std::string_view keyword;
+            const char* at;
+            const char* end;
+        };
+
+        inline bool is_space(char value) {
+            return value == ' ' || value == '\t' || value == '\r';
+        }
+
+        inline const char* skip_spaces(const char* at, const char* end) {
+            while (at < end && is_space(*at)) {
+                at += 1;
+            }
+            return at;
+        }
+
+        // Splits the line starting at `at` into its keyword and the rest, and moves `at` to the next line.
+        inline line next_line(const char*& at, const char* end) {
+            auto newline = (const char*)std::memchr(at, '\n', (size_t)(end - at));
+            auto line_end = newline != nullptr ? newline : end;
+            auto start = skip_spaces(at, line_end);
+            auto keyword_end = start;
+            while (keyword_end < line_end && !is_space(*keyword_end)) {
+                keyword_end += 1;
+            }
+            at = newline != nullptr ? newline + 1 : end;
+            return {std::string_view(start, (size_t)(keyword_end - start)), keyword_end, line_end};
+        }
+
+        inline std::string rest_of_line(const line& target) {
+            auto begin = skip_spaces(target.at, target.end);
+            auto end = target.end;
+            while (end > begin && is_space(end[-1])) {
+                end -= 1;
+            }
+            return std::string(begin, end);
+        }
+
+        inline float parse_float(const char*& at, const char* end) {
+            at = skip_spaces(at, end);
+            float value = 0.0f;
+            auto result = std::from_chars(at, end, value);
+            at = result.ptr;
+            return value;
+        }
+
+        // Index `value` of an element among `before` that came earlier in the file and `total` in all of it.
+        inline uint32_t resolve(long long value, size_t before, size_t total) {
+            auto index = value > 0 ? value - 1 : (long long)before + value;
+            return value != 0 && index >= 0 && (size_t)index < total ? (uint32_t)index : out_of_range;
+        }
+
+        inline bool parse_index(const char*& at, const char* end, long long& value) {
+            auto result = std::from_chars(at, end, value);
+            at = result.ptr;
+            return result.ec == std::errc();
+        }
+
+        // Cuts the text into about `count` pieces that end after a newline.
+        inline std::vector<chunk> split(const char* begin, const char* end, size_t count) {
+            std::vector<chunk> chunks;
+            auto size = (size_t)(end - begin);
+            auto at = begin;
+            for (size_t index = 1; index <= count && at < end; index += 1) {
+                auto target = begin + size * index / count;
+                if (target < at) {
+                    continue;
+                }
+                auto newline = (const char*)std::memchr(target, '\n', (size_t)(end - target));
+                auto chunk_end = newline != nullptr && index < count ? newline + 1 : end;
+                chunks.push_back({at, chunk_end});
+                at = chunk_end;
+            }
+            return chunks;
+        }
+
+        inline void count_elements(chunk& target) {
+            auto at = target.begin;
+            while (at < target.end) {
+                auto current = next_line(at, target.end);
+                if (current.keyword == "v") {
+                    target.positions += 1;
+                } else if (current.keyword == "vt") {
+                    target.texcoords += 1;
+                } else if (current.keyword == "vn") {
+                    target.normals += 1;
+                }
+            }
+        }
+
+        struct elements {
+            std::vector<glm::vec3> positions;
+            std::vector<glm::vec2> texcoords;
+            std::vector<glm::vec3> normals;
+        };
+
+        // Second pass over a chunk, the counts of the chunk are replaced by the counts of all chunks before it.
+        inline void parse(chunk& target, elements& all) {
+            auto positions = target.positions;
+            auto texcoords = target.texcoords;
+            auto normals = target.normals;
+            target.runs.emplace_back();
+            auto at = target.begin;
+            std::vector<corner> face;
+            while (at < target.end && target.error.empty()) {
+                auto current = next_line(at, target.end);
+                auto value = current.at;
+                if (current.keyword == "v") {
+                    auto x = parse_float(value, current.end);
+                    auto y = parse_float(value, current.end);
+                    auto z = parse_float(value, current.end);
+                    all.positions[positions++] = glm::vec3(x, y, z);
+                } else if (current.keyword == "vt") {
+                    auto u = parse_float(value, current.end);
+                    auto v = parse_float(value, current.end);
+                    all.texcoords[texcoords++] = glm::vec2(u, 1.0f - v);
+                } else if (current.keyword == "vn") {
+                    auto x = parse_float(value, current.end);
+                    auto y = parse_float(value, current.end);
+                    auto z = parse_float(value, current.end);
+                    all.normals[normals++] = glm::vec3(x, y, z);
+                } else if (current.keyword == "f") {
+                    face.clear();
+                    while (true) {
+                        value = skip_spaces(value, current.end);
+                        if (value == current.end) {
+                            break;
+                        }
+                        // p, p/t, p//n or p/t/n
+                        corner parsed = {missing, missing, missing};
+                        long long index = 0;
+                        auto valid = parse_index(value, current.end, index);
+                        parsed.position = resolve(index, positions, all.positions.size());
+                        if (valid && value < current.end && *value == '/') {
+                            value += 1;
+                            if (value < current.end && *value != '/') {
+                                valid = parse_index(value, current.end, index);
+                                parsed.texcoord = resolve(index, texcoords, all.texcoords.size());
+                            }
+                            if (valid && value < current.end && *value == '/') {
+                                value += 1;
+                                valid = parse_index(value, current.end, index);
+                                parsed.normal = resolve(index, normals, all.normals.size());
+                            }
+                        }
+                        if (!valid || (value < current.end && !is_space(*value))) {
+                            target.error = "malformed face";
+                            break;
+                        }
+                        if (parsed.position == out_of_range || parsed.texcoord == out_of_range || parsed.normal == out_of_range) {
+                            target.error = "face index out of range";
+                            break;
+                        }
+                        face.push_back(parsed);
+                    }
+                    auto& corners = target.runs.back().corners;
+                    for (size_t index = 2; index < face.size(); index += 1) {
+                        corners.push_back(face[0]);
+                        corners.push_back(face[index - 1]);
+                        corners.push_back(face[index]);
+                    }
+                } else if (current.keyword == "o" || current.keyword == "g" || current.keyword == "usemtl") {
+                    if (!target.runs.back().corners.empty()) {
+                        target.runs.emplace_back();
+                    }
+                    auto& changed = target.runs.back();
+                    if (current.keyword == "usemtl") {
+                        changed.sets_material = true;
+                        changed.material = rest_of_line(current);
+                    } else {
+                        changed.sets_object = true;
+                        changed.object = rest_of_line(current);
+                    }
+                } else if (current.keyword == "mtllib") {
+                    target.libraries.push_back(rest_of_line(current));
+                }
+            }
+        }
+
+        // Missing libraries are only reported, their materials fall back to the default one like in Assimp.
+        inline void read_materials(const std::string& path, std::unordered_map<std::string, material>& materials) {
+            std::ifstream file(path, std::ios::binary);
+            if (!file) {
+                fmt::print("Failed to open material library {}\n", path);
+                return;
+            }
+            const std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            auto at = text.data();
+            const auto end = text.data() + text.size();
+            material* current_material = nullptr;
+            while (at < end) {
+                auto current = next_line(at, end);
+                if (current.keyword == "newmtl") {
+                    current_material = &materials[rest_of_line(current)];
+                    continue;
+                }
+                if (current_material == nullptr) {
+                    continue;
+                }
+                auto value = current.at;
+                if (current.keyword == "Kd") {
+                    auto r = parse_float(value, current.end);
+                    auto g = parse_float(value, current.end);
+                    auto b = parse_float(value, current.end);
+                    current_material->diffuse = glm::vec3(r, g, b);
+                } else if (current.keyword == "map_Kd" || current.keyword == "map_bump" || current.keyword == "bump") {
+                    // Options come first, the file name is the last word.
+                    auto name = rest_of_line(current);
+                    auto space = name.find_last_of(" \t");
+                    if (space != std::string::npos) {
+                        name = name.substr(space + 1);
+                    }
+                    (current.keyword == "map_Kd" ? current_material->diffuse_texture : current_material->normal_texture) = name;
+                }
+            }
+        }
+
+        inline size_t hash(const corner& target) {
+            uint64_t value = ((uint64_t)target.position * 0x9e3779b97f4a7c15ull) ^ ((uint64_t)target.texcoord * 0xc2b2ae3d27d4eb4full) ^ ((uint64_t)target.normal * 0x165667b19e3779f9ull);
+            return (size_t)(value ^ (value >> 29));
+        }
+
+        // Vertices and indices of the corners of the runs of one chunk that belong to the same mesh, every distinct
+        // corner becomes one vertex.
+        struct piece {
+            std::vector<const std::vector<corner>*> runs;
+            const material* surface;
+            size_t mesh;
+            std::vector<vertex> vertices;
+            std::vector<GLuint> indices;
+            glm::vec3 min_values = glm::vec3(std::numeric_limits<float>::max());
+            glm::vec3 max_values = glm::vec3(std::numeric_limits<float>::lowest());
+        };
+
+        inline void build(piece& target, const elements& all) {
+            size_t corner_count = 0;
+            for (const auto* corners: target.runs) {
+                corner_count += corners->size();
+            }
+            // Open addressing with linear probing, at most half full.
+            size_t capacity = 16;
+            while (capacity < corner_count * 2) {
+                capacity *= 2;
+            }
+            std::vector<uint32_t> slots(capacity, missing);
+            std::vector<corner> keys;
+            target.indices.reserve(corner_count);
+            for (const auto* corners: target.runs) {
+                for (const auto& key: *corners) {
+                    auto slot = hash(key) & (capacity - 1);
+                    while (slots[slot] != missing && !(keys[slots[slot]] == key)) {
+                        slot = (slot + 1) & (capacity - 1);
+                    }
+                    if (slots[slot] == missing) {
+                        slots[slot] = (uint32_t)keys.size();
+                        keys.push_back(key);
+                        auto position = all.positions[key.position];
+                        auto normal = key.normal != missing ? all.normals[key.normal] : glm::vec3(0.0f);
+                        auto texcoords = key.texcoord != missing ? all.texcoords[key.texcoord] : glm::vec2(0.0f);
+                        // Vertices with a color take the diffuse color of the material, like models do from Assimp.
+                        if constexpr (std::is_constructible_v<vertex, glm::vec3, glm::vec3, glm::vec2, glm::vec3>) {
+                            target.vertices.emplace_back(position, normal, texcoords, target.surface->diffuse);
+                        } else {
+                            target.vertices.emplace_back(position, normal, texcoords);
+                        }
+                        target.min_values = glm::min(target.min_values, position);
+                        target.max_values = glm::max(target.max_values, position);
+                    }
+                    target.indices.push_back(slots[slot]);
+                }
+            }
+        }
+    }
+
+    inline bool is_obj(const std::string& path) {
+        auto extension = std::filesystem::path(path).extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char value) {
+            return (char)std::tolower(value);
+        });
+        return extension == ".obj";
+    }
+
+    // Throws when the file can not be read or refers to elements it does not have.
+    inline std::vector<mesh_cache::cached_mesh> load(const std::string& path, job_system& jobs) {
+        file_io::mapped_file file(path);
+        if (file.data() == nullptr) {
+            throw std::runtime_error(fmt::format("Failed to open {}", path));
+        }
+        const auto text = (const char*)file.data();
+        // A few chunks per thread so that stealing evens out lines of different cost, none much below a megabyte.
+        const size_t chunk_size = 1 << 20;
+        auto chunks = details::split(text, text + file.size(), std::max<size_t>(1, std::min(jobs.size() * 4, file.size() / chunk_size)));
+        jobs.parallel_for(chunks.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t index = begin; index < end; index += 1) {
+                details::count_elements(chunks[index]);
+            }
+        });
+        details::elements all;
+        size_t positions = 0;
+        size_t texcoords = 0;
+        size_t normals = 0;
+        for (auto& target: chunks) {
+            positions += std::exchange(target.positions, positions);
+            texcoords += std::exchange(target.texcoords, texcoords);
+            normals += std::exchange(target.normals, normals);
+        }
+        all.positions.resize(positions);
+        all.texcoords.resize(texcoords);
+        all.normals.resize(normals);
+        jobs.parallel_for(chunks.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t index = begin; index < end; index += 1) {
+                details::parse(chunks[index], all);
+            }
+        });
+
+        std::unordered_map<std::string, details::material> materials;
+        for (const auto& target: chunks) {
+            if (!target.error.empty()) {
+                throw std::runtime_error(fmt::format("{}: {}", path, target.error));
+            }
+            for (const auto& library: target.libraries) {
+                details::read_materials((std::filesystem::path(path).parent_path() / library).string(), materials);
+            }
+        }
+
+        // Meshes in the order their group and material first show up; the runs of a chunk that go to the same mesh,
+        // however many o, g or usemtl lines come between them, make one piece of it.
+        const details::material default_material;
+        std::vector<const details::material*> mesh_materials;
+        std::unordered_map<std::string, size_t> mesh_indices;
+        std::vector<details::piece> pieces;
+        std::unordered_map<size_t, size_t> chunk_pieces;
+        std::string object;
+        std::string material;
+        for (const auto& target: chunks) {
+            chunk_pieces.clear();
+            for (const auto& current: target.runs) {
+                if (current.sets_object) {
+                    object = current.object;
+                }
+                if (current.sets_material) {
+                    material = current.material;
+                }
+                if (current.corners.empty()) {
+                    continue;
+                }
+                auto key = object + '\n' + material;
+                auto found = mesh_indices.find(key);
+                if (found == mesh_indices.end()) {
+                    auto surface = materials.find(material);
+                    mesh_materials.push_back(surface != materials.end() ? &surface->second : &default_material);
+                    found = mesh_indices.emplace(key, mesh_materials.size() - 1).first;
+                }
+                auto [at, created] = chunk_pieces.try_emplace(found->second, pieces.size());
+                if (created) {
+                    pieces.push_back({{}, mesh_materials[found->second], found->second});
+                }
+                pieces[at->second].runs.push_back(&current.corners);
+            }
+        }
+        jobs.parallel_for(pieces.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t index = begin; index < end; index += 1) {
+                details::build(pieces[index], all);
+            }
+        });
+
+        // Pieces are appended to their meshes, their indices moved past the vertices of the pieces before them.
+        std::vector<mesh_cache::cached_mesh> meshes(mesh_materials.size());
+        std::vector<size_t> index_counts(meshes.size());
+        std::vector<std::pair<size_t, size_t>> offsets(pieces.size());
+        for (size_t index = 0; index < pieces.size(); index += 1) {
+            auto& source = pieces[index];
+            auto& target = meshes[source.mesh];
+            offsets[index] = {target.vertices.size(), index_counts[source.mesh]};
+            index_counts[source.mesh] += source.indices.size();
+            target.vertices.insert(target.vertices.end(), source.vertices.begin(), source.vertices.end());
+            target.min_values = glm::min(target.min_values, source.min_values);
+            target.max_values = glm::max(target.max_values, source.max_values);
+            std::vector<vertex>().swap(source.vertices);
+        }
+        for (size_t index = 0; index < meshes.size(); index += 1) {
+            meshes[index].indices.resize(index_counts[index]);
+        }
+        jobs.parallel_for(pieces.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t index = begin; index < end; index += 1) {
+                auto target = meshes[pieces[index].mesh].indices.data() + offsets[index].second;
+                for (auto value: pieces[index].indices) {
+                    *target++ = (GLuint)(value + offsets[index].first);
+                }
+            }
+        });
+        for (size_t index = 0; index < meshes.size(); index += 1) {
+            if (!mesh_materials[index]->diffuse_texture.empty()) {
+                meshes[index].diffuse_textures.push_back(mesh_materials[index]->diffuse_texture);
+            }
+            if (!mesh_materials[index]->normal_texture.empty()) {
+                meshes[index].normal_textures.push_back(mesh_materials[index]->normal_texture);
+            }
+        }
+        return meshes;
+    }
+}
+
+#endif
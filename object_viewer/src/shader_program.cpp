@@ -1,9 +1,16 @@
 #include "shader_program.hpp"
+#include "gl_state.hpp"
 
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <utility>
+#include <cstring>
+#include <fmt/format.h>
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
 
 namespace {
     std::string read_shader_code(const std::string& filename) {
@@ -17,75 +24,161 @@ namespace {
         }
         std::terminate();
     }
+
+    bool has_parallel_shader_compile() {
+        static const bool supported = []() {
+            GLint count = 0;
+            glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+            for (GLint index = 0; index < count; index += 1) {
+                auto name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, index));
+                if (std::strcmp(name, "GL_KHR_parallel_shader_compile") == 0 ||
+                    std::strcmp(name, "GL_ARB_parallel_shader_compile") == 0) {
+                    return true;
+                }
+            }
+            return false;
+        }();
+        return supported;
+    }
 }
 
 shader_program::shader_program(std::string  vertex_shader_path, std::string  fragment_shader_path):
     vertex_shader_path(std::move(vertex_shader_path)), fragment_shader_path(std::move(fragment_shader_path)) {
-    reload();
+    const auto vertex_code = read_shader_code(this->vertex_shader_path);
+    const auto fragment_code = read_shader_code(this->fragment_shader_path);
+    program_id = link(vertex_code, fragment_code);
+    check_linking_error(program_id);
+}
+
+shader_program::shader_program(shader_program&& other) noexcept:
+    program_id(std::exchange(other.program_id, 0)), pending_program_id(std::exchange(other.pending_program_id, 0)),
+    pending_frames(other.pending_frames), vertex_shader_path(std::move(other.vertex_shader_path)),
+    fragment_shader_path(std::move(other.fragment_shader_path)) {}
+
+shader_program& shader_program::operator=(shader_program&& other) noexcept {
+    if (this != &other) {
+        gl_state::forget_program(program_id);
+        glDeleteProgram(program_id);
+        glDeleteProgram(pending_program_id);
+        program_id = std::exchange(other.program_id, 0);
+        pending_program_id = std::exchange(other.pending_program_id, 0);
+        pending_frames = other.pending_frames;
+        vertex_shader_path = std::move(other.vertex_shader_path);
+        fragment_shader_path = std::move(other.fragment_shader_path);
+    }
+    return *this;
+}
+
+shader_program::~shader_program() {
+    if (pending_program_id != 0) {
+        glDeleteProgram(pending_program_id);
+    }
+    if (program_id != 0) {
+        gl_state::forget_program(program_id);
+        glDeleteProgram(program_id);
+    }
 }
 
 void shader_program::reload() {
     const auto vertex_code = read_shader_code(vertex_shader_path);
     const auto fragment_code = read_shader_code(fragment_shader_path);
-    compile(vertex_code, fragment_code);
-    link();
+    auto new_program_id = link(vertex_code, fragment_code);
+    if (!check_linking_error(new_program_id)) {
+        glDeleteProgram(new_program_id);
+        return;
+    }
+    gl_state::forget_program(program_id);
+    glDeleteProgram(program_id);
+    program_id = new_program_id;
 }
 
-shader_program::~shader_program() {
+void shader_program::begin_reload(const std::string& vertex_code, const std::string& fragment_code) {
+    if (pending_program_id != 0) {
+        glDeleteProgram(pending_program_id);
+    }
+    pending_program_id = link(vertex_code, fragment_code);
+    pending_frames = 0;
+}
+
+bool shader_program::finish_reload() {
+    if (pending_program_id == 0) {
+        return false;
+    }
+    if (has_parallel_shader_compile()) {
+        GLint completed = GL_FALSE;
+        glGetProgramiv(pending_program_id, GL_COMPLETION_STATUS_KHR, &completed);
+        if (completed != GL_TRUE) {
+            return false;
+        }
+    } else if (pending_frames++ < 1) {
+        // Without the extension give the driver one frame before the status query blocks on it.
+        return false;
+    }
+    auto new_program_id = std::exchange(pending_program_id, 0);
+    if (!check_linking_error(new_program_id)) {
+        glDeleteProgram(new_program_id);
+        return false;
+    }
+    gl_state::forget_program(program_id);
+    glDeleteProgram(program_id);
+    program_id = new_program_id;
+    fmt::print("Reloaded shader program: {} {}\n", vertex_shader_path, fragment_shader_path);
+    return true;
 }
 
-void shader_program::compile(const std::string& vertex_code, const std::string& fragment_code)
-{
-    const char* vcode = vertex_code.c_str();
-    vertex_id = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex_id, 1, &vcode, NULL);
-    glCompileShader(vertex_id);
-
-    const char* fcode = fragment_code.c_str();
-    fragment_id = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment_id, 1, &fcode, NULL);
-    glCompileShader(fragment_id);
-    check_compile_error();
+GLuint shader_program::compile(GLenum type, const std::string& code) {
+    const char* source = code.c_str();
+    auto shader_id = glCreateShader(type);
+    glShaderSource(shader_id, 1, &source, NULL);
+    glCompileShader(shader_id);
+    return shader_id;
 }
 
-void shader_program::link() {
-    program_id = glCreateProgram();
-    glAttachShader(program_id, vertex_id);
-    glAttachShader(program_id, fragment_id);
-    glLinkProgram(program_id);
-    check_linking_error();
+GLuint shader_program::link(const std::string& vertex_code, const std::string& fragment_code) {
+    auto vertex_id = compile(GL_VERTEX_SHADER, vertex_code);
+    auto fragment_id = compile(GL_FRAGMENT_SHADER, fragment_code);
+    auto new_program_id = glCreateProgram();
+    glAttachShader(new_program_id, vertex_id);
+    glAttachShader(new_program_id, fragment_id);
+    glLinkProgram(new_program_id);
+    // Shaders stay attached (and queryable) until the program itself is deleted.
     glDeleteShader(vertex_id);
     glDeleteShader(fragment_id);
+    return new_program_id;
 }
 
 void shader_program::use() {
-    glUseProgram(program_id);
+    gl_state::use_program(program_id);
 }
 
-void shader_program::check_compile_error() {
+bool shader_program::check_compile_error(GLuint shader_id, const char* stage) {
     int success;
     char infoLog[1024];
-    glGetShaderiv(vertex_id, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(vertex_id, 1024, NULL, infoLog);
-        std::cerr << "Error compiling Vertex shader_t:\n" << infoLog << std::endl;
-    }
-    glGetShaderiv(fragment_id, GL_COMPILE_STATUS, &success);
+    glGetShaderiv(shader_id, GL_COMPILE_STATUS, &success);
     if (!success)
     {
-        glGetShaderInfoLog(fragment_id, 1024, NULL, infoLog);
-        std::cerr << "Error compiling Fragment shader_t:\n" << infoLog << std::endl;
+        glGetShaderInfoLog(shader_id, 1024, NULL, infoLog);
+        std::cerr << "Error compiling " << stage << " shader_t:\n" << infoLog << std::endl;
     }
+    return success;
 }
 
-void shader_program::check_linking_error() {
+bool shader_program::check_linking_error(GLuint program_id) {
     int success;
     char infoLog[1024];
     glGetProgramiv(program_id, GL_LINK_STATUS, &success);
     if (!success)
     {
+        GLsizei count = 0;
+        GLuint shaders[2];
+        glGetAttachedShaders(program_id, 2, &count, shaders);
+        for (GLsizei index = 0; index < count; index += 1) {
+            GLint type = 0;
+            glGetShaderiv(shaders[index], GL_SHADER_TYPE, &type);
+            check_compile_error(shaders[index], type == GL_VERTEX_SHADER ? "Vertex" : "Fragment");
+        }
         glGetProgramInfoLog(program_id, 1024, NULL, infoLog);
         std::cerr << "Error Linking shader_t Program:\n" << infoLog << std::endl;
     }
+    return success;
 }
@@ -12,12 +12,43 @@ class shader_program {
 public:
     shader_program(std::string  vertex_code_fname, std::string  fragment_code_fname);
 
+    shader_program(const shader_program& other) = delete;
+
+    shader_program& operator=(const shader_program& other) = delete;
+
+    shader_program(shader_program&& other) noexcept;
+
+    shader_program& operator=(shader_program&& other) noexcept;
+
     ~shader_program();
 
     void use();
 
     void reload();
 
+    // Issues compilation of the new sources without waiting for the driver.
+    // The result is picked up by finish_reload() on a later frame.
+    void begin_reload(const std::string& vertex_code, const std::string& fragment_code);
+
+    // Returns true once the pending program has linked and replaced the current one.
+    // A program that failed to link is discarded and the current one is kept.
+    bool finish_reload();
+
+    [[nodiscard]]
+    bool has_pending_reload() const {
+        return pending_program_id != 0;
+    }
+
+    [[nodiscard]]
+    const std::string& get_vertex_shader_path() const {
+        return vertex_shader_path;
+    }
+
+    [[nodiscard]]
+    const std::string& get_fragment_shader_path() const {
+        return fragment_shader_path;
+    }
+
     inline void set_uniform(const std::string& name, int val) {
         glUniform1i(glGetUniformLocation(program_id, name.c_str()), val);
     }
@@ -68,17 +99,17 @@ public:
 
 private:
 
-    void check_compile_error();
+    static bool check_compile_error(GLuint shader_id, const char* stage);
 
-    void check_linking_error();
+    static bool check_linking_error(GLuint program_id);
 
-    void compile(const std::string& vertex_code, const std::string& fragment_code);
+    static GLuint compile(GLenum type, const std::string& code);
 
-    void link();
+    static GLuint link(const std::string& vertex_code, const std::string& fragment_code);
 
-    GLuint vertex_id;
-    GLuint fragment_id;
-    GLuint program_id;
+    GLuint program_id = 0;
+    GLuint pending_program_id = 0;
+    int pending_frames = 0;
     std::string vertex_shader_path;
     std::string fragment_shader_path;
 };
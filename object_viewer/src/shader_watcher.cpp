@@ -0,0 +1,160 @@
+#include "shader_watcher.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <optional>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    std::string normalize_path(const std::string& path) {
+        return std::filesystem::path(path).lexically_normal().generic_string();
+    }
+
+    std::optional<std::string> try_read_file(const std::string& filename) {
+        std::ifstream file(filename);
+        if (!file) {
+            return std::nullopt;
+        }
+        return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    const auto poll_interval = std::chrono::milliseconds(250);
+}
+
+shader_watcher::shader_watcher(std::vector<std::string> directories): directories(std::move(directories)) {
+#ifdef __linux__
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0) {
+        std::cerr << "inotify_init1 failed, falling back to polling shader timestamps" << std::endl;
+    } else {
+        for (const auto& directory: this->directories) {
+            auto descriptor = inotify_add_watch(inotify_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+            if (descriptor < 0) {
+                std::cerr << "Failed to watch shader directory: " << directory << std::endl;
+                continue;
+            }
+            watch_descriptors.insert_or_assign(descriptor, directory);
+        }
+    }
+#endif
+    worker = std::thread(&shader_watcher::run, this);
+}
+
+shader_watcher::~shader_watcher() {
+    running = false;
+    if (worker.joinable()) {
+        worker.join();
+    }
+#ifdef __linux__
+    if (inotify_fd >= 0) {
+        close(inotify_fd);
+    }
+#endif
+}
+
+void shader_watcher::watch(shader_program& program) {
+    std::lock_guard lock(mutex);
+    programs.push_back({
+        &program,
+        normalize_path(program.get_vertex_shader_path()),
+        normalize_path(program.get_fragment_shader_path())
+    });
+}
+
+void shader_watcher::update() {
+    std::vector<pending_sources> ready;
+    {
+        std::lock_guard lock(mutex);
+        ready.swap(pending);
+    }
+    for (auto& sources: ready) {
+        sources.program->begin_reload(sources.vertex_code, sources.fragment_code);
+        if (std::find(compiling.begin(), compiling.end(), sources.program) == compiling.end()) {
+            compiling.push_back(sources.program);
+        }
+    }
+    compiling.erase(std::remove_if(compiling.begin(), compiling.end(), [](shader_program* program) {
+        program->finish_reload();
+        return !program->has_pending_reload();
+    }), compiling.end());
+}
+
+void shader_watcher::run() {
+    std::vector<std::string> changed_files;
+    while (running) {
+        changed_files.clear();
+        wait_for_changes(changed_files);
+        if (!changed_files.empty()) {
+            handle_changes(changed_files);
+        }
+    }
+}
+
+void shader_watcher::wait_for_changes(std::vector<std::string>& changed_files) {
+#ifdef __linux__
+    if (inotify_fd >= 0) {
+        pollfd descriptor = {inotify_fd, POLLIN, 0};
+        if (poll(&descriptor, 1, (int)poll_interval.count()) <= 0) {
+            return;
+        }
+        alignas(inotify_event) char buffer[4096];
+        ssize_t length = 0;
+        while ((length = read(inotify_fd, buffer, sizeof(buffer))) > 0) {
+            for (char* cursor = buffer; cursor < buffer + length;) {
+                auto event = reinterpret_cast<inotify_event*>(cursor);
+                auto directory = watch_descriptors.find(event->wd);
+                if (event->len > 0 && directory != watch_descriptors.end()) {
+                    changed_files.push_back(normalize_path(directory->second + "/" + event->name));
+                }
+                cursor += sizeof(inotify_event) + event->len;
+            }
+        }
+        return;
+    }
+#endif
+    std::this_thread::sleep_for(poll_interval);
+    for (const auto& directory: directories) {
+        std::error_code error;
+        for (const auto& entry: std::filesystem::directory_iterator(directory, error)) {
+            auto path = normalize_path(entry.path().string());
+            auto timestamp = entry.last_write_time(error);
+            auto [iterator, inserted] = timestamps.try_emplace(path, timestamp);
+            if (!inserted && iterator->second != timestamp) {
+                iterator->second = timestamp;
+                changed_files.push_back(path);
+            }
+        }
+    }
+}
+
+void shader_watcher::handle_changes(const std::vector<std::string>& changed_files) {
+    std::vector<watched_program> affected;
+    {
+        std::lock_guard lock(mutex);
+        for (const auto& watched: programs) {
+            for (const auto& file: changed_files) {
+                if (file == watched.vertex_path || file == watched.fragment_path) {
+                    affected.push_back(watched);
+                    break;
+                }
+            }
+        }
+    }
+    for (const auto& watched: affected) {
+        auto vertex_code = try_read_file(watched.vertex_path);
+        auto fragment_code = try_read_file(watched.fragment_path);
+        if (!vertex_code || !fragment_code) {
+            continue;
+        }
+        std::lock_guard lock(mutex);
+        pending.push_back({watched.program, std::move(*vertex_code), std::move(*fragment_code)});
+    }
+}
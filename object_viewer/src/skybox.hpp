@@ -10,6 +10,8 @@
 #include <tuple>
 #include <fmt/format.h>
 #include "shader_program.hpp"
+#include "gl_state.hpp"
+#include "job_system.hpp"
 
 namespace skybox {
     static float vertices[] = {
@@ -56,24 +58,34 @@ namespace skybox {
         1.0f, -1.0f, 1.0f
     };
 
-    inline GLuint load_cubemap(std::vector<std::string> faces) {
+    struct face_image {
+        unsigned char* data = nullptr;
+        int width = 0;
+        int height = 0;
+    };
+
+    // Faces are decoded as jobs, only the uploads happen on the calling thread.
+    inline GLuint load_cubemap(std::vector<std::string> faces, job_system& jobs) {
+        std::vector<face_image> images(faces.size());
+        jobs.parallel_for(faces.size(), 1, [&](size_t i, size_t) {
+            int channels_count;
+            images[i].data = stbi_load(faces[i].c_str(), &images[i].width, &images[i].height, &channels_count, 0);
+        });
+
         unsigned int texture_id;
         glGenTextures(1, &texture_id);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, texture_id);
+        gl_state::bind_texture(GL_TEXTURE_CUBE_MAP, texture_id);
 
-        int width;
-        int height;
-        int channels_count;
         for (unsigned int i = 0; i < faces.size(); i++) {
-            unsigned char* data = stbi_load(faces[i].c_str(), &width, &height, &channels_count, 0);
-            if (data) {
+            auto& image = images[i];
+            if (image.data) {
                 glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
-                             0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data
+                             0, GL_RGB, image.width, image.height, 0, GL_RGB, GL_UNSIGNED_BYTE, image.data
                 );
-                stbi_image_free(data);
+                stbi_image_free(image.data);
             } else {
                 std::cout << "Cubemap tex failed to load at path: " << faces[i] << std::endl;
-                stbi_image_free(data);
+                stbi_image_free(image.data);
             }
         }
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -84,7 +96,7 @@ namespace skybox {
         return texture_id;
     }
 
-    inline auto load_skybox_textures(const std::string& directory, const std::string& format) {
+    inline auto load_skybox_textures(const std::string& directory, const std::string& format, job_system& jobs) {
         return load_cubemap({
             fmt::format("{}/positive-x.{}", directory, format),
             fmt::format("{}/negative-x.{}", directory, format),
@@ -92,39 +104,38 @@ namespace skybox {
             fmt::format("{}/negative-y.{}", directory, format),
             fmt::format("{}/positive-z.{}", directory, format),
             fmt::format("{}/negative-z.{}", directory, format),
-        });
+        }, jobs);
     }
     
-    inline auto create_skybox(const std::string& directory, const std::string& format = "jpg") {
+    inline auto create_skybox(const std::string& directory, const std::string& format, job_system& jobs) {
         GLuint vao;
         GLuint vbo;
         glGenVertexArrays(1, &vao);
         glGenBuffers(1, &vbo);
-        glBindVertexArray(vao);
+        gl_state::bind_vertex_array(vao);
         glBindBuffer(GL_ARRAY_BUFFER, vbo);
         glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), &vertices, GL_STATIC_DRAW);
         glEnableVertexAttribArray(0);
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), nullptr);
-        auto texture = load_skybox_textures(directory, format);
+        gl_state::bind_vertex_array(0);
+        auto texture = load_skybox_textures(directory, format, jobs);
         shader_program shader(
             "shaders/skybox_vertex.glsl",
             "shaders/skybox_fragment.glsl"
         );
-        return std::make_tuple(vao, vbo, texture, shader);
+        return std::make_tuple(vao, vbo, texture, std::move(shader));
     }
 
     inline void draw(GLuint skybox_vao, GLuint skybox_texture, shader_program& skybox_shader, glm::mat4 view, glm::mat4 projection) {
-        glDepthFunc(GL_LEQUAL);
+        gl_state::depth_func(GL_LEQUAL);
         skybox_shader.use();
         skybox_shader.set_uniform("view", view);
         skybox_shader.set_uniform("projection", projection);
         skybox_shader.set_uniform("water", 0);
-        glBindVertexArray(skybox_vao);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, skybox_texture);
+        gl_state::bind_vertex_array(skybox_vao);
+        gl_state::bind_texture(0, GL_TEXTURE_CUBE_MAP, skybox_texture);
         glDrawArrays(GL_TRIANGLES, 0, 36);
-        glBindVertexArray(0);
-        glDepthFunc(GL_LESS);
+        gl_state::depth_func(GL_LESS);
     }
 }
 
@@ -1,9 +1,16 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
+#ifdef INSTANCED
+layout (location = 4) in mat4 instance_model;
+#endif
 
 uniform mat4 lightSpaceMatrix;
 uniform mat4 model;
 
 void main() {
+#ifdef INSTANCED
+    gl_Position = lightSpaceMatrix * model * instance_model * vec4(aPos, 1.0);
+#else
     gl_Position = lightSpaceMatrix * model * vec4(aPos, 1.0);
+#endif
 }
\ No newline at end of file
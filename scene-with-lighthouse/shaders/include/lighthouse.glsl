@@ -0,0 +1,22 @@
+// Projected lighthouse beam, compiled out for passes built with NO_LIGHTHOUSE.
+#ifndef NO_LIGHTHOUSE
+uniform vec3 lighthouse_light_position;
+uniform vec3 lighthouse_light_target_point;
+uniform mat4 lighthouse_light_space_matrix;
+uniform sampler2D lighthouse_projection_texture;
+
+vec4 calc_lighthouse_light(vec3 position) {
+    vec4 fcords = lighthouse_light_space_matrix * vec4(position, 1.0);
+    vec3 projCoords = fcords.xyz / fcords.w;
+    projCoords = projCoords * 0.5 + 0.5;
+    vec2 tc = ((2 * projCoords - 1) / (2 * 0.004)).xy + 0.5;
+    if (tc.x > 1 || tc.x < 0 || tc.y < 0 || tc.y > 1) {
+        return vec4(0);
+    }
+    return texture(lighthouse_projection_texture, tc);
+}
+#else
+vec4 calc_lighthouse_light(vec3 position) {
+    return vec4(0);
+}
+#endif
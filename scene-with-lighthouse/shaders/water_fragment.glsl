@@ -20,31 +20,12 @@ const float water_reflection_value = 1.3;
 const float near = 0.001f;
 const float far = 1000.0f;
 
-uniform vec3 camera_position;
-
-uniform vec3 global_light_position;
-uniform vec3 global_light_color;
-uniform float global_light_ambient_strength;
-uniform float global_light_directional_strength;
+#include "include/lighting.glsl"
+#include "include/lighthouse.glsl"
 
 vec4 calc_global_light(vec3 normal, vec3 object_color) {
-    vec3 _normal = normalize(normal);
-    // ambient
-    vec3 ambient = global_light_ambient_strength * object_color;
-    // diffuse
-    vec3 light_direction = normalize(global_light_position - vertex_position);
-    float diff = max(dot(light_direction, _normal), 0.0);
-    vec3 diffuse = diff * global_light_color;
-    // specular
-    vec3 view_direction = normalize(camera_position - vertex_position);
-    float spec = 0.0;
-    vec3 halfway_direction = normalize(light_direction + view_direction);
-    spec = pow(max(dot(_normal, halfway_direction), 0.0), 86.0);
-    vec3 specular = spec * global_light_color;
-    // calculate shadow
-//    float shadow = ShadowCalculation(FragPosLightSpace);
-    //    vec3 lighting = (ambient + (1.0 - shadow) * (diffuse + specular)) * object_color;
-    vec3 result = (ambient + (diffuse + specular)) * object_color;
+    light_terms light = calc_global_light_terms(vertex_position, normal, object_color);
+    vec3 result = (light.ambient + (light.diffuse + light.specular)) * object_color;
     return vec4(result, 1.0);
 }
 
@@ -64,22 +45,6 @@ float calculate_water_depth(vec2 reflection_tc, vec2 refraction_tc) {
     return water_depth;
 }
 
-uniform vec3 lighthouse_light_position;
-uniform vec3 lighthouse_light_target_point;
-uniform mat4 lighthouse_light_space_matrix;
-uniform sampler2D lighthouse_projection_texture;
-
-vec4 calc_lighthouse_light() {
-    vec4 fcords = lighthouse_light_space_matrix * vec4(vertex_position, 1.0);
-    vec3 projCoords = fcords.xyz / fcords.w;
-    projCoords = projCoords * 0.5 + 0.5;
-    vec2 tc = ((2 * projCoords - 1) / (2 * 0.004)).xy + 0.5;
-    if (tc.x > 1 || tc.x < 0 || tc.y < 0 || tc.y > 1) {
-        return vec4(0);
-    }
-    return texture(lighthouse_projection_texture, tc);
-}
-
 void main() {
     float corrected_time = time * 0.008;
     vec2 distortion_first_coords = (texcoord + vec2(sin(corrected_time), cos(corrected_time))) * distortion_tiling;
@@ -102,7 +67,7 @@ void main() {
 
     float depth_alpha = clamp(calculate_water_depth(reflection_tc, refraction_tc), 0, 1);
 
-    vec4 base_color = vec4(0, 0.2, 0.5, 1.0) + calc_lighthouse_light();
+    vec4 base_color = vec4(0, 0.2, 0.5, 1.0) + calc_lighthouse_light(vertex_position);
     vec4 reflection_refraction_color = mix(reflection_color, refraction_color, calculate_reflective_factor(vec3(0.0, 1.0, 0.0)));
     vec4 object_color = mix(reflection_refraction_color, base_color, 0.1);
     FragColor = calc_global_light(normal, object_color.rgb) * 1.4;
@@ -0,0 +1,349 @@
+#ifndef BC_ENCODER_HPP
+#define BC_ENCODER_HPP
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+// Block compression of 4x4 pixel blocks for the GPU, fast enough to run on first load.
+// Endpoints start as the corners of the block's bounding box along the diagonal its colors follow, moved inwards by a
+// sixteenth, and every pixel takes the palette entry nearest to its projection on the line between them; one least
+// squares fit of the endpoints to those entries follows. Bounds and projections of the 16 pixels are computed with
+// SSE2 where available.
+// Pixels are RGBA, row by row; single channel blocks are 16 bytes.
+namespace bc_encoder {
+    namespace details {
+        // Smallest and largest value of every channel over the block.
+        inline void bounds(const uint8_t* pixels, uint8_t* min, uint8_t* max) {
+#if defined(__SSE2__) || defined(_M_X64)
+            auto p0 = _mm_loadu_si128((const __m128i*)pixels);
+            auto p1 = _mm_loadu_si128((const __m128i*)(pixels + 16));
+            auto p2 = _mm_loadu_si128((const __m128i*)(pixels + 32));
+            auto p3 = _mm_loadu_si128((const __m128i*)(pixels + 48));
+            auto low = _mm_min_epu8(_mm_min_epu8(p0, p1), _mm_min_epu8(p2, p3));
+            auto high = _mm_max_epu8(_mm_max_epu8(p0, p1), _mm_max_epu8(p2, p3));
+            low = _mm_min_epu8(low, _mm_shuffle_epi32(low, _MM_SHUFFLE(1, 0, 3, 2)));
+            high = _mm_max_epu8(high, _mm_shuffle_epi32(high, _MM_SHUFFLE(1, 0, 3, 2)));
+            low = _mm_min_epu8(low, _mm_shuffle_epi32(low, _MM_SHUFFLE(2, 3, 0, 1)));
+            high = _mm_max_epu8(high, _mm_shuffle_epi32(high, _MM_SHUFFLE(2, 3, 0, 1)));
+            auto packed_low = (uint32_t)_mm_cvtsi128_si32(low);
+            auto packed_high = (uint32_t)_mm_cvtsi128_si32(high);
+            std::memcpy(min, &packed_low, 4);
+            std::memcpy(max, &packed_high, 4);
+#else
+            for (int channel = 0; channel < 4; channel += 1) {
+                min[channel] = 255;
+                max[channel] = 0;
+                for (int pixel = 0; pixel < 16; pixel += 1) {
+                    min[channel] = std::min(min[channel], pixels[pixel * 4 + channel]);
+                    max[channel] = std::max(max[channel], pixels[pixel * 4 + channel]);
+                }
+            }
+#endif
+        }
+
+        // dot(pixel - origin, direction) of every pixel; channels with a zero direction do not count.
+        inline void project(const uint8_t* pixels, const int* origin, const int* direction, int32_t* dots) {
+#if defined(__SSE2__) || defined(_M_X64)
+            const auto zero = _mm_setzero_si128();
+            const auto start = _mm_setr_epi16(
+                (short)origin[0], (short)origin[1], (short)origin[2], (short)origin[3],
+                (short)origin[0], (short)origin[1], (short)origin[2], (short)origin[3]
+            );
+            const auto axis = _mm_setr_epi16(
+                (short)direction[0], (short)direction[1], (short)direction[2], (short)direction[3],
+                (short)direction[0], (short)direction[1], (short)direction[2], (short)direction[3]
+            );
+            for (int quarter = 0; quarter < 4; quarter += 1) {
+                auto four = _mm_loadu_si128((const __m128i*)(pixels + quarter * 16));
+                // Two pixels per register, then rg and ba sums of each pixel side by side.
+                auto first = _mm_madd_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(four, zero), start), axis);
+                auto second = _mm_madd_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(four, zero), start), axis);
+                auto even = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(first), _mm_castsi128_ps(second), _MM_SHUFFLE(2, 0, 2, 0)));
+                auto odd = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(first), _mm_castsi128_ps(second), _MM_SHUFFLE(3, 1, 3, 1)));
+                _mm_storeu_si128((__m128i*)(dots + quarter * 4), _mm_add_epi32(even, odd));
+            }
+#else
+            for (int pixel = 0; pixel < 16; pixel += 1) {
+                dots[pixel] = 0;
+                for (int channel = 0; channel < 4; channel += 1) {
+                    dots[pixel] += (pixels[pixel * 4 + channel] - origin[channel]) * direction[channel];
+                }
+            }
+#endif
+        }
+
+        // Swaps the ends of channels that fall while green rises, so that min and max lie on the colors' diagonal.
+        inline void select_diagonal(const uint8_t* pixels, uint8_t* min, uint8_t* max, int channels) {
+            int center[4];
+            for (int channel = 0; channel < 4; channel += 1) {
+                center[channel] = (min[channel] + max[channel]) / 2;
+            }
+            for (int channel = 0; channel < channels; channel += 1) {
+                if (channel == 1) {
+                    continue;
+                }
+                int covariance = 0;
+                for (int pixel = 0; pixel < 16; pixel += 1) {
+                    covariance += (pixels[pixel * 4 + channel] - center[channel]) * (pixels[pixel * 4 + 1] - center[1]);
+                }
+                if (covariance < 0) {
+                    std::swap(min[channel], max[channel]);
+                }
+            }
+        }
+
+        // Moves both ends inwards by a sixteenth of the range, the outermost pixels are rarely worth a palette entry.
+        inline void inset(uint8_t* min, uint8_t* max) {
+            for (int channel = 0; channel < 4; channel += 1) {
+                auto offset = (max[channel] - min[channel]) / 16;
+                min[channel] = (uint8_t)(min[channel] + offset);
+                max[channel] = (uint8_t)(max[channel] - offset);
+            }
+        }
+
+        // Ends that best reproduce the pixels when pixel i is end0 + weights[i] * (end1 - end0), false when the
+        // weights do not tell the ends apart.
+        inline bool fit_ends(const uint8_t* pixels, const float* weights, uint8_t* end0, uint8_t* end1) {
+            float a = 0.0f;
+            float b = 0.0f;
+            float c = 0.0f;
+            float x[4] = {};
+            float y[4] = {};
+            for (int pixel = 0; pixel < 16; pixel += 1) {
+                const auto weight = weights[pixel];
+                a += (1.0f - weight) * (1.0f - weight);
+                b += (1.0f - weight) * weight;
+                c += weight * weight;
+                for (int channel = 0; channel < 4; channel += 1) {
+                    x[channel] += (1.0f - weight) * pixels[pixel * 4 + channel];
+                    y[channel] += weight * pixels[pixel * 4 + channel];
+                }
+            }
+            const auto determinant = a * c - b * b;
+            if (determinant < 1e-3f) {
+                return false;
+            }
+            for (int channel = 0; channel < 4; channel += 1) {
+                end0[channel] = (uint8_t)std::clamp((c * x[channel] - b * y[channel]) / determinant + 0.5f, 0.0f, 255.0f);
+                end1[channel] = (uint8_t)std::clamp((a * y[channel] - b * x[channel]) / determinant + 0.5f, 0.0f, 255.0f);
+            }
+            return true;
+        }
+
+        inline uint16_t to_565(const uint8_t* color) {
+            return (uint16_t)(((color[0] * 31 + 127) / 255) << 11 | ((color[1] * 63 + 127) / 255) << 5 | ((color[2] * 31 + 127) / 255));
+        }
+
+        inline void from_565(uint16_t value, int* color) {
+            auto r = value >> 11 & 31;
+            auto g = value >> 5 & 63;
+            auto b = value & 31;
+            color[0] = r << 3 | r >> 2;
+            color[1] = g << 2 | g >> 4;
+            color[2] = b << 3 | b >> 2;
+            color[3] = 0;
+        }
+
+        // Thirds of the way from color0 to color1 nearest to every pixel.
+        inline void color_steps(const uint8_t* pixels, uint16_t color0, uint16_t color1, int* steps) {
+            int end0[4];
+            int end1[4];
+            from_565(color0, end0);
+            from_565(color1, end1);
+            const int direction[4] = {end1[0] - end0[0], end1[1] - end0[1], end1[2] - end0[2], 0};
+            const auto length = direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2];
+            int32_t dots[16];
+            project(pixels, end0, direction, dots);
+            for (int pixel = 0; pixel < 16; pixel += 1) {
+                steps[pixel] = length > 0 ? std::clamp((dots[pixel] * 6 + length) / (2 * length), 0, 3) : 0;
+            }
+        }
+
+        // Four colour BC1 block, also the colour half of BC3.
+        inline void encode_color(const uint8_t* pixels, uint8_t* output) {
+            uint8_t min[4];
+            uint8_t max[4];
+            bounds(pixels, min, max);
+            inset(min, max);
+            select_diagonal(pixels, min, max, 3);
+            auto color0 = to_565(max);
+            auto color1 = to_565(min);
+            int steps[16] = {};
+            if (color0 != color1) {
+                color_steps(pixels, color0, color1, steps);
+                float weights[16];
+                for (int pixel = 0; pixel < 16; pixel += 1) {
+                    weights[pixel] = (float)steps[pixel] / 3.0f;
+                }
+                if (fit_ends(pixels, weights, max, min) && to_565(max) != to_565(min)) {
+                    color0 = to_565(max);
+                    color1 = to_565(min);
+                    color_steps(pixels, color0, color1, steps);
+                }
+            }
+            // Four colour mode needs color0 > color1; equal ends make a flat block.
+            if (color0 < color1) {
+                std::swap(color0, color1);
+                for (auto& step: steps) {
+                    step = 3 - step;
+                }
+            }
+            uint32_t indices = 0;
+            if (color0 != color1) {
+                // Steps along the line map to palette entries color0, 2/3 color0 + 1/3 color1, the other third, color1.
+                constexpr uint32_t palette[4] = {0, 2, 3, 1};
+                for (int pixel = 0; pixel < 16; pixel += 1) {
+                    indices |= palette[steps[pixel]] << (pixel * 2);
+                }
+            }
+            output[0] = (uint8_t)(color0 & 0xff);
+            output[1] = (uint8_t)(color0 >> 8);
+            output[2] = (uint8_t)(color1 & 0xff);
+            output[3] = (uint8_t)(color1 >> 8);
+            std::memcpy(output + 4, &indices, 4);
+        }
+
+        // Eight value BC4 block of 16 values `stride` bytes apart, also the alpha half of BC3.
+        inline void encode_values(const uint8_t* values, int stride, uint8_t* output) {
+            uint8_t min = 255;
+            uint8_t max = 0;
+            for (int pixel = 0; pixel < 16; pixel += 1) {
+                min = std::min(min, values[pixel * stride]);
+                max = std::max(max, values[pixel * stride]);
+            }
+            output[0] = max;
+            output[1] = min;
+            uint64_t indices = 0;
+            if (max != min) {
+                const auto range = max - min;
+                for (int pixel = 0; pixel < 16; pixel += 1) {
+                    // Sevenths above min: 7 is value0, 0 is value1 and the rest count down from index 2.
+                    auto step = ((values[pixel * stride] - min) * 14 + range) / (2 * range);
+                    uint64_t index = step == 7 ? 0 : step == 0 ? 1 : 8 - step;
+                    indices |= index << (pixel * 3);
+                }
+            }
+            for (int byte = 0; byte < 6; byte += 1) {
+                output[2 + byte] = (uint8_t)(indices >> (byte * 8));
+            }
+        }
+
+        // Little endian bit writer for the 128 bits of a BC7 block.
+        struct bits {
+            uint64_t words[2] = {0, 0};
+            int position = 0;
+
+            void write(uint64_t value, int count) {
+                for (int bit = 0; bit < count; bit += 1) {
+                    words[position / 64] |= (value >> bit & 1) << (position % 64);
+                    position += 1;
+                }
+            }
+        };
+
+        // 7 bit ends with a shared low bit: the bit that brings the end closer to `target`.
+        inline int quantize_end(const uint8_t* target, int* quantized) {
+            int best_bit = 0;
+            int best_error = -1;
+            for (int bit = 0; bit < 2; bit += 1) {
+                int error = 0;
+                int candidate[4];
+                for (int channel = 0; channel < 4; channel += 1) {
+                    candidate[channel] = std::clamp((target[channel] - bit + 1) >> 1, 0, 127);
+                    auto difference = (candidate[channel] << 1 | bit) - target[channel];
+                    error += difference * difference;
+                }
+                if (best_error < 0 || error < best_error) {
+                    best_error = error;
+                    best_bit = bit;
+                    std::copy(candidate, candidate + 4, quantized);
+                }
+            }
+            return best_bit;
+        }
+    }
+
+    inline void encode_bc1(const uint8_t* pixels, uint8_t* output) {
+        details::encode_color(pixels, output);
+    }
+
+    inline void encode_bc3(const uint8_t* pixels, uint8_t* output) {
+        details::encode_values(pixels + 3, 4, output);
+        details::encode_color(pixels, output + 8);
+    }
+
+    inline void encode_bc4(const uint8_t* values, uint8_t* output) {
+        details::encode_values(values, 1, output);
+    }
+
+    // Mode 6 only: one pair of RGBA ends for the whole block and 16 steps between them.
+    inline void encode_bc7(const uint8_t* pixels, uint8_t* output) {
+        uint8_t min[4];
+        uint8_t max[4];
+        details::bounds(pixels, min, max);
+        details::inset(min, max);
+        details::select_diagonal(pixels, min, max, 4);
+        int ends[2][4];
+        int low_bits[2];
+        int indices[16];
+        for (int pass = 0; pass < 2; pass += 1) {
+            low_bits[0] = details::quantize_end(min, ends[0]);
+            low_bits[1] = details::quantize_end(max, ends[1]);
+            int decoded[2][4];
+            for (int end = 0; end < 2; end += 1) {
+                for (int channel = 0; channel < 4; channel += 1) {
+                    decoded[end][channel] = ends[end][channel] << 1 | low_bits[end];
+                }
+            }
+            const int direction[4] = {
+                decoded[1][0] - decoded[0][0], decoded[1][1] - decoded[0][1],
+                decoded[1][2] - decoded[0][2], decoded[1][3] - decoded[0][3]
+            };
+            const auto length = direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2] + direction[3] * direction[3];
+            int32_t dots[16];
+            details::project(pixels, decoded[0], direction, dots);
+            for (int pixel = 0; pixel < 16; pixel += 1) {
+                indices[pixel] = length > 0 ? (int)std::clamp(((int64_t)dots[pixel] * 30 + length) / (2 * length), (int64_t)0, (int64_t)15) : 0;
+            }
+            // Interpolation weights of the 16 steps, in 64ths.
+            constexpr int weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+            float fitted[16];
+            for (int pixel = 0; pixel < 16; pixel += 1) {
+                fitted[pixel] = (float)weights[indices[pixel]] / 64.0f;
+            }
+            if (pass == 1 || length == 0 || !details::fit_ends(pixels, fitted, min, max)) {
+                break;
+            }
+        }
+        // The top bit of the first index is implied zero.
+        if (indices[0] >= 8) {
+            std::swap(ends[0], ends[1]);
+            std::swap(low_bits[0], low_bits[1]);
+            for (auto& index: indices) {
+                index = 15 - index;
+            }
+        }
+        details::bits block;
+        block.write(1 << 6, 7);
+        for (int channel = 0; channel < 4; channel += 1) {
+            block.write((uint64_t)ends[0][channel], 7);
+            block.write((uint64_t)ends[1][channel], 7);
+        }
+        block.write((uint64_t)low_bits[0], 1);
+        block.write((uint64_t)low_bits[1], 1);
+        block.write((uint64_t)indices[0], 3);
+        for (int pixel = 1; pixel < 16; pixel += 1) {
+            block.write((uint64_t)indices[pixel], 4);
+        }
+        std::memcpy(output, block.words, 16);
+    }
+}
+
+#endif
@@ -0,0 +1,318 @@
+#ifndef COMPRESSED_TEXTURE_HPP
+#define COMPRESSED_TEXTURE_HPP
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <vector>
+#include <GL/glew.h>
+#include <fmt/core.h>
+
+#include "bc_encoder.hpp"
+#include "file_io.hpp"
+#include "gl_state.hpp"
+#include "job_system.hpp"
+#include "mip_chain.hpp"
+#include "stb_image_wrapper.hpp"
+
+// Block compressed 2D textures with their whole mip chain, transcoded from the image on first load and kept in a file
+// next to it (`<image>.texcache`) for the runs after that. Single channel images become BC4, opaque ones BC1 and the
+// ones with alpha BC7 where the GPU has BPTC, BC3 otherwise; a quarter to an eighth of the memory of RGBA8.
+// The cache belongs to one state of the image the way the mesh cache does, and to a GPU that can sample its format.
+//
+// Layout, native byte order, in the spirit of KTX2: a header, an index of offset and size for every level from the
+// largest down, then the blocks of the levels.
+namespace compressed_texture {
+    // Bump whenever the layout, the encoder or the mip filter changes.
+    inline constexpr uint32_t version = 2;
+    inline constexpr uint32_t magic = 0x58455443;
+
+    struct image {
+        GLenum format = 0;
+        int width = 0;
+        int height = 0;
+        // Blocks of every level, largest first; empty when the image can not be read.
+        std::vector<std::vector<uint8_t>> levels;
+        // Whether the levels came from the cache rather than the encoder.
+        bool cached = false;
+        // Reading the cache or transcoding, and the stb decode that transcoding starts with.
+        float load_ms = 0.0f;
+        float decode_ms = 0.0f;
+    };
+
+    namespace details {
+        struct header {
+            uint32_t magic;
+            uint32_t version;
+            uint32_t format;
+            uint32_t width;
+            uint32_t height;
+            uint32_t level_count;
+            // Whether the mip chain was filtered as sRGB.
+            uint32_t gamma;
+            uint32_t reserved;
+            uint64_t source_size;
+            int64_t source_time;
+            uint64_t source_hash;
+        };
+
+        struct level_entry {
+            uint64_t offset;
+            uint64_t size;
+        };
+
+        inline std::string cache_path(const std::string& source) {
+            return source + ".texcache";
+        }
+
+        // Format of images with alpha.
+        inline GLenum alpha_format() {
+            return GLEW_ARB_texture_compression_bptc ? GL_COMPRESSED_RGBA_BPTC_UNORM : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        }
+
+        inline bool can_sample(GLenum format) {
+            return format != GL_COMPRESSED_RGBA_BPTC_UNORM || GLEW_ARB_texture_compression_bptc;
+        }
+
+        inline size_t block_size(GLenum format) {
+            return format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || format == GL_COMPRESSED_RED_RGTC1 ? 8 : 16;
+        }
+
+        inline size_t level_size(GLenum format, int width, int height) {
+            return (size_t)((width + 3) / 4) * (size_t)((height + 3) / 4) * block_size(format);
+        }
+
+        inline std::optional<image> read_levels(const file_io::mapped_file& file, const std::string& source, bool gamma, header& cache_header, bool& touched) {
+            if (file.data() == nullptr) {
+                return std::nullopt;
+            }
+            file_io::reader input{file.data(), file.data() + file.size()};
+            if (!input.read(cache_header) || cache_header.magic != magic || cache_header.version != version || cache_header.gamma != (uint32_t)gamma) {
+                return std::nullopt;
+            }
+            if (!can_sample(cache_header.format) || cache_header.width == 0 || cache_header.height == 0) {
+                return std::nullopt;
+            }
+            if (cache_header.level_count != mip_chain::level_count((int)cache_header.width, (int)cache_header.height)) {
+                return std::nullopt;
+            }
+            if (!file_io::matches_source(source, cache_header.source_size, cache_header.source_time, cache_header.source_hash, touched)) {
+                return std::nullopt;
+            }
+            image result;
+            result.format = cache_header.format;
+            result.width = (int)cache_header.width;
+            result.height = (int)cache_header.height;
+            result.cached = true;
+            auto width = result.width;
+            auto height = result.height;
+            for (uint32_t level = 0; level < cache_header.level_count; level += 1) {
+                level_entry entry;
+                if (!input.read(entry) || entry.size != level_size(result.format, width, height) || entry.offset > file.size() || entry.size > file.size() - entry.offset) {
+                    return std::nullopt;
+                }
+                result.levels.emplace_back(file.data() + entry.offset, file.data() + entry.offset + entry.size);
+                width = std::max(1, width / 2);
+                height = std::max(1, height / 2);
+            }
+            return result;
+        }
+
+        inline std::optional<image> read(const std::string& source, bool gamma) {
+            const auto path = cache_path(source);
+            header cache_header;
+            bool touched = false;
+            std::optional<image> result;
+            {
+                file_io::mapped_file file(path);
+                result = read_levels(file, source, gamma, cache_header, touched);
+            }
+            if (result.has_value() && touched) {
+                std::fstream update(path, std::ios::binary | std::ios::in | std::ios::out);
+                update.write((const char*)&cache_header, sizeof(cache_header));
+            }
+            return result;
+        }
+
+        // Replaces the cache of the source; a cache that can not be written is only reported.
+        inline void write(const std::string& source, bool gamma, const image& target) {
+            auto current = file_io::stamp(source);
+            auto hash = file_io::hash_file(source);
+            if (!current.has_value() || !hash.has_value()) {
+                return;
+            }
+            const auto path = cache_path(source);
+            const auto temporary = path + ".tmp";
+            {
+                std::ofstream output(temporary, std::ios::binary | std::ios::trunc);
+                const header cache_header = {
+                    magic, version, target.format, (uint32_t)target.width, (uint32_t)target.height,
+                    (uint32_t)target.levels.size(), (uint32_t)gamma, 0, current->first, current->second, *hash
+                };
+                output.write((const char*)&cache_header, sizeof(cache_header));
+                uint64_t offset = sizeof(cache_header) + target.levels.size() * sizeof(level_entry);
+                for (const auto& level: target.levels) {
+                    const level_entry entry = {offset, level.size()};
+                    output.write((const char*)&entry, sizeof(entry));
+                    offset += level.size();
+                }
+                for (const auto& level: target.levels) {
+                    output.write((const char*)level.data(), (std::streamsize)level.size());
+                }
+                if (!output) {
+                    fmt::print("Failed to write texture cache {}\n", temporary);
+                    return;
+                }
+            }
+            std::error_code error;
+            std::filesystem::rename(temporary, path, error);
+            if (error) {
+                fmt::print("Failed to write texture cache {}: {}\n", path, error.message());
+                std::filesystem::remove(temporary, error);
+            }
+        }
+
+        // Blocks of one level, rows of blocks spread over the job system. Blocks over the edge repeat the last pixels.
+        inline std::vector<uint8_t> encode_level(const uint8_t* pixels, int width, int height, int channels, GLenum format, job_system& jobs) {
+            const auto blocks_x = (width + 3) / 4;
+            const auto blocks_y = (height + 3) / 4;
+            const auto size = block_size(format);
+            std::vector<uint8_t> result(level_size(format, width, height));
+            jobs.parallel_for((size_t)blocks_y, std::max<size_t>(1, 1024 / (size_t)blocks_x), [&](size_t first, size_t last) {
+                uint8_t block[64];
+                for (auto row = first; row < last; row += 1) {
+                    for (int column = 0; column < blocks_x; column += 1) {
+                        for (int pixel = 0; pixel < 16; pixel += 1) {
+                            const auto x = std::min(column * 4 + pixel % 4, width - 1);
+                            const auto y = std::min((int)row * 4 + pixel / 4, height - 1);
+                            std::copy_n(pixels + ((size_t)y * width + x) * channels, channels, block + pixel * channels);
+                        }
+                        auto output = result.data() + (row * blocks_x + column) * size;
+                        if (format == GL_COMPRESSED_RED_RGTC1) {
+                            bc_encoder::encode_bc4(block, output);
+                        } else if (format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT) {
+                            bc_encoder::encode_bc1(block, output);
+                        } else if (format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT) {
+                            bc_encoder::encode_bc3(block, output);
+                        } else {
+                            bc_encoder::encode_bc7(block, output);
+                        }
+                    }
+                }
+            });
+            return result;
+        }
+
+        // The image of the pixels in `format` with all its levels, the mips filtered from the pixels.
+        inline image encode(const uint8_t* pixels, int width, int height, int channels, GLenum format, bool gamma, job_system& jobs) {
+            image result;
+            result.format = format;
+            result.width = width;
+            result.height = height;
+            result.levels.push_back(encode_level(pixels, width, height, channels, format, jobs));
+            for (const auto& level: mip_chain::generate(pixels, width, height, channels, gamma, jobs)) {
+                result.levels.push_back(encode_level(level.pixels.data(), level.width, level.height, channels, format, jobs));
+            }
+            return result;
+        }
+
+        inline image transcode(const std::string& source, bool gamma, job_system& jobs) {
+            int width, height, components;
+            if (!stbi_info(source.c_str(), &width, &height, &components)) {
+                return {};
+            }
+            const auto channels = components == 1 ? 1 : 4;
+            const auto start = std::chrono::steady_clock::now();
+            std::unique_ptr<unsigned char, void (*)(void*)> pixels(stbi_load(source.c_str(), &width, &height, &components, channels), stbi_image_free);
+            const auto decode_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+            if (!pixels) {
+                return {};
+            }
+            GLenum format = GL_COMPRESSED_RED_RGTC1;
+            if (channels == 4) {
+                bool opaque = true;
+                for (size_t index = 3; index < (size_t)width * height * 4 && opaque; index += 4) {
+                    opaque = pixels.get()[index] == 255;
+                }
+                format = opaque ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : alpha_format();
+            }
+            auto result = encode(pixels.get(), width, height, channels, format, gamma, jobs);
+            result.decode_ms = decode_ms;
+            return result;
+        }
+    }
+
+    // Whether the GPU samples the formats textures are transcoded to; without S3TC textures stay uncompressed.
+    [[nodiscard]]
+    inline bool supported() {
+        return GLEW_EXT_texture_compression_s3tc;
+    }
+
+    // The cached texture of the image, transcoded and cached first when there is none. Safe to call from jobs.
+    // `gamma` tells whether the image holds sRGB colors rather than data such as normals, for filtering its mips.
+    inline image load(const std::string& source, bool gamma, job_system& jobs) {
+        const auto start = std::chrono::steady_clock::now();
+        auto result = details::read(source, gamma);
+        if (!result.has_value()) {
+            result = details::transcode(source, gamma, jobs);
+            if (!result->levels.empty()) {
+                details::write(source, gamma, *result);
+            }
+        }
+        result->load_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return std::move(*result);
+    }
+
+    inline GLuint upload(const image& target) {
+        GLuint texture_id;
+        glGenTextures(1, &texture_id);
+        gl_state::bind_texture(GL_TEXTURE_2D, texture_id);
+        auto width = target.width;
+        auto height = target.height;
+        for (size_t level = 0; level < target.levels.size(); level += 1) {
+            glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)level, target.format, width, height, 0, (GLsizei)target.levels[level].size(), target.levels[level].data());
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)target.levels.size() - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        return texture_id;
+    }
+
+    // Bytes on the GPU, and what the same levels take as RGBA8 (R8 for single channel images).
+    [[nodiscard]]
+    inline size_t compressed_size(const image& target) {
+        size_t size = 0;
+        for (const auto& level: target.levels) {
+            size += level.size();
+        }
+        return size;
+    }
+
+    [[nodiscard]]
+    inline size_t uncompressed_size(const image& target) {
+        const size_t channels = target.format == GL_COMPRESSED_RED_RGTC1 ? 1 : 4;
+        size_t size = 0;
+        auto width = target.width;
+        auto height = target.height;
+        for (size_t level = 0; level < target.levels.size(); level += 1) {
+            size += (size_t)width * height * channels;
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+        }
+        return size;
+    }
+}
+
+#endif
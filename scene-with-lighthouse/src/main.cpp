@@ -3,16 +3,37 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <fmt/format.h>
+#include <algorithm>
 #include <optional>
 #include <array>
+#include <chrono>
+#include <functional>
+#include <string>
 
 #include "shader_program.hpp"
+#include "shader_watcher.hpp"
+#include "shader_cache.hpp"
+#include "gl_state.hpp"
+#include "render_queue.hpp"
+#include "instance_buffer.hpp"
+#include "vegetation.hpp"
+#include "bvh.hpp"
+#include "bvh_benchmark.hpp"
+#include "obj_benchmark.hpp"
+#include "mip_benchmark.hpp"
+#include "occlusion_culler.hpp"
+#include "occlusion_queries.hpp"
+#include "static_batch.hpp"
+#include "stream_buffer.hpp"
+#include "asset_streamer.hpp"
 #include "mesh.hpp"
 #include "model.hpp"
+#include "texture_registry.hpp"
 #include "camera.hpp"
 #include "skybox.hpp"
 #include "ui.hpp"
 #include "heightmap.hpp"
+#include "job_system.hpp"
 #include "water.hpp"
 #include "utility.hpp"
 #include "light.hpp"
@@ -30,10 +51,22 @@ camera scene_camera(glm::vec3(0.0f, 0.3f, 1.0f));
 float current_time = 0;
 float delta_time = 0.0f;
 
-auto boat_position = glm::vec3(0.0f, 0.0f, 0.0f);
-size_t boat_position_index = 0;
-float boat_time = 0.0f;
-float boat_self_rotation = glm::radians(-180.0f);
+// Where the boat is on its path and which corner it heads to.
+struct boat_state {
+    glm::vec3 position = glm::vec3(0.0f);
+    float rotation = glm::radians(-180.0f);
+    size_t target = 0;
+};
+
+// Length of one simulation step in seconds, the boat moves one unit per step.
+const inline float simulation_step = 0.01f;
+// After a long stall the simulation drops time beyond this instead of catching up step by step.
+const inline float max_simulation_lag = 0.25f;
+// The last two simulation steps, and the state between them all passes of the frame render.
+boat_state previous_boat;
+boat_state current_boat;
+boat_state boat;
+float simulation_time = 0.0f;
 
 glm::mat4 light_space_matrix;
 GLuint shadow_map = 0;
@@ -72,7 +105,7 @@ std::optional<GLFWwindow*> init(int argc, char** argv) {
         return std::nullopt;
     }
     glfwSetFramebufferSizeCallback(window, [](GLFWwindow* window, int width, int height) {
-        glViewport(0, 0, width, height);
+        gl_state::viewport(0, 0, width, height);
     });
     glfwSetCursorPosCallback(window, [](GLFWwindow* window, double xpos, double ypos) {
         if (first_mouse) {
@@ -95,7 +128,7 @@ std::optional<GLFWwindow*> init(int argc, char** argv) {
         scene_camera.mouse_scroll((float)yoffset);
     });
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
-    //init_ui(window);
+    ui::init(window);
     return std::make_optional(window);
 }
 
@@ -145,24 +178,57 @@ void process_input(GLFWwindow* window, float delta_time) {
 void set_light_uniforms(shader_program& shader) {
     global_light::set_uniforms(shader, "global_light");
     shader.set_uniform("shadow_map", 6);
+    gl_state::bind_texture(6, GL_TEXTURE_2D, shadow_map);
 }
 
 const auto default_clipping_plane = glm::vec4(0, -1, 0, 10000);
 
-void set_mvpc_uniforms(shader_program& shader, glm::mat4 model, glm::mat4 view, glm::mat4 projection, glm::vec4 clipping_plane = default_clipping_plane) {
-    shader.set_uniform("model", model);
-    shader.set_uniform("view", view);
-    shader.set_uniform("projection", projection);
-    shader.set_uniform("clipping_plane", clipping_plane);
+// Order of the passes in the render queue, every frame renders them in this order.
+enum scene_pass : size_t {
+    reflection_pass,
+    refraction_pass,
+    shadow_pass,
+    main_pass,
+    water_pass
+};
+
+void set_pass_uniforms(shader_program& shader, const render_pass& pass) {
+    shader.set_uniform("view", pass.view);
+    shader.set_uniform("projection", pass.projection);
+    shader.set_uniform("clipping_plane", pass.clipping_plane);
     shader.set_uniform("time", current_time);
     shader.set_uniform("lightSpaceMatrix", light_space_matrix);
-    shader.set_uniform("camera_position", scene_camera.position);
+    shader.set_uniform("camera_position", pass.eye);
     shader.set_uniform("lighthouse_light_space_matrix", lighthouse_light_space_matrix);
     shader.set_uniform("lighthouse_light_position", lighthouse_light_position);
-    shader.set_uniform("lighthouse_light_target_point", boat_position);
+    shader.set_uniform("lighthouse_light_target_point", boat.position);
     shader.set_uniform("lighthouse_projection_texture", 7);
+    gl_state::bind_texture(7, GL_TEXTURE_2D, lighthouse_projection_texture);
+    set_light_uniforms(shader);
+}
+
+void set_shadow_pass_uniforms(shader_program& shader, const render_pass& pass) {
+    shader.set_uniform("lightSpaceMatrix", light_space_matrix);
+}
+
+void set_water_pass_uniforms(shader_program& shader, const render_pass& pass) {
+    set_pass_uniforms(shader, pass);
+    shader.set_uniform("texture_diffuse_reflection", 0);
+    shader.set_uniform("texture_diffuse_refraction", 1);
+    shader.set_uniform("texture_dudv", 2);
+    shader.set_uniform("texture_normal", 3);
+    shader.set_uniform("texture_refraction_depth", 4);
 }
 
+// Programs a pass renders the scene with; each pass picks the permutation it needs.
+struct pass_shaders {
+    shader_program& terrain;
+    shader_program& common_object;
+    shader_program& instanced_object;
+    // Objects whose diffuse textures are layers of a texture array.
+    shader_program& layered_object;
+};
+
 inline void apply_center_shift(glm::mat4& model_matrix, mesh& target) {
     auto center_shift = (target.min_values + target.max_values) / 2.0f;
     model_matrix = glm::translate(model_matrix, -center_shift);
@@ -173,136 +239,284 @@ inline void apply_center_shift(glm::mat4& model_matrix, model& target) {
     model_matrix = glm::translate(model_matrix, -center_shift);
 }
 
-void render_terrain(glm::mat4 view, glm::mat4 projection, glm::vec4 clipping_plane, shader_program& shader, mesh& terrain_mesh) {
-    glActiveTexture(GL_TEXTURE6);
-    glBindTexture(GL_TEXTURE_2D, shadow_map);
-    glActiveTexture(GL_TEXTURE7);
-    glBindTexture(GL_TEXTURE_2D, lighthouse_projection_texture);
-    shader.use();
+glm::mat4 terrain_transform(mesh& terrain_mesh) {
     auto model = glm::mat4(1.0f);
     apply_center_shift(model, terrain_mesh);
-    set_mvpc_uniforms(shader, model, view, projection, clipping_plane);
-    set_light_uniforms(shader);
-    shader.set_uniform("camera_position", scene_camera.position);
-    shader.set_uniform("camera_front", scene_camera.front);
-    terrain_mesh.draw(shader);
+    return model;
 }
 
-void render_trees(glm::mat4 view, glm::mat4 projection, glm::vec4 clipping_plane, shader_program& shader, model& tree_model) {
-    shader.use();
-    auto model = glm::mat4(1.0f);
-    model = glm::scale(model, glm::vec3(0.01f));
-    apply_center_shift(model, tree_model);
-    std::vector<glm::vec3> translate_vectors = {
-        glm::vec3(-5.9100404, 4.840016, -6.600056),
-        glm::vec3(-6.1000447, 2.8399978, -1.9399986),
-        glm::vec3(-1.1, 2.7499986, -23.34993),
-        glm::vec3(5.850004, 2.7499986, -27.849861),
-        glm::vec3(-12.65003, 2.7499986, -17.50002),
-        glm::vec3(-19.049995, 7.2000093, -21.449959)
-    };
-    for (auto translate_vector: translate_vectors) {
-        auto cmodel = glm::translate(model, translate_vector);
-        set_mvpc_uniforms(shader, cmodel, view, projection, clipping_plane);
-        set_light_uniforms(shader);
-        tree_model.draw(shader);
-    }
+void submit_terrain(render_queue& queue, size_t pass, shader_program& shader, mesh& terrain_mesh) {
+    queue.submit(pass, shader, terrain_mesh, terrain_transform(terrain_mesh));
 }
 
-void render_water(glm::mat4 view, glm::mat4 projection, water_framebuffers_controller& controller, shader_program& shader, mesh& water_mesh) {
-    controller.bind_textures();
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+// Trees scattered over the terrain wherever it is above the water, not too steep and the density map allows.
+vegetation create_trees(model& tree_model, const terrain_sampler& terrain, job_system& jobs) {
+    scatter_rules rules;
+    return vegetation(tree_model, terrain, density_map::generate(256, rules.seed), rules, jobs);
+}
 
-    shader.use();
+void submit_water(render_queue& queue, shader_program& shader, mesh& water_mesh) {
     auto model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(-0.5f, 0.0f, -0.5f));
     model = glm::scale(model, glm::vec3(1.0f));
-    set_mvpc_uniforms(shader, model, view, projection);
-    set_light_uniforms(shader);
-    shader.set_uniform("camera_position", scene_camera.position);
-    shader.set_uniform("texture_diffuse_reflection", 0);
-    shader.set_uniform("texture_diffuse_refraction", 1);
-    shader.set_uniform("texture_dudv", 2);
-    shader.set_uniform("texture_normal", 3);
-    shader.set_uniform("texture_refraction_depth", 4);
-    set_light_uniforms(shader);
-    water_mesh.draw(shader, true);
-
-    glDisable(GL_BLEND);
+    queue.submit(water_pass, shader, water_mesh, model);
 }
 
-void render_boat(glm::mat4 view, glm::mat4 projection, glm::vec4 clipping_plane, shader_program& shader, model& boat_model) {
-    shader.use();
-    auto model = glm::mat4(1.0f);
-    std::vector<glm::vec3> path_points = {
+// One step of the boat towards the next corner of its path, turning when it gets there.
+boat_state step_boat(boat_state state) {
+    static const std::vector<glm::vec3> path_points = {
         glm::vec3(0.0, 0.0, 0.0),
         glm::vec3(0.0, 0.0, -814.0),
         glm::vec3(300.0, 0.0, -814.0),
         glm::vec3(300.0, 0.0, 0.0)
     };
-    model = glm::scale(model, glm::vec3(0.0002));
-    if (glm::distance(path_points[boat_position_index], boat_position) < 0.01f) {
-        boat_position_index = (boat_position_index + 1) % path_points.size();
-        boat_self_rotation += glm::radians(90.0f);
+    if (glm::distance(path_points[state.target], state.position) < 0.01f) {
+        state.target = (state.target + 1) % path_points.size();
+        state.rotation += glm::radians(90.0f);
     }
-    auto current_target_point = path_points[boat_position_index];
-    boat_time += delta_time;
-    if (boat_time > 0.01f) {
-        auto direction = glm::normalize(boat_position - current_target_point);
-        boat_position -= direction * 1.0f;
-        boat_time = 0;
+    auto direction = glm::normalize(state.position - path_points[state.target]);
+    state.position -= direction * 1.0f;
+    return state;
+}
+
+// Advances the simulation in fixed steps by the time elapsed since the last frame, once per frame before any pass,
+// and interpolates the state the frame renders between the last two steps.
+void simulate(float elapsed) {
+    simulation_time = std::min(simulation_time + elapsed, max_simulation_lag);
+    while (simulation_time >= simulation_step) {
+        previous_boat = current_boat;
+        current_boat = step_boat(current_boat);
+        simulation_time -= simulation_step;
     }
-    model = glm::translate(model, boat_position);
-    model = glm::rotate(model, -boat_self_rotation, glm::vec3(0.0f, 1.0f, 0.0f));
-    set_mvpc_uniforms(shader, model, view, projection, clipping_plane);
-    set_light_uniforms(shader);
-    boat_model.draw(shader);
+    auto alpha = simulation_time / simulation_step;
+    boat.position = glm::mix(previous_boat.position, current_boat.position, alpha);
+    boat.rotation = glm::mix(previous_boat.rotation, current_boat.rotation, alpha);
+    boat.target = current_boat.target;
+}
+
+glm::mat4 boat_transform() {
+    auto model = glm::mat4(1.0f);
+    model = glm::scale(model, glm::vec3(0.0002));
+    model = glm::translate(model, boat.position);
+    model = glm::rotate(model, -boat.rotation, glm::vec3(0.0f, 1.0f, 0.0f));
+    return model;
 }
 
-void render_lighthouse(glm::mat4 view, glm::mat4 projection, glm::vec4 clipping_plane, shader_program& shader, model& lighthouse_model) {
-    shader.use();
+// Side of the square chunks the static world is merged into, a few of them cover the lighthouse.
+const inline float static_chunk_size = 0.05f;
+// Bytes of per-frame dynamic data, each of the frames in flight gets this much.
+const inline size_t stream_frame_size = 1 << 20;
+// Time a frame may spend putting streamed assets into the scene.
+const inline float streaming_budget_ms = 4.0f;
+
+glm::mat4 lighthouse_transform() {
     auto model = glm::mat4(1.0f);
     model = glm::scale(model, glm::vec3(0.01f));
     model = glm::translate(model, glm::vec3(-17.950012, 4.6499996, -18.05001));
-    auto transform = glm::mat4(1.0f);
-    set_mvpc_uniforms(shader, model * transform, view, projection, clipping_plane);
-    set_light_uniforms(shader);
-    lighthouse_model.draw(shader);
+    return model;
+}
+
+void add_occluder(occlusion_culler& occlusion, model& source, const glm::mat4& transform) {
+    for (auto& target: source.get_meshes()) {
+        std::vector<glm::vec3> positions;
+        for (const auto& vertex: target.vertices) {
+            positions.push_back(vertex.position);
+        }
+        occlusion.add_occluder(positions, target.indices, transform);
+    }
+}
+
+// Something the passes draw, found through the scene BVH by its world bounds.
+struct scene_object {
+    std::string name;
+    std::function<void(render_queue&, size_t, const pass_shaders&)> submit;
+    // Hardware occlusion query of the object in the main pass, for the few large meshes worth a query each.
+    std::optional<size_t> query;
+};
+
+// Box drawn by the main pass where a streamed asset will be, until it is ready.
+struct asset_placeholder {
+    size_t asset;
+    std::function<glm::mat4()> transform;
+};
+
+// The nearest object box under the cursor.
+std::optional<bvh::ray_hit> pick_object(GLFWwindow* window, const bvh& scene_bvh, const glm::mat4& view_projection) {
+    double x = 0;
+    double y = 0;
+    int width = 0;
+    int height = 0;
+    glfwGetCursorPos(window, &x, &y);
+    glfwGetWindowSize(window, &width, &height);
+    auto ndc = glm::vec2(2.0f * (float)x / width - 1.0f, 1.0f - 2.0f * (float)y / height);
+    auto inverse = glm::inverse(view_projection);
+    auto near_point = inverse * glm::vec4(ndc.x, ndc.y, -1.0f, 1.0f);
+    auto far_point = inverse * glm::vec4(ndc.x, ndc.y, 1.0f, 1.0f);
+    auto origin = glm::vec3(near_point) / near_point.w;
+    auto target = glm::vec3(far_point) / far_point.w;
+    return scene_bvh.raycast(origin, glm::normalize(target - origin));
 }
 
 int main(int argc, char** argv) {
+    if (argc > 1 && std::string(argv[1]) == "--bvh-benchmark") {
+        return bvh_benchmark::run();
+    }
+    if (argc > 1 && std::string(argv[1]) == "--obj-benchmark") {
+        return obj_benchmark::run(argc > 2 ? std::stoull(argv[2]) : 10000000);
+    }
+    const auto start_time = std::chrono::steady_clock::now();
     auto init_result = init(argc, argv);
     if (!init_result.has_value()) {
         return 1;
     }
     auto window = init_result.value();
-    glEnable(GL_DEPTH_TEST);
+    gl_state::enable(GL_DEPTH_TEST);
+
+    shader_watcher shaders_watcher({"../shaders", "../shaders/include"});
+    shader_cache shaders(&shaders_watcher);
 
-    auto terrain_shader = load_shader("../shaders/terrain");
-    auto terrain_mesh = create_terrain("assets/heightmap/heightmap.png");
-    auto water_shader = load_shader("../shaders/water");
+    // Loading, culling and the per-pass draw lists all run their parallel work here.
+    job_system jobs;
+    if (argc > 1 && std::string(argv[1]) == "--mip-benchmark") {
+        return mip_benchmark::run(jobs);
+    }
+    auto& water_shader = shaders.get("../shaders/water");
     auto water_mesh = create_water();
-    auto common_object_shader = load_shader("../shaders/common_object");
-    auto simple_object_shader = load_shader("../shaders/simple_object");
-    auto tree_model = model("assets/models/tree", "lowpoyltree.obj");
-    auto boat_model = model("assets/models/boat", "boat.obj");
-    auto lighthouse_model = model("assets/models/lighthouse", "lighthouse.obj");
+    auto& simple_object_shader = shaders.get("../shaders/simple_object");
 
     auto [simple_cube_vao, simple_cube_vbo] = simple_cube::create();
 
-    auto depth_shader = load_shader("../shaders/depth");
+    auto& depth_shader = shaders.get("../shaders/depth");
+    auto& instanced_depth_shader = shaders.get("../shaders/depth", {"INSTANCED"});
+
+    const pass_shaders main_shaders = {
+        shaders.get("../shaders/terrain"),
+        shaders.get("../shaders/common_object"),
+        shaders.get("../shaders/common_object", {"INSTANCED"}),
+        shaders.get("../shaders/common_object", {"TEXTURE_ARRAY"})
+    };
+    // Reflection and refraction are distorted by the water surface, shadows there are not worth the PCF taps.
+    // The beam only sweeps the surface the camera looks at, so the mirrored view skips it too.
+    const pass_shaders reflection_shaders = {
+        shaders.get("../shaders/terrain", {"NO_SHADOW", "NO_LIGHTHOUSE"}),
+        shaders.get("../shaders/common_object", {"NO_SHADOW", "NO_LIGHTHOUSE"}),
+        shaders.get("../shaders/common_object", {"INSTANCED", "NO_SHADOW", "NO_LIGHTHOUSE"}),
+        shaders.get("../shaders/common_object", {"TEXTURE_ARRAY", "NO_SHADOW", "NO_LIGHTHOUSE"})
+    };
+    const pass_shaders refraction_shaders = {
+        shaders.get("../shaders/terrain", {"NO_SHADOW"}),
+        shaders.get("../shaders/common_object", {"NO_SHADOW"}),
+        shaders.get("../shaders/common_object", {"INSTANCED", "NO_SHADOW"}),
+        shaders.get("../shaders/common_object", {"TEXTURE_ARRAY", "NO_SHADOW"})
+    };
+
+    std::vector<scene_object> scene_objects;
+    std::vector<aabb> scene_bounds;
+    occlusion_queries queries;
+    const auto add_object = [&](std::string name, const aabb& bounds, std::function<void(render_queue&, size_t, const pass_shaders&)> submit) {
+        scene_objects.push_back({std::move(name), std::move(submit), std::nullopt});
+        scene_bounds.push_back(bounds);
+    };
+    bvh scene_bvh;
+    // The terrain and the lighthouse hide most of the scene from a low camera.
+    occlusion_culler occlusion(jobs);
+
+    // Filled in on the streaming thread, the scene refers to them only once they are ready.
+    std::optional<mesh> terrain_mesh;
+    std::optional<terrain_sampler> terrain;
+    std::optional<model> tree_model;
+    std::optional<vegetation> trees;
+    std::optional<model> boat_model;
+    std::optional<model> lighthouse_model;
+    static_batch static_world(static_chunk_size);
+    // Boat bounds are refitted every frame after the simulation step.
+    std::optional<uint32_t> first_boat_object;
+    GLuint streamed_projection_texture = 0;
+    std::vector<asset_placeholder> placeholders;
+    // Declared after what the loaders fill in, so that it stops loading before any of it is destroyed.
+    asset_streamer streamer(window, jobs, streaming_budget_ms);
+    placeholders.push_back({streamer.load("terrain", [&]() {
+        heightmap_loader heightmap("assets/heightmap/heightmap.png");
+        terrain_mesh.emplace(create_terrain(heightmap, jobs));
+        terrain.emplace(heightmap, glm::vec3(terrain_transform(*terrain_mesh)[3]), jobs);
+    }, [&]() {
+        add_object("terrain", aabb{terrain_mesh->min_values, terrain_mesh->max_values}.transformed(terrain_transform(*terrain_mesh)), [&](render_queue& queue, size_t pass, const pass_shaders& shaders) {
+            submit_terrain(queue, pass, shaders.terrain, *terrain_mesh);
+        });
+        auto [occluder_vertices, occluder_indices] = terrain->create_occluder(64);
+        occlusion.add_occluder(occluder_vertices, occluder_indices);
+    }), []() {
+        return glm::scale(glm::mat4(1.0f), glm::vec3(0.5f, 0.002f, 0.5f));
+    }});
+    // Trees are scattered and their instance buffers filled on the streaming thread, the first draw of a cell
+    // makes its vertex arrays in the window's context.
+    const auto trees_asset = streamer.load("trees", [&]() {
+        if (!terrain.has_value()) {
+            throw std::runtime_error("trees need the terrain");
+        }
+        tree_model.emplace("assets/models/tree", "lowpoyltree.obj", jobs);
+        trees.emplace(create_trees(*tree_model, *terrain, jobs));
+    }, [&]() {
+        for (size_t index = 0; index < trees->get_cell_count(); index += 1) {
+            add_object(fmt::format("tree cell {}", index), trees->get_cell_bounds(index), [&, index](render_queue& queue, size_t pass, const pass_shaders& shaders) {
+                trees->submit_cell(queue, pass, shaders.instanced_object, index, scene_camera.position);
+            });
+        }
+    });
+    placeholders.push_back({streamer.load("boat", [&]() {
+        boat_model.emplace("assets/models/boat", "boat.obj", jobs, model_layout::packed);
+        boat_model->upload();
+    }, [&]() {
+        first_boat_object = (uint32_t)scene_objects.size();
+        for (size_t index = 0; index < boat_model->get_meshes().size(); index += 1) {
+            auto& target = boat_model->get_meshes()[index];
+            add_object(fmt::format("boat mesh {}", index), aabb{target.min_values, target.max_values}.transformed(boat_transform()), [&, index](render_queue& queue, size_t pass, const pass_shaders& shaders) {
+                queue.submit(pass, shaders.common_object, *boat_model, index, boat_transform());
+            });
+            scene_objects.back().query = queries.add();
+        }
+    }), []() {
+        return glm::scale(glm::translate(glm::mat4(1.0f), boat.position * 0.0002f), glm::vec3(0.005f));
+    }});
+    placeholders.push_back({streamer.load("lighthouse", [&]() {
+        lighthouse_model.emplace("assets/models/lighthouse", "lighthouse.obj", jobs, model_layout::layered);
+        // Everything that never moves is merged by material into chunks, the lighthouse is all there is so far.
+        static_world.add(*lighthouse_model, lighthouse_transform());
+        static_world.build();
+    }, [&]() {
+        for (size_t index = 0; index < static_world.get_chunks().size(); index += 1) {
+            add_object(fmt::format("static chunk {}", index), static_world.get_chunks()[index].bounds, [&, index](render_queue& queue, size_t pass, const pass_shaders& shaders) {
+                static_world.submit_chunk(queue, pass, shaders.layered_object, index);
+            });
+            scene_objects.back().query = queries.add();
+        }
+        add_occluder(occlusion, *lighthouse_model, lighthouse_transform());
+    }), []() {
+        return glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(lighthouse_transform()[3])), glm::vec3(0.01f, 0.05f, 0.01f));
+    }});
+    streamer.load("lighthouse projection", [&]() {
+        streamed_projection_texture = details::load_texture("assets/batman.png", jobs);
+    }, [&]() {
+        lighthouse_projection_texture = streamed_projection_texture;
+    });
+    std::optional<bvh::ray_hit> picked;
+    bool pick_button_down = false;
 
-    water_framebuffers_controller water_framebuffers(window);
+    water_framebuffers_controller water_framebuffers(window, jobs);
     shadow_framebuffer_controller shadow_framebuffer;
     shadow_map = shadow_framebuffer.depth_map;
-    lighthouse_projection_texture = details::load_texture("assets/batman.png");
 
     auto last_frame = 0.0f;
+    std::optional<float> first_frame_ms;
+    bool textures_evicted = false;
 
     auto reflection_clipping_plane = glm::vec4(0, 1, 0, 0);
     auto refraction_clipping_plane = glm::vec4(0, -1, 0, 0);
 
+    render_queue queue;
+    stream_buffer frame_stream(stream_frame_size);
+    const pass_shaders shadow_shaders = {depth_shader, depth_shader, instanced_depth_shader, depth_shader};
+
     auto rotation = glm::vec2(0.0f);
     while (!glfwWindowShouldClose(window)) {
         glfwPollEvents();
@@ -313,19 +527,34 @@ int main(int argc, char** argv) {
         delta_time = current_time - last_frame;
         last_frame = current_time;
 
-        if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS) {
-            terrain_shader = load_shader("../shaders/terrain");
-            common_object_shader = load_shader("../shaders/common_object");
-            water_shader = load_shader("../shaders/water");
-        }
+        shaders_watcher.update();
         process_input(window, delta_time);
+        streamer.update();
+        if (!textures_evicted && streamer.get_stats().total_ms > 0.0f) {
+            // All assets are in: textures nothing uses any more, such as those of an asset that failed half way, can go.
+            texture_registry::evict_unused();
+            texture_registry::print_usage();
+            textures_evicted = true;
+        }
+        if (scene_bvh.size() != scene_bounds.size()) {
+            // Streamed assets brought new objects, the tree is small enough to build again.
+            scene_bvh.build(scene_bounds);
+        }
+        simulate(delta_time);
+        // Boat bounds follow the simulation once per frame, every pass culls against the same state.
+        if (first_boat_object.has_value()) {
+            for (size_t index = 0; index < boat_model->get_meshes().size(); index += 1) {
+                auto& target = boat_model->get_meshes()[index];
+                scene_bvh.refit(*first_boat_object + index, aabb{target.min_values, target.max_values}.transformed(boat_transform()));
+            }
+        }
+        frame_stream.begin_frame();
+        const auto uniform_stats = shader_program::reset_uniform_stats();
+        const auto job_stats = jobs.reset_stats();
+        const auto gl_call_stats = gl_state::reset_stats();
 
         auto [display_width, display_height] = utility::get_window_size(window);
-        glViewport(0, 0, display_width, display_height);
         glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glEnable(GL_CLIP_DISTANCE0);
-        glEnable(GL_DEPTH_TEST);
 
         auto view = scene_camera.get_view_matrix();
         glm::mat4 projection = glm::perspective(
@@ -335,89 +564,265 @@ int main(int argc, char** argv) {
             far_plane
         );
 
-        const auto render_stuff = [&](glm::vec4 clipping_plane, glm::mat4 view = scene_camera.get_view_matrix()) {
-            render_terrain(view, projection, clipping_plane, terrain_shader, terrain_mesh);
-            render_trees(view, projection, clipping_plane, common_object_shader, tree_model);
-            render_boat(view, projection, clipping_plane, common_object_shader, boat_model);
-            render_lighthouse(view, projection, clipping_plane, common_object_shader, lighthouse_model);
-        };
-
-        const auto render_stuff_with_shader = [&](shader_program& shader, glm::vec4 clipping_plane, glm::mat4 view = scene_camera.get_view_matrix()) {
-            render_terrain(view, projection, clipping_plane, shader, terrain_mesh);
-            render_trees(view, projection, clipping_plane, shader, tree_model);
-            render_boat(view, projection, clipping_plane, shader, boat_model);
-            render_lighthouse(view, projection, clipping_plane, shader, lighthouse_model);
-        };
-
         {
             const float vl = 10;
             glm::mat4 lightProjection = glm::ortho(-vl, vl, -vl, vl, 0.1f, far_plane);
-            glm::mat4 lightView = glm::lookAt(lighthouse_light_position, boat_position * 0.0002f, glm::vec3(0.0, 1.0, 0.0));
+            glm::mat4 lightView = glm::lookAt(lighthouse_light_position, boat.position * 0.0002f, glm::vec3(0.0, 1.0, 0.0));
             lighthouse_light_space_matrix = lightProjection * lightView;
         }
 
-        {
-            water_framebuffers.bind_reflection_frame_buffer();
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-            auto distance = 2 * scene_camera.position.y;
-            scene_camera.position.y -= distance;
-            scene_camera.pitch = -scene_camera.pitch;
-            scene_camera.update();
-            auto corrected_view = scene_camera.get_view_matrix();
-            render_stuff(reflection_clipping_plane, corrected_view);
-            scene_camera.position.y += distance;
-            scene_camera.pitch = -scene_camera.pitch;
-            scene_camera.update();
-            water_framebuffers_controller::unbind_current_framebuffer(display_width, display_height);
+        // Left click picks the nearest object under the cursor, unless the click is meant for the UI.
+        auto pick_button = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+        if (pick_button && !pick_button_down && !ImGui::GetIO().WantCaptureMouse) {
+            picked = pick_object(window, scene_bvh, projection * view);
         }
-        water_framebuffers.bind_refraction_frame_buffer();
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        render_stuff(refraction_clipping_plane);
-        water_framebuffers_controller::unbind_current_framebuffer(display_width, display_height);
-
-        const auto configure_matrices = [&]() {
-            const float vl = 1;
-            glm::mat4 lightProjection = glm::ortho(-vl, vl, -vl, vl, near_plane, far_plane);
-            glm::mat4 lightView = glm::lookAt(global_light::position, glm::vec3(0.0f), glm::vec3(0.0, 1.0, 0.0));
-            light_space_matrix = lightProjection * lightView;
-        };
-
-        glDisable(GL_CLIP_DISTANCE0);
-
-        shadow_framebuffer.bind_framebuffer();
-        glViewport(0, 0, shadow_framebuffer.width, shadow_framebuffer.height);
-        glClear(GL_DEPTH_BUFFER_BIT);
-        glCullFace(GL_FRONT);
-        configure_matrices();
-        render_stuff_with_shader(depth_shader, default_clipping_plane);
-        glCullFace(GL_BACK);
-        shadow_framebuffer.unbind_framebuffer(display_width, display_height);
+        pick_button_down = pick_button;
+        occlusion.update(projection * view);
+        queries.collect();
 
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        configure_matrices();
+        const float vl = 1;
+        glm::mat4 lightProjection = glm::ortho(-vl, vl, -vl, vl, near_plane, far_plane);
+        glm::mat4 lightView = glm::lookAt(global_light::position, glm::vec3(0.0f), glm::vec3(0.0, 1.0, 0.0));
+        light_space_matrix = lightProjection * lightView;
 
-        render_stuff(default_clipping_plane);
+        const auto unbind_framebuffer = [&, width = display_width, height = display_height]() {
+            water_framebuffers_controller::unbind_current_framebuffer(width, height);
+        };
 
-        simple_cube::render(
-            simple_cube_vao,
-            simple_object_shader,
-            glm::translate(glm::scale(glm::mat4(1.0f), glm::vec3(0.015f)), global_light::position),
-            view,
-            projection
+        auto distance = 2 * scene_camera.position.y;
+        scene_camera.position.y -= distance;
+        scene_camera.pitch = -scene_camera.pitch;
+        scene_camera.update();
+        queue.set_pass(reflection_pass, {
+            scene_camera.get_view_matrix(), projection, reflection_clipping_plane, scene_camera.position, far_plane, false,
+            [&]() {
+                water_framebuffers.bind_reflection_frame_buffer();
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                gl_state::enable(GL_CLIP_DISTANCE0);
+                gl_state::enable(GL_DEPTH_TEST);
+            },
+            unbind_framebuffer,
+            set_pass_uniforms
+        });
+        scene_camera.position.y += distance;
+        scene_camera.pitch = -scene_camera.pitch;
+        scene_camera.update();
+
+        queue.set_pass(refraction_pass, {
+            view, projection, refraction_clipping_plane, scene_camera.position, far_plane, false,
+            [&]() {
+                water_framebuffers.bind_refraction_frame_buffer();
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                gl_state::enable(GL_CLIP_DISTANCE0);
+            },
+            [&, unbind_framebuffer]() {
+                unbind_framebuffer();
+                gl_state::disable(GL_CLIP_DISTANCE0);
+            },
+            set_pass_uniforms
+        });
+        queue.set_pass(shadow_pass, {
+            lightView, lightProjection, default_clipping_plane, global_light::position, far_plane, true,
+            [&]() {
+                shadow_framebuffer.bind_framebuffer();
+                glClear(GL_DEPTH_BUFFER_BIT);
+                gl_state::cull_face(GL_FRONT);
+            },
+            [&, unbind_framebuffer]() {
+                gl_state::cull_face(GL_BACK);
+                unbind_framebuffer();
+            },
+            set_shadow_pass_uniforms
+        });
+        queue.set_pass(main_pass, {
+            view, projection, default_clipping_plane, scene_camera.position, far_plane, false,
+            [&]() {
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            },
+            [&]() {
+                simple_cube::render(
+                    simple_cube_vao,
+                    simple_object_shader,
+                    glm::translate(glm::scale(glm::mat4(1.0f), glm::vec3(0.015f)), global_light::position),
+                    view,
+                    projection
+                );
+                //simple_cube::render(
+                //    simple_cube_vao,
+                //    simple_object_shader,
+                //    glm::translate(glm::scale(glm::mat4(1.0f), glm::vec3(0.01f)), lighthouse_light_position),
+                //    view,
+                //    projection
+                //);
+                for (const auto& placeholder: placeholders) {
+                    if (!streamer.is_ready(placeholder.asset)) {
+                        simple_cube::render(simple_cube_vao, simple_object_shader, placeholder.transform(), view, projection);
+                    }
+                }
+                // The depth buffer now holds everything the main pass draws, the answers are used from the next frame on.
+                queries.issue(simple_object_shader, frame_stream, view, projection, scene_camera.position, near_plane);
+            },
+            set_pass_uniforms
+        });
+        queue.set_pass(water_pass, {
+            view, projection, default_clipping_plane, scene_camera.position, far_plane, true,
+            [&]() {
+                water_framebuffers.bind_textures();
+                gl_state::enable(GL_BLEND);
+                gl_state::blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            },
+            []() {
+                gl_state::disable(GL_BLEND);
+            },
+            set_water_pass_uniforms
+        });
+
+        // Objects are culled against the view volume of every pass through the BVH, the queue only sees visible ones.
+        std::array<size_t, water_pass + 1> visible_objects = {};
+        // Refraction and main render from the camera the occlusion buffer is drawn for.
+        std::array<size_t, water_pass + 1> occluded_objects = {};
+        const auto submit_scene = [&](size_t pass, const pass_shaders& shaders) {
+            const auto test_occlusion = pass == refraction_pass || pass == main_pass;
+            scene_bvh.query(queue.get_frustum(pass), [&](uint32_t object) {
+                if (test_occlusion && !occlusion.is_visible(scene_bvh.get_bounds(object))) {
+                    occluded_objects[pass] += 1;
+                    return;
+                }
+                auto& target = scene_objects[object];
+                auto condition = std::make_optional<GLuint>(0);
+                if (pass == main_pass && target.query.has_value()) {
+                    condition = queries.draw_condition(*target.query);
+                }
+                if (!condition.has_value()) {
+                    return;
+                }
+                queue.set_condition(pass, *condition);
+                target.submit(queue, pass, shaders);
+                queue.set_condition(pass, 0);
+                visible_objects[pass] += 1;
+            });
+        };
+        // Passes are culled, recorded and sorted as jobs, each into its own list, the GL thread only replays them.
+        const std::array<const pass_shaders*, water_pass> scene_pass_shaders = {&reflection_shaders, &refraction_shaders, &shadow_shaders, &main_shaders};
+        const auto record_start = std::chrono::steady_clock::now();
+        jobs.parallel_for(water_pass + 1, 1, [&](size_t pass, size_t) {
+            if (pass == water_pass) {
+                submit_water(queue, water_shader, water_mesh);
+            } else {
+                submit_scene(pass, *scene_pass_shaders[pass]);
+            }
+            queue.prepare(pass);
+        });
+        const auto record_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - record_start).count();
+        for (uint32_t object = 0; object < scene_objects.size(); object += 1) {
+            if (scene_objects[object].query.has_value()) {
+                queries.set_bounds(*scene_objects[object].query, scene_bvh.get_bounds(object));
+            }
+        }
+        const auto queue_stats = queue.execute();
+        frame_stream.end_frame();
+
+        ui::begin_frame();
+        ImGui::Begin("Stats");
+        ImGui::Text("Uniform calls: %zu issued, %zu skipped", uniform_stats.issued, uniform_stats.skipped);
+        ImGui::Text("GL state calls: %zu requested, %zu issued", gl_call_stats.requested, gl_call_stats.issued);
+        ImGui::Text("Draw items: %zu in %zu draw calls, %zu program and %zu material switches", queue_stats.items, queue_stats.draw_calls, queue_stats.program_switches, queue_stats.material_switches);
+        ImGui::Text("Instances: %zu", queue_stats.instances);
+        ImGui::Text("Draw lists: %.2f ms on %zu threads", record_ms, jobs.size());
+        // The first entry is the main thread, which runs jobs while it waits for them.
+        for (size_t thread = 0; thread < job_stats.size(); thread += 1) {
+            ImGui::Text(
+                "Job thread %zu: %.0f%% busy, %zu jobs, %zu stolen",
+                thread,
+                job_stats[thread].utilization * 100.0f,
+                job_stats[thread].jobs,
+                job_stats[thread].stolen
+            );
+        }
+        const auto& streaming_stats = streamer.get_stats();
+        ImGui::Text(
+            "Assets: %zu of %zu streamed, %zu failed, %.2f ms putting them into the scene",
+            streaming_stats.ready,
+            streaming_stats.requested,
+            streaming_stats.failed,
+            streaming_stats.integration_ms
         );
-
-        //simple_cube::render(
-        //    simple_cube_vao,
-        //    simple_object_shader,
-        //    glm::translate(glm::scale(glm::mat4(1.0f), glm::vec3(0.01f)), lighthouse_light_position),
-        //    view,
-        //    projection
-        //);
-
-        render_water(view, projection, water_framebuffers, water_shader, water_mesh);
+        const auto texture_usage = texture_registry::get_usage();
+        ImGui::Text(
+            "Textures: %zu in %.1f MB, %zu unused, %zu loaded, %zu shared by path, %zu by contents",
+            texture_usage.textures,
+            (float)texture_usage.bytes / (1 << 20),
+            texture_usage.unused,
+            texture_usage.loads,
+            texture_usage.path_hits,
+            texture_usage.content_hits
+        );
+        if (first_frame_ms.has_value()) {
+            ImGui::Text("First frame after %.0f ms, all assets after %.0f ms", *first_frame_ms, streaming_stats.total_ms);
+        }
+        const auto trees_ready = streamer.is_ready(trees_asset);
+        ImGui::Text("Trees: %zu in %zu cells", trees_ready ? trees->get_instance_count() : 0, trees_ready ? trees->get_cell_count() : 0);
+        ImGui::Text(
+            "Static world: %zu meshes merged into %zu in %zu chunks",
+            static_world.get_source_mesh_count(),
+            static_world.get_mesh_count(),
+            static_world.get_chunks().size()
+        );
+        const char* pass_names[] = {"Reflection", "Refraction", "Shadow", "Main", "Water"};
+        for (size_t pass = reflection_pass; pass <= water_pass; pass += 1) {
+            const auto& culling = queue_stats.culling[pass];
+            ImGui::Text(
+                "%s pass: %zu of %zu objects, %zu draw items visible, %zu culled",
+                pass_names[pass],
+                visible_objects[pass],
+                scene_objects.size(),
+                culling.visible,
+                culling.culled
+            );
+        }
+        const auto occlusion_stats = occlusion.get_stats();
+        ImGui::Text(
+            "Occlusion: %zu occluder triangles in %.2f ms, hidden objects: %zu refraction, %zu main",
+            occlusion_stats.triangles,
+            occlusion_stats.rasterization_ms,
+            occluded_objects[refraction_pass],
+            occluded_objects[main_pass]
+        );
+        const auto& query_stats = queries.get_stats();
+        ImGui::Text(
+            "Occlusion queries: %zu meshes, %zu issued, %zu read, skipped draws: %zu, conditional draws: %zu",
+            queries.size(),
+            query_stats.issued,
+            query_stats.collected,
+            query_stats.skipped,
+            query_stats.conditional
+        );
+        const auto& stream_stats = frame_stream.get_stats();
+        ImGui::Text(
+            "Stream buffer: %zu of %zu KB, %s, %zu failed allocations%s",
+            stream_stats.allocated / 1024,
+            frame_stream.get_frame_size() / 1024,
+            frame_stream.is_persistent() ? "persistently mapped" : "mapped per frame",
+            stream_stats.failed,
+            stream_stats.waited ? ", waited for the GPU" : ""
+        );
+        if (picked.has_value()) {
+            ImGui::Text("Picked: %s at %.3f", scene_objects[picked->object].name.c_str(), picked->distance);
+        } else {
+            ImGui::Text("Picked: nothing, left click an object");
+        }
+        ImGui::End();
+        ui::end_frame();
+        // ImGui sets up its own program, textures and blending behind the cache.
+        gl_state::invalidate();
 
         glfwSwapBuffers(window);
+        if (!first_frame_ms.has_value()) {
+            first_frame_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+            fmt::print("First frame after {:.0f} ms\n", *first_frame_ms);
+        }
     }
+    ui::dispose();
     water_framebuffers.dispose();
     glfwDestroyWindow(window);
     glfwTerminate();
@@ -3,6 +3,8 @@
 
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <GL/glew.h>
 #include <glm/glm.hpp>
 #include <vector>
@@ -10,6 +12,10 @@
 #include <iostream>
 #include <climits>
 #include <cmath>
+#include <memory>
+
+#include "gl_state.hpp"
+#include "instance_buffer.hpp"
 
 
 struct __attribute__ ((packed)) vertex {
@@ -25,27 +31,41 @@ struct __attribute__ ((packed)) vertex {
     glm::vec3 color;
 };
 
+// Ids no two meshes or models of a run share, unlike their addresses, which later ones can be allocated at.
+inline uint64_t next_render_id() {
+    static std::atomic<uint64_t> next = 0;
+    return next++;
+}
+
 struct texture {
-    texture(GLuint id, std::string type): id(id), type(std::move(type)) {}
+    texture(GLuint id, std::string type, GLenum target = GL_TEXTURE_2D, std::shared_ptr<const void> owner = nullptr):
+        id(id), type(std::move(type)), target(target), owner(std::move(owner)) {}
 
     GLuint id;
     std::string type;
+    GLenum target;
+    // Keeps what the id belongs to alive while a mesh has it, such as a texture of the texture registry.
+    std::shared_ptr<const void> owner;
 };
 
 class mesh {
 public:
 
-    mesh(std::vector<vertex> vertices, std::vector<GLuint> indices, std::vector<texture> textures = {}):
+    // Meshes of a packed model are not uploaded on their own, the model keeps them all in shared buffers.
+    mesh(std::vector<vertex> vertices, std::vector<GLuint> indices, std::vector<texture> textures = {}, bool upload = true):
         vertices(vertices), indices(indices), textures(textures)
     {
-        setup_mesh();
+        setup_mesh(upload);
     }
 
-    mesh(const mesh& other) = default;
+    // A copy gets a render id of its own, its textures can change apart from the original's.
+    mesh(const mesh& other): vertices(other.vertices), indices(other.indices), textures(other.textures),
+        min_values(other.min_values), max_values(other.max_values), vao(other.vao), vbo(other.vbo), ebo(other.ebo) {}
 
     mesh(mesh&& other) noexcept: vertices(std::move(other.vertices)), indices(std::move(other.indices)),
         textures(std::move(other.textures)), min_values(std::move(other.min_values)),
-        max_values(std::move(other.max_values)), vao(other.vao), vbo(other.vbo), ebo(other.ebo) {}
+        max_values(std::move(other.max_values)), vao(other.vao), vbo(other.vbo), ebo(other.ebo),
+        render_id(other.render_id) {}
 
     static std::string get_diffuse_texture_name(int nm) {
         return "texture_diffuse" + std::to_string(nm);
@@ -59,28 +79,79 @@ public:
         return "texture_specular" + std::to_string(nm);
     }
 
+    // Identifies the mesh to the render queue for the whole run.
+    [[nodiscard]]
+    uint64_t get_render_id() const {
+        return render_id;
+    }
+
     void draw(shader_program& shader, bool ignore_textures = false) {
         if (!ignore_textures) {
-            int diffuse_textures = 1;
-            int specular_textures = 1;
-            int normal_textures = 1;
-            for (size_t index = 0; index < textures.size(); index += 1) {
-                glActiveTexture(GL_TEXTURE1 + index);
-                std::string number;
-                auto name = textures[index].type;
-                if (name == "texture_diffuse") {
-                    number = std::to_string(diffuse_textures++);
-                } else if (name == "texture_normal") {
-                    number = std::to_string(normal_textures++);
-                }
-                shader.set_uniform(name + number, (int) (index + 1));
-                glBindTexture(GL_TEXTURE_2D, textures[index].id);
-            }
-            glActiveTexture(GL_TEXTURE0);
+            bind_textures(shader);
         }
-        glBindVertexArray(vao);
+        if (vao == 0) {
+            create_vertex_array();
+        }
+        gl_state::bind_vertex_array(vao);
         glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
+    }
+
+    // Draws instance_count instances in one call with a vertex array from create_instanced_vertex_array().
+    void draw_instanced(shader_program& shader, GLuint instanced_vao, size_t instance_count, bool ignore_textures = false) {
+        if (!ignore_textures) {
+            bind_textures(shader);
+        }
+        gl_state::bind_vertex_array(instanced_vao);
+        glDrawElementsInstanced(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0, instance_count);
+    }
+
+    // A vertex array reading the mesh's vertices plus the per-instance model matrices, one attribute per column.
+    // Each instance buffer gets its own vertex array, so switching between them is a single bind.
+    GLuint create_instanced_vertex_array(const instance_buffer& instances) {
+        GLuint instanced_vao = 0;
+        glGenVertexArrays(1, &instanced_vao);
+        gl_state::bind_vertex_array(instanced_vao);
+        bind_vertex_attributes(vbo, ebo);
+        glBindBuffer(GL_ARRAY_BUFFER, instances.get_id());
+        for (GLuint column = 0; column < 4; column += 1) {
+            auto attribute = instance_buffer::first_attribute + column;
+            glEnableVertexAttribArray(attribute);
+            glVertexAttribPointer(attribute, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(column * sizeof(glm::vec4)));
+            glVertexAttribDivisor(attribute, 1);
+        }
+        gl_state::bind_vertex_array(0);
+        return instanced_vao;
+    }
+
+    // Points the bound vertex array at interleaved vertices and their indices.
+    static void bind_vertex_attributes(GLuint vertex_buffer, GLuint element_buffer) {
+        glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, element_buffer);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), nullptr);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)offsetof(vertex, normal));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)offsetof(vertex, texcoords));
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)offsetof(vertex, color));
+    }
+
+    void bind_textures(shader_program& shader) {
+        int diffuse_textures = 1;
+        int specular_textures = 1;
+        int normal_textures = 1;
+        for (size_t index = 0; index < textures.size(); index += 1) {
+            std::string number;
+            auto name = textures[index].type;
+            if (name == "texture_diffuse") {
+                number = std::to_string(diffuse_textures++);
+            } else if (name == "texture_normal") {
+                number = std::to_string(normal_textures++);
+            }
+            shader.set_uniform(name + number, (int) (index + 1));
+            gl_state::bind_texture(index + 1, textures[index].target, textures[index].id);
+        }
     }
 
     std::vector<vertex> vertices;
@@ -88,37 +159,40 @@ public:
     std::vector<texture> textures;
 
     glm::vec3 min_values = glm::vec3(std::numeric_limits<float>::max());
-    glm::vec3 max_values = glm::vec3(std::numeric_limits<float>::min());
+    glm::vec3 max_values = glm::vec3(std::numeric_limits<float>::lowest());
 
 private:
 
-    void setup_mesh() {
+    void setup_mesh(bool upload) {
         for (auto& vertex: vertices) {
             min_values = glm::min(min_values, vertex.position);
             max_values = glm::max(max_values, vertex.position);
         }
-        glGenVertexArrays(1, &vao);
+        if (!upload) {
+            return;
+        }
         glGenBuffers(1, &vbo);
         glGenBuffers(1, &ebo);
-        glBindVertexArray(vao);
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(vertex), vertices.data(), GL_STATIC_DRAW);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), nullptr);
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)offsetof(vertex, normal));
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)offsetof(vertex, texcoords));
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)offsetof(vertex, color));
-        glBindVertexArray(0);
+        // The element array binding belongs to whichever vertex array is bound, the copy target leaves it alone.
+        glBindBuffer(GL_COPY_WRITE_BUFFER, vbo);
+        glBufferData(GL_COPY_WRITE_BUFFER, vertices.size() * sizeof(vertex), vertices.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, ebo);
+        glBufferData(GL_COPY_WRITE_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+    }
+
+    // Buffers are shared with the streaming context that may have filled them, vertex arrays are not,
+    // so the vertex array is made on the first draw by the context that draws.
+    void create_vertex_array() {
+        glGenVertexArrays(1, &vao);
+        gl_state::bind_vertex_array(vao);
+        bind_vertex_attributes(vbo, ebo);
+        gl_state::bind_vertex_array(0);
     }
 
     GLuint vao = 0;
     GLuint vbo = 0;
     GLuint ebo = 0;
+    uint64_t render_id = next_render_id();
 };
 
 #endif
@@ -0,0 +1,267 @@
+#ifndef MIP_CHAIN_HPP
+#define MIP_CHAIN_HPP
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#include "job_system.hpp"
+
+// Mip levels of 8 bit images built on the CPU, instead of leaving glGenerateMipmap to the driver.
+// Every level is a 2x2 box filter of the one above it; levels are kept as linear floats between steps, so rounding
+// does not add up down the chain, and only written out as bytes. sRGB colors are averaged as linear light, which
+// keeps bright details from darkening as they shrink. Jobs filter bands of rows of the first level and carry every
+// band down through the next few levels while its rows are still in cache, two pixels at a time when built with AVX
+// (ENABLE_AVX) and one at a time with SSE; the small levels left below are filtered on the calling thread.
+namespace mip_chain {
+    struct level {
+        int width = 0;
+        int height = 0;
+        std::vector<uint8_t> pixels;
+    };
+
+    namespace details {
+        struct tables {
+            float srgb_to_linear[256];
+            float unorm_to_float[256];
+            // Linear values in 4095ths to sRGB bytes.
+            uint8_t linear_to_srgb[4096];
+        };
+
+        inline const tables& get_tables() {
+            static const tables result = []() {
+                tables created;
+                for (int index = 0; index < 256; index += 1) {
+                    auto value = (float)index / 255.0f;
+                    created.srgb_to_linear[index] = value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+                    created.unorm_to_float[index] = value;
+                }
+                for (int index = 0; index < 4096; index += 1) {
+                    auto value = (float)index / 4095.0f;
+                    auto encoded = value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+                    created.linear_to_srgb[index] = (uint8_t)std::clamp(encoded * 255.0f + 0.5f, 0.0f, 255.0f);
+                }
+                return created;
+            }();
+            return result;
+        }
+
+        // Whether channel `channel` of an image with `channels` holds an sRGB color; alpha and single channels never do.
+        constexpr bool is_srgb(int channel, int channels, bool gamma) {
+            return gamma && channels >= 3 && channel < 3;
+        }
+
+        // One row of the half size level of an 8 bit image, as 4 floats per pixel, from the two rows under it.
+        // `step` is the distance to the second column of a pair, 0 for images one pixel wide.
+        template <int channels>
+        void filter_bytes(const uint8_t* row0, const uint8_t* row1, size_t step, bool gamma, float* output, int new_width) {
+            const auto& lookup = get_tables();
+            const float* decode[channels];
+            for (int channel = 0; channel < channels; channel += 1) {
+                decode[channel] = is_srgb(channel, channels, gamma) ? lookup.srgb_to_linear : lookup.unorm_to_float;
+            }
+            for (int x = 0; x < new_width; x += 1) {
+                const auto x0 = (size_t)x * 2 * channels;
+                const auto x1 = x0 + step;
+                for (int channel = 0; channel < 4; channel += 1) {
+                    if (channel < channels) {
+                        const auto table = decode[channel];
+                        output[x * 4 + channel] = (table[row0[x0 + channel]] + table[row0[x1 + channel]]
+                            + table[row1[x0 + channel]] + table[row1[x1 + channel]]) * 0.25f;
+                    } else {
+                        output[x * 4 + channel] = 0.0f;
+                    }
+                }
+            }
+        }
+
+        // One row of the half size level of a level of 4 floats per pixel, from the two rows under it.
+        inline void filter_floats(const float* row0, const float* row1, int width, float* output, int new_width) {
+            int x = 0;
+            // Both columns of a pair exist whenever the level is at least two wide.
+            if (width >= 2) {
+#if defined(__AVX__)
+                const auto quarter8 = _mm256_set1_ps(0.25f);
+                for (; x + 2 <= new_width; x += 2) {
+                    // Four source pixels: the left pair feeds output x, the right pair output x + 1.
+                    auto left = _mm256_add_ps(_mm256_loadu_ps(row0 + x * 8), _mm256_loadu_ps(row1 + x * 8));
+                    auto right = _mm256_add_ps(_mm256_loadu_ps(row0 + x * 8 + 8), _mm256_loadu_ps(row1 + x * 8 + 8));
+                    auto sum = _mm256_add_ps(_mm256_permute2f128_ps(left, right, 0x20), _mm256_permute2f128_ps(left, right, 0x31));
+                    _mm256_storeu_ps(output + x * 4, _mm256_mul_ps(sum, quarter8));
+                }
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+                const auto quarter = _mm_set1_ps(0.25f);
+                for (; x < new_width; x += 1) {
+                    auto top = _mm_add_ps(_mm_loadu_ps(row0 + x * 8), _mm_loadu_ps(row0 + x * 8 + 4));
+                    auto bottom = _mm_add_ps(_mm_loadu_ps(row1 + x * 8), _mm_loadu_ps(row1 + x * 8 + 4));
+                    _mm_storeu_ps(output + x * 4, _mm_mul_ps(_mm_add_ps(top, bottom), quarter));
+                }
+#endif
+            }
+            for (; x < new_width; x += 1) {
+                const auto x0 = (size_t)x * 8;
+                const auto x1 = width >= 2 ? x0 + 4 : x0;
+                for (int channel = 0; channel < 4; channel += 1) {
+                    output[x * 4 + channel] = (row0[x0 + channel] + row0[x1 + channel] + row1[x0 + channel] + row1[x1 + channel]) * 0.25f;
+                }
+            }
+        }
+
+        // One row of 4 floats per pixel as bytes.
+        template <int channels>
+        void encode(const float* row, int width, bool gamma, uint8_t* output) {
+            const auto& lookup = get_tables();
+            float scales[4];
+            for (int channel = 0; channel < 4; channel += 1) {
+                scales[channel] = is_srgb(channel, channels, gamma) ? 4095.0f : 255.0f;
+            }
+#if defined(__SSE2__) || defined(_M_X64)
+            const auto scale = _mm_loadu_ps(scales);
+#endif
+            for (int x = 0; x < width; x += 1) {
+                alignas(16) int32_t steps[4];
+#if defined(__SSE2__) || defined(_M_X64)
+                // Rounded steps of every channel, clamped to the table or byte range.
+                auto scaled = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(row + x * 4), scale), _mm_setzero_ps()), scale);
+                _mm_store_si128((__m128i*)steps, _mm_cvtps_epi32(scaled));
+#else
+                for (int channel = 0; channel < 4; channel += 1) {
+                    steps[channel] = (int32_t)(std::clamp(row[x * 4 + channel] * scales[channel], 0.0f, scales[channel]) + 0.5f);
+                }
+#endif
+                for (int channel = 0; channel < channels; channel += 1) {
+                    output[x * channels + channel] = is_srgb(channel, channels, gamma) ? lookup.linear_to_srgb[steps[channel]] : (uint8_t)steps[channel];
+                }
+            }
+        }
+
+        // Levels a band of rows is carried down through; a band is 32 rows of the first level and 1 of the sixth.
+        inline constexpr size_t band_depth = 6;
+
+        // Floats a band needs for the rows of its levels above the last one.
+        inline size_t band_scratch_size(const std::vector<level>& levels, size_t depth) {
+            size_t size = 0;
+            for (size_t index = 0; index + 1 < depth; index += 1) {
+                size += ((size_t)1 << (depth - 1 - index)) * levels[index].width * 4;
+            }
+            return size;
+        }
+
+        // Rows of the first `depth` levels below the image that come from band `band`. The rows of the last of these
+        // levels are kept as floats in `bottom`, the other ones only as long as the band needs them, in `scratch`.
+        template <int channels>
+        void filter_band(const uint8_t* pixels, int width, int height, bool gamma, std::vector<level>& levels, size_t depth, size_t band, float* scratch, float* bottom) {
+            // Rows of the level above in this band and the first of them, none above the first level.
+            const float* above = nullptr;
+            size_t above_first = 0;
+            auto above_width = width;
+            auto above_height = height;
+            for (size_t index = 0; index < depth; index += 1) {
+                auto& target = levels[index];
+                const auto rows = (size_t)1 << (depth - 1 - index);
+                const auto first = band * rows;
+                const auto last = std::min(first + rows, (size_t)target.height);
+                const auto row_size = (size_t)target.width * 4;
+                auto floats = index + 1 == depth ? bottom + first * row_size : scratch;
+                for (auto y = first; y < last; y += 1) {
+                    auto output = floats + (y - first) * row_size;
+                    if (above == nullptr) {
+                        const auto row0 = pixels + y * 2 * width * channels;
+                        const auto row1 = height >= 2 ? row0 + (size_t)width * channels : row0;
+                        filter_bytes<channels>(row0, row1, width >= 2 ? channels : 0, gamma, output, target.width);
+                    } else {
+                        const auto row0 = above + (y * 2 - above_first) * above_width * 4;
+                        const auto row1 = above_height >= 2 ? row0 + (size_t)above_width * 4 : row0;
+                        filter_floats(row0, row1, above_width, output, target.width);
+                    }
+                    encode<channels>(output, target.width, gamma, target.pixels.data() + y * target.width * channels);
+                }
+                above = floats;
+                above_first = first;
+                above_width = target.width;
+                above_height = target.height;
+                scratch += rows * row_size;
+            }
+        }
+
+        template <int channels>
+        void filter_levels(const uint8_t* pixels, int width, int height, bool gamma, std::vector<level>& levels, job_system& jobs) {
+            const auto depth = std::min(band_depth, levels.size());
+            const auto scratch_size = band_scratch_size(levels, depth);
+            const auto band_rows = (size_t)1 << (depth - 1);
+            // Floats of the last level the bands reach; not zeroed, the bands write all of it.
+            std::unique_ptr<float[]> bottom(new float[(size_t)levels[depth - 1].width * levels[depth - 1].height * 4]);
+            jobs.parallel_for((levels.front().height + band_rows - 1) / band_rows, 1, [&](size_t first, size_t last) {
+                std::unique_ptr<float[]> scratch(new float[scratch_size]);
+                for (auto band = first; band < last; band += 1) {
+                    filter_band<channels>(pixels, width, height, gamma, levels, depth, band, scratch.get(), bottom.get());
+                }
+            });
+            std::unique_ptr<float[]> current;
+            for (auto index = depth; index < levels.size(); index += 1) {
+                const auto& source = levels[index - 1];
+                auto& target = levels[index];
+                const auto row_size = (size_t)target.width * 4;
+                current.reset(new float[row_size * target.height]);
+                for (size_t y = 0; y < (size_t)target.height; y += 1) {
+                    const auto row0 = bottom.get() + y * 2 * source.width * 4;
+                    const auto row1 = source.height >= 2 ? row0 + (size_t)source.width * 4 : row0;
+                    filter_floats(row0, row1, source.width, current.get() + y * row_size, target.width);
+                    encode<channels>(current.get() + y * row_size, target.width, gamma, target.pixels.data() + y * target.width * channels);
+                }
+                std::swap(bottom, current);
+            }
+        }
+    }
+
+    // Levels of the whole chain of a width x height image, the image itself included.
+    [[nodiscard]]
+    inline uint32_t level_count(int width, int height) {
+        uint32_t count = 1;
+        while (width > 1 || height > 1) {
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+            count += 1;
+        }
+        return count;
+    }
+
+    // Levels below an image of `channels` bytes per pixel, from half its size down to 1x1, in the same layout. With
+    // `gamma` the color channels of 3 and 4 channel images are sRGB. Odd last rows and columns are left out.
+    inline std::vector<level> generate(const uint8_t* pixels, int width, int height, int channels, bool gamma, job_system& jobs) {
+        std::vector<level> levels;
+        for (auto level_width = width, level_height = height; level_width > 1 || level_height > 1;) {
+            level_width = std::max(1, level_width / 2);
+            level_height = std::max(1, level_height / 2);
+            level next;
+            next.width = level_width;
+            next.height = level_height;
+            next.pixels.resize((size_t)level_width * level_height * channels);
+            levels.push_back(std::move(next));
+        }
+        if (levels.empty()) {
+            return levels;
+        }
+        if (channels == 1) {
+            details::filter_levels<1>(pixels, width, height, gamma, levels, jobs);
+        } else if (channels == 2) {
+            details::filter_levels<2>(pixels, width, height, gamma, levels, jobs);
+        } else if (channels == 3) {
+            details::filter_levels<3>(pixels, width, height, gamma, levels, jobs);
+        } else {
+            details::filter_levels<4>(pixels, width, height, gamma, levels, jobs);
+        }
+        return levels;
+    }
+}
+
+#endif
@@ -0,0 +1,308 @@
+#ifndef OCCLUSION_CULLER_HPP
+#define OCCLUSION_CULLER_HPP
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "frustum.hpp"
+#include "job_system.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+// CPU occlusion culling: big occluders are rasterized at low resolution into a depth buffer with a
+// per-tile farthest depth on top, and object boxes are tested against it before they are submitted.
+// Rasterization runs as a job one frame ahead: update() queues it for the current camera and makes the
+// buffer finished for the previous camera current. Tests use that buffer with the camera it
+// was rendered with, so results lag one frame behind camera motion and nothing is read back from the GPU.
+class occlusion_culler {
+public:
+    static constexpr int width = 256;
+    static constexpr int height = 128;
+    static constexpr int tile_size = 8;
+    static constexpr int tiles_x = width / tile_size;
+    static constexpr int tiles_y = height / tile_size;
+
+    struct stats {
+        size_t triangles = 0;
+        float rasterization_ms = 0.0f;
+    };
+
+    explicit occlusion_culler(job_system& jobs): jobs(jobs) {}
+
+    occlusion_culler(const occlusion_culler& other) = delete;
+
+    occlusion_culler& operator=(const occlusion_culler& other) = delete;
+
+    ~occlusion_culler() {
+        jobs.wait(rasterized);
+    }
+
+    // Occluders are static world space triangles, added ones are drawn from the next update() on.
+    // They should lie inside the objects they stand for, anything they cover is considered hidden.
+    void add_occluder(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices, const glm::mat4& model = glm::mat4(1.0f)) {
+        // The rasterization in flight reads the occluders.
+        jobs.wait(rasterized);
+        auto base = (uint32_t)occluder_positions.size();
+        for (const auto& position: positions) {
+            occluder_positions.push_back(glm::vec3(model * glm::vec4(position, 1.0f)));
+        }
+        for (auto index: indices) {
+            occluder_indices.push_back(base + index);
+        }
+    }
+
+    // Starts rasterizing for this camera and switches tests to the buffer of the previous one.
+    void update(const glm::mat4& view_projection) {
+        jobs.wait(rasterized);
+        std::swap(current, next);
+        next.view_projection = view_projection;
+        jobs.run([this]() { rasterize(next); }, &rasterized);
+    }
+
+    // False only when the box is behind occluders at every pixel it covers.
+    [[nodiscard]]
+    bool is_visible(const aabb& box) const {
+        if (!current.valid) {
+            return true;
+        }
+        auto screen_min = glm::vec2(std::numeric_limits<float>::max());
+        auto screen_max = glm::vec2(std::numeric_limits<float>::lowest());
+        auto nearest = std::numeric_limits<float>::max();
+        for (int corner = 0; corner < 8; corner += 1) {
+            auto point = glm::vec4(
+                corner & 1 ? box.max.x : box.min.x,
+                corner & 2 ? box.max.y : box.min.y,
+                corner & 4 ? box.max.z : box.min.z,
+                1.0f
+            );
+            auto clip = current.view_projection * point;
+            // Boxes crossing the near plane surround the camera.
+            if (clip.w <= near_w || clip.z < -clip.w) {
+                return true;
+            }
+            auto screen = to_screen(clip);
+            screen_min = glm::min(screen_min, glm::vec2(screen.x, screen.y));
+            screen_max = glm::max(screen_max, glm::vec2(screen.x, screen.y));
+            nearest = std::min(nearest, screen.z);
+        }
+        auto x0 = to_pixel(screen_min.x, width, false);
+        auto y0 = to_pixel(screen_min.y, height, false);
+        auto x1 = std::min(width - 1, to_pixel(screen_max.x, width, true));
+        auto y1 = std::min(height - 1, to_pixel(screen_max.y, height, true));
+        if (x0 > x1 || y0 > y1) {
+            return true;
+        }
+        for (auto tile_y = y0 / tile_size; tile_y <= y1 / tile_size; tile_y += 1) {
+            for (auto tile_x = x0 / tile_size; tile_x <= x1 / tile_size; tile_x += 1) {
+                if (nearest > current.tile_depth[tile_y * tiles_x + tile_x]) {
+                    continue;
+                }
+                // Some pixel of the tile is farther than the box, look at the ones the box covers.
+                auto from_y = std::max(y0, tile_y * tile_size);
+                auto to_y = std::min(y1, tile_y * tile_size + tile_size - 1);
+                auto from_x = std::max(x0, tile_x * tile_size);
+                auto to_x = std::min(x1, tile_x * tile_size + tile_size - 1);
+                for (auto y = from_y; y <= to_y; y += 1) {
+                    for (auto x = from_x; x <= to_x; x += 1) {
+                        if (nearest <= current.depth[y * width + x]) {
+                            return true;
+                        }
+                    }
+                }
+            }
+        }
+        return false;
+    }
+
+    [[nodiscard]]
+    stats get_stats() const {
+        return current.frame_stats;
+    }
+
+private:
+    static constexpr float near_w = 1e-5f;
+
+    struct depth_buffer {
+        // Depth in [0, 1] per pixel, 1 where no occluder was drawn.
+        std::vector<float> depth = std::vector<float>(width * height, 1.0f);
+        // Farthest depth of every tile.
+        std::vector<float> tile_depth = std::vector<float>(tiles_x * tiles_y, 1.0f);
+        glm::mat4 view_projection = glm::mat4(1.0f);
+        stats frame_stats;
+        bool valid = false;
+    };
+
+    // Pixel coordinate clamped to [0, size] before the conversion, so that far off-screen values do not overflow.
+    static int to_pixel(float value, int size, bool round_up) {
+        value = std::clamp(value, 0.0f, (float)size);
+        return (int)(round_up ? std::ceil(value) : std::floor(value));
+    }
+
+    static glm::vec3 to_screen(const glm::vec4& clip) {
+        auto ndc = glm::vec3(clip) / clip.w;
+        return glm::vec3((ndc.x * 0.5f + 0.5f) * width, (0.5f - ndc.y * 0.5f) * height, ndc.z * 0.5f + 0.5f);
+    }
+
+    void rasterize(depth_buffer& target) const {
+        auto start = std::chrono::steady_clock::now();
+        std::fill(target.depth.begin(), target.depth.end(), 1.0f);
+        clip_positions.resize(occluder_positions.size());
+        for (size_t index = 0; index < occluder_positions.size(); index += 1) {
+            clip_positions[index] = target.view_projection * glm::vec4(occluder_positions[index], 1.0f);
+        }
+        target.frame_stats.triangles = 0;
+        for (size_t index = 0; index + 2 < occluder_indices.size(); index += 3) {
+            std::array<glm::vec4, 3> triangle = {
+                clip_positions[occluder_indices[index]],
+                clip_positions[occluder_indices[index + 1]],
+                clip_positions[occluder_indices[index + 2]]
+            };
+            target.frame_stats.triangles += clip_and_draw(target, triangle);
+        }
+        for (int tile_y = 0; tile_y < tiles_y; tile_y += 1) {
+            for (int tile_x = 0; tile_x < tiles_x; tile_x += 1) {
+                auto farthest = 0.0f;
+                for (int y = tile_y * tile_size; y < (tile_y + 1) * tile_size; y += 1) {
+                    auto row = target.depth.begin() + y * width + tile_x * tile_size;
+                    farthest = std::max(farthest, *std::max_element(row, row + tile_size));
+                }
+                target.tile_depth[tile_y * tiles_x + tile_x] = farthest;
+            }
+        }
+        target.valid = true;
+        target.frame_stats.rasterization_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Cuts the part in front of the near plane away, returns the number of triangles drawn.
+    static size_t clip_and_draw(depth_buffer& target, const std::array<glm::vec4, 3>& triangle) {
+        std::array<glm::vec4, 4> polygon;
+        size_t count = 0;
+        for (size_t index = 0; index < 3; index += 1) {
+            const auto& from = triangle[index];
+            const auto& to = triangle[(index + 1) % 3];
+            // Signed distance to the near plane z = -w.
+            auto from_distance = from.z + from.w;
+            auto to_distance = to.z + to.w;
+            if (from_distance >= 0.0f) {
+                polygon[count++] = from;
+            }
+            if ((from_distance >= 0.0f) != (to_distance >= 0.0f)) {
+                polygon[count++] = glm::mix(from, to, from_distance / (from_distance - to_distance));
+            }
+        }
+        if (count < 3) {
+            return 0;
+        }
+        std::array<glm::vec3, 4> screen;
+        for (size_t index = 0; index < count; index += 1) {
+            if (polygon[index].w <= near_w) {
+                return 0;
+            }
+            screen[index] = to_screen(polygon[index]);
+        }
+        draw(target, screen[0], screen[1], screen[2]);
+        if (count == 4) {
+            draw(target, screen[0], screen[2], screen[3]);
+        }
+        return count - 2;
+    }
+
+    // Keeps the nearest depth at every pixel center inside the triangle, from either side.
+    static void draw(depth_buffer& target, glm::vec3 v0, glm::vec3 v1, glm::vec3 v2) {
+        const auto edge = [](glm::vec3 a, glm::vec3 b, float x, float y) {
+            return (b.x - a.x) * (y - a.y) - (b.y - a.y) * (x - a.x);
+        };
+        auto area = edge(v0, v1, v2.x, v2.y);
+        if (std::abs(area) < 1e-8f) {
+            return;
+        }
+        if (area < 0.0f) {
+            std::swap(v1, v2);
+            area = -area;
+        }
+        auto x0 = to_pixel(std::min({v0.x, v1.x, v2.x}), width, false) & ~3;
+        auto y0 = to_pixel(std::min({v0.y, v1.y, v2.y}), height, false);
+        auto x1 = std::min(width - 1, to_pixel(std::max({v0.x, v1.x, v2.x}), width, true));
+        auto y1 = std::min(height - 1, to_pixel(std::max({v0.y, v1.y, v2.y}), height, true));
+        if (x0 > x1 || y0 > y1) {
+            return;
+        }
+        // Edge functions and depth as a * x + b * y + c at pixel centers.
+        std::array<glm::vec3, 3> edges;
+        const std::array<std::pair<glm::vec3, glm::vec3>, 3> sides = {std::make_pair(v1, v2), std::make_pair(v2, v0), std::make_pair(v0, v1)};
+        for (size_t index = 0; index < 3; index += 1) {
+            auto [a, b] = sides[index];
+            edges[index] = glm::vec3(-(b.y - a.y), b.x - a.x, (b.y - a.y) * a.x - (b.x - a.x) * a.y);
+        }
+        auto depth_plane = (edges[0] * v0.z + edges[1] * v1.z + edges[2] * v2.z) / area;
+        for (int y = y0; y <= y1; y += 1) {
+            auto py = y + 0.5f;
+            auto* row = target.depth.data() + y * width;
+            auto x = x0;
+#if defined(__SSE2__) || defined(_M_X64)
+            const auto lanes = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+            __m128 step[3];
+            __m128 weights[3];
+            for (size_t index = 0; index < 3; index += 1) {
+                step[index] = _mm_set1_ps(edges[index].x * 4.0f);
+                weights[index] = _mm_add_ps(
+                    _mm_mul_ps(_mm_add_ps(_mm_set1_ps((float)x), lanes), _mm_set1_ps(edges[index].x)),
+                    _mm_set1_ps(edges[index].y * py + edges[index].z)
+                );
+            }
+            auto depth_step = _mm_set1_ps(depth_plane.x * 4.0f);
+            auto depth = _mm_add_ps(
+                _mm_mul_ps(_mm_add_ps(_mm_set1_ps((float)x), lanes), _mm_set1_ps(depth_plane.x)),
+                _mm_set1_ps(depth_plane.y * py + depth_plane.z)
+            );
+            const auto zero = _mm_setzero_ps();
+            for (; x <= x1; x += 4) {
+                auto inside = _mm_and_ps(
+                    _mm_and_ps(_mm_cmpge_ps(weights[0], zero), _mm_cmpge_ps(weights[1], zero)),
+                    _mm_cmpge_ps(weights[2], zero)
+                );
+                if (_mm_movemask_ps(inside) != 0) {
+                    auto stored = _mm_loadu_ps(row + x);
+                    auto nearest = _mm_min_ps(stored, depth);
+                    _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, stored)));
+                }
+                for (size_t index = 0; index < 3; index += 1) {
+                    weights[index] = _mm_add_ps(weights[index], step[index]);
+                }
+                depth = _mm_add_ps(depth, depth_step);
+            }
+#endif
+            for (; x <= x1; x += 1) {
+                auto px = x + 0.5f;
+                if (glm::dot(edges[0], glm::vec3(px, py, 1.0f)) >= 0.0f && glm::dot(edges[1], glm::vec3(px, py, 1.0f)) >= 0.0f &&
+                    glm::dot(edges[2], glm::vec3(px, py, 1.0f)) >= 0.0f) {
+                    row[x] = std::min(row[x], glm::dot(depth_plane, glm::vec3(px, py, 1.0f)));
+                }
+            }
+        }
+    }
+
+    std::vector<glm::vec3> occluder_positions;
+    std::vector<uint32_t> occluder_indices;
+    // Scratch space of the rasterization job.
+    mutable std::vector<glm::vec4> clip_positions;
+
+    depth_buffer current;
+    depth_buffer next;
+
+    job_system& jobs;
+    job_counter rasterized;
+};
+
+#endif
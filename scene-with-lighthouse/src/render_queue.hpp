@@ -0,0 +1,406 @@
+#ifndef RENDER_QUEUE_HPP
+#define RENDER_QUEUE_HPP
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <GL/glew.h>
+#include <fmt/core.h>
+#include <glm/glm.hpp>
+
+#include "frustum.hpp"
+#include "mesh.hpp"
+#include "model.hpp"
+#include "instance_buffer.hpp"
+#include "shader_program.hpp"
+
+// Everything a pass needs to render the submitted items: where it renders to and from which point of view.
+struct render_pass {
+    glm::mat4 view = glm::mat4(1.0f);
+    glm::mat4 projection = glm::mat4(1.0f);
+    glm::vec4 clipping_plane = glm::vec4(0.0f);
+    glm::vec3 eye = glm::vec3(0.0f);
+    // Distance that maps to the far end of the depth bits of the sort key.
+    float depth_range = 1.0f;
+    // Passes that only write depth skip binding material textures.
+    bool ignore_textures = false;
+    // Binds the target and sets fixed-function state before the first item, restores it after the last.
+    std::function<void()> begin;
+    std::function<void()> end;
+    // Sets per-pass uniforms, called every time the pass switches to a program.
+    std::function<void(shader_program&, const render_pass&)> bind_program;
+};
+
+inline constexpr size_t max_render_passes = 16;
+
+struct pass_culling_stats {
+    size_t visible = 0;
+    size_t culled = 0;
+};
+
+struct render_queue_stats {
+    size_t items = 0;
+    size_t draw_calls = 0;
+    size_t program_switches = 0;
+    size_t material_switches = 0;
+    size_t instances = 0;
+    std::array<pass_culling_stats, max_render_passes> culling = {};
+};
+
+// Collects draw items for all passes of a frame and executes them in one sweep ordered by a packed key:
+//   pass (4 bits) | program (10 bits) | material (14 bits) | mesh (16 bits) | depth (20 bits)
+// so that every pass renders in order and, inside a pass, program and texture switches are minimized.
+// Meshes of a packed model share the mesh bits, so the visible ones of a material end up next to each other
+// and are drawn with a single multi-draw. Meshes and models are told apart by their render ids, and running out of
+// the bits of a field throws instead of letting two ids collide.
+// Items whose world bounds are outside the view volume of their pass are dropped before sorting.
+// Every pass records into its own list: different passes can be submitted to and prepared on different threads
+// at the same time, as long as set_pass() is done before and execute() runs on the GL thread after.
+class render_queue {
+public:
+    static constexpr size_t max_passes = max_render_passes;
+
+    void set_pass(size_t index, render_pass pass) {
+        frustums.at(index) = frustum(pass.projection * pass.view);
+        passes.at(index) = std::move(pass);
+    }
+
+    [[nodiscard]]
+    const frustum& get_frustum(size_t pass) const {
+        return frustums.at(pass);
+    }
+
+    // Items submitted to the pass until the next call are rendered conditionally on the occlusion query, 0 renders them unconditionally.
+    void set_condition(size_t pass, GLuint query) {
+        lists.at(pass).condition = query;
+    }
+
+    void submit(size_t pass, shader_program& shader, mesh& target, const glm::mat4& model) {
+        submit(pass, shader, target, model, aabb{target.min_values, target.max_values}.transformed(model), nullptr, 0);
+    }
+
+    void submit(size_t pass, shader_program& shader, model& target, const glm::mat4& model_matrix) {
+        for (size_t index = 0; index < target.get_meshes().size(); index += 1) {
+            submit(pass, shader, target, index, model_matrix);
+        }
+    }
+
+    // One mesh of a model, so that meshes can be culled one by one and still be drawn together when the model is packed.
+    void submit(size_t pass, shader_program& shader, model& target, size_t mesh_index, const glm::mat4& model_matrix) {
+        auto& target_mesh = target.get_meshes()[mesh_index];
+        auto bounds = aabb{target_mesh.min_values, target_mesh.max_values}.transformed(model_matrix);
+        if (!target.is_packed()) {
+            submit(pass, shader, target_mesh, model_matrix, bounds, nullptr, 0);
+            return;
+        }
+        submit(pass, shader, target_mesh, model_matrix, bounds, nullptr, 0, &target, (uint32_t)mesh_index);
+    }
+
+    // One draw per mesh for all instances; the program multiplies `model` by each instance's matrix.
+    // `bounds` covers all instances in world space.
+    void submit_instanced(size_t pass, shader_program& shader, model_instances& target, const aabb& bounds, const glm::mat4& model_matrix = glm::mat4(1.0f)) {
+        if (target.instances.size() == 0) {
+            return;
+        }
+        auto& meshes = target.source->get_meshes();
+        for (size_t index = 0; index < meshes.size(); index += 1) {
+            submit(pass, shader, meshes[index], model_matrix, bounds, &target, target.instances.size(), nullptr, (uint32_t)index);
+        }
+    }
+
+    // Culls and sorts the items of the pass, execute() does it for the passes it finds unprepared.
+    void prepare(size_t pass) {
+        auto& list = lists.at(pass);
+        cull(list);
+        sort(list);
+        list.prepared = true;
+    }
+
+    // Renders the prepared items pass by pass and clears the lists for the next frame. Does all the GL calls.
+    render_queue_stats execute() {
+        render_queue_stats stats;
+        for (size_t pass_index = 0; pass_index < max_passes; pass_index += 1) {
+            auto& list = lists[pass_index];
+            if (!list.prepared) {
+                prepare(pass_index);
+            }
+            stats.culling[pass_index] = list.culling;
+            stats.items += list.items.size();
+            if (!list.items.empty()) {
+                replay(passes[pass_index], list, stats);
+            }
+            list.items.clear();
+            list.bounds.clear();
+            list.condition = 0;
+            list.culling = {};
+            list.prepared = false;
+        }
+        return stats;
+    }
+
+private:
+    static constexpr uint64_t program_mask = (1ull << 10) - 1;
+    static constexpr uint64_t material_mask = (1ull << 14) - 1;
+    static constexpr uint64_t mesh_mask = (1ull << 16) - 1;
+    static constexpr uint64_t depth_mask = (1ull << 20) - 1;
+
+    struct draw_item {
+        uint64_t key;
+        shader_program* shader;
+        mesh* target;
+        glm::mat4 model_matrix;
+        // Set for instanced meshes, whose vertex array is only asked for on the GL thread.
+        model_instances* instances;
+        size_t instance_count;
+        GLuint condition;
+        // Set for meshes of packed models; part is the index of the mesh in the packed or instanced model.
+        model* packed;
+        uint32_t part;
+    };
+
+    struct mesh_ids {
+        uint32_t mesh;
+        uint32_t material;
+    };
+
+    // Items of one pass in submission order until prepare() culls them and sorts their indices by key.
+    struct pass_list {
+        std::vector<draw_item> items;
+        aabb_batch bounds;
+        std::vector<uint8_t> visibility;
+        std::vector<uint32_t> order;
+        std::vector<uint32_t> scratch;
+        GLuint condition = 0;
+        pass_culling_stats culling;
+        bool prepared = false;
+    };
+
+    void replay(const render_pass& pass, pass_list& list, render_queue_stats& stats) {
+        if (pass.begin) {
+            pass.begin();
+        }
+        shader_program* current_program = nullptr;
+        uint64_t current_material = ~0ull;
+        const auto& order = list.order;
+        for (size_t at = 0; at < order.size(); at += 1) {
+            auto& item = list.items[order[at]];
+            if (item.shader != current_program) {
+                current_program = item.shader;
+                current_program->use();
+                if (pass.bind_program) {
+                    pass.bind_program(*current_program, pass);
+                }
+                stats.program_switches += 1;
+            }
+            auto material = (item.key >> 36) & material_mask;
+            if (material != current_material) {
+                current_material = material;
+                stats.material_switches += 1;
+            }
+            item.shader->set_uniform("model", item.model_matrix);
+            if (item.condition != 0) {
+                glBeginConditionalRender(item.condition, GL_QUERY_NO_WAIT);
+            }
+            if (item.packed != nullptr) {
+                // Following items of the same packed model, material and transform go into the same call.
+                parts.clear();
+                parts.push_back(item.part);
+                while (at + 1 < order.size() && can_merge(item, list.items[order[at + 1]])) {
+                    at += 1;
+                    parts.push_back(list.items[order[at]].part);
+                }
+                item.packed->draw_packed(*item.shader, parts.data(), parts.size(), pass.ignore_textures);
+            } else if (item.instances != nullptr) {
+                item.target->draw_instanced(*item.shader, item.instances->get_vertex_array(item.part), item.instance_count, pass.ignore_textures);
+                stats.instances += item.instance_count;
+            } else {
+                item.target->draw(*item.shader, pass.ignore_textures);
+            }
+            if (item.condition != 0) {
+                glEndConditionalRender();
+            }
+            stats.draw_calls += 1;
+        }
+        if (pass.end) {
+            pass.end();
+        }
+    }
+
+    void submit(
+        size_t pass,
+        shader_program& shader,
+        mesh& target,
+        const glm::mat4& model_matrix,
+        const aabb& world_bounds,
+        model_instances* instances,
+        size_t instance_count,
+        model* packed = nullptr,
+        uint32_t part = 0
+    ) {
+        const auto ids = get_mesh_ids(target);
+        auto mesh_id = packed != nullptr ? get_packed_model_id(*packed) : ids.mesh;
+        auto distance = glm::length(glm::vec3(model_matrix[3]) - passes[pass].eye) / passes[pass].depth_range;
+        auto depth = (uint64_t)(std::clamp(distance, 0.0f, 1.0f) * depth_mask);
+        uint64_t key = (uint64_t)pass << 60;
+        key |= (uint64_t)get_program_id(shader) << 50;
+        key |= (uint64_t)ids.material << 36;
+        key |= (uint64_t)mesh_id << 20;
+        key |= depth;
+        auto& list = lists[pass];
+        list.items.push_back({key, &shader, &target, model_matrix, instances, instance_count, list.condition, packed, part});
+        list.bounds.push_back(world_bounds);
+    }
+
+    // Tests the items of a pass against its frustum and keeps the visible ones in order.
+    void cull(pass_list& list) {
+        auto& items = list.items;
+        if (items.empty()) {
+            return;
+        }
+        list.visibility.resize(items.size());
+        frustums[items.front().key >> 60].cull(list.bounds, 0, items.size(), list.visibility.data());
+        size_t kept = 0;
+        for (size_t index = 0; index < items.size(); index += 1) {
+            if (!list.visibility[index]) {
+                list.culling.culled += 1;
+                continue;
+            }
+            list.culling.visible += 1;
+            items[kept++] = items[index];
+        }
+        items.resize(kept);
+    }
+
+    // Whether next can join the multi-draw of item: same pass, program, material, packed model, transform and condition.
+    static bool can_merge(const draw_item& item, const draw_item& next) {
+        return next.packed == item.packed && (next.key >> 36) == (item.key >> 36) && next.shader == item.shader
+            && next.condition == item.condition && next.model_matrix == item.model_matrix;
+    }
+
+    static void check_capacity(size_t used, uint64_t mask, const char* what) {
+        if (used > mask) {
+            throw std::runtime_error(fmt::format("The render queue ran out of {} ids after {}", what, mask + 1));
+        }
+    }
+
+    // Ids are shared by all passes and looked up from the threads recording them, new ones are added under the write lock.
+    // Programs are told apart by address: one allocated where a deleted one was only inherits its place in the order,
+    // replay() switches programs and merges draws by comparing the programs themselves.
+    uint32_t get_program_id(const shader_program& shader) {
+        {
+            std::shared_lock<std::shared_mutex> lock(ids_mutex);
+            auto found = program_ids.find(&shader);
+            if (found != program_ids.end()) {
+                return found->second;
+            }
+        }
+        std::unique_lock<std::shared_mutex> lock(ids_mutex);
+        auto found = program_ids.find(&shader);
+        if (found != program_ids.end()) {
+            return found->second;
+        }
+        check_capacity(program_ids.size(), program_mask, "program");
+        return program_ids.emplace(&shader, (uint32_t)program_ids.size()).first->second;
+    }
+
+    // Meshes sharing the same set of textures share a material id, so they end up next to each other.
+    mesh_ids get_mesh_ids(const mesh& target) {
+        {
+            std::shared_lock<std::shared_mutex> lock(ids_mutex);
+            auto found = meshes.find(target.get_render_id());
+            if (found != meshes.end()) {
+                return found->second;
+            }
+        }
+        std::vector<GLuint> texture_set;
+        for (const auto& texture: target.textures) {
+            texture_set.push_back(texture.id);
+        }
+        std::unique_lock<std::shared_mutex> lock(ids_mutex);
+        auto found = meshes.find(target.get_render_id());
+        if (found != meshes.end()) {
+            return found->second;
+        }
+        auto material = materials.find(texture_set);
+        if (material == materials.end()) {
+            check_capacity(materials.size(), material_mask, "material");
+            material = materials.emplace(texture_set, (uint32_t)materials.size()).first;
+        }
+        check_capacity(meshes.size() + packed_models.size(), mesh_mask, "mesh");
+        return meshes.emplace(target.get_render_id(), mesh_ids{(uint32_t)meshes.size(), material->second}).first->second;
+    }
+
+    // Packed models count down from the top of the mesh bits, away from the ids of single meshes.
+    uint32_t get_packed_model_id(const model& target) {
+        {
+            std::shared_lock<std::shared_mutex> lock(ids_mutex);
+            auto found = packed_models.find(target.get_render_id());
+            if (found != packed_models.end()) {
+                return found->second;
+            }
+        }
+        std::unique_lock<std::shared_mutex> lock(ids_mutex);
+        auto found = packed_models.find(target.get_render_id());
+        if (found != packed_models.end()) {
+            return found->second;
+        }
+        // Both kinds share the mesh bits, together they must not meet in the middle.
+        check_capacity(meshes.size() + packed_models.size(), mesh_mask, "mesh");
+        return packed_models.emplace(target.get_render_id(), (uint32_t)(mesh_mask - packed_models.size())).first->second;
+    }
+
+    // LSD radix sort of item indices by key, one byte per round.
+    // Rounds where every key has the same byte (most of the pass and program bits) are skipped.
+    void sort(pass_list& list) {
+        const auto& items = list.items;
+        auto& order = list.order;
+        auto& scratch = list.scratch;
+        order.resize(items.size());
+        scratch.resize(items.size());
+        for (size_t index = 0; index < items.size(); index += 1) {
+            order[index] = (uint32_t)index;
+        }
+        for (int shift = 0; shift < 64; shift += 8) {
+            std::array<size_t, 256> offsets = {};
+            for (const auto& item: items) {
+                offsets[(item.key >> shift) & 0xff] += 1;
+            }
+            if (std::any_of(offsets.begin(), offsets.end(), [&](size_t count) { return count == items.size(); })) {
+                continue;
+            }
+            size_t total = 0;
+            for (auto& offset: offsets) {
+                total += std::exchange(offset, total);
+            }
+            for (auto index: order) {
+                scratch[offsets[(items[index].key >> shift) & 0xff]++] = index;
+            }
+            order.swap(scratch);
+        }
+    }
+
+    std::array<render_pass, max_passes> passes;
+    std::array<frustum, max_passes> frustums;
+    std::array<pass_list, max_passes> lists;
+    // Parts of the multi-draw being merged by replay().
+    std::vector<uint32_t> parts;
+    std::shared_mutex ids_mutex;
+    std::unordered_map<const shader_program*, uint32_t> program_ids;
+    // Keyed by render id, never by address: a mesh or model allocated where a deleted one was must not inherit
+    // its material and be merged into draws with the wrong textures.
+    std::unordered_map<uint64_t, mesh_ids> meshes;
+    std::unordered_map<uint64_t, uint32_t> packed_models;
+    std::map<std::vector<GLuint>, uint32_t> materials;
+};
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef SHADER_CACHE_HPP
+#define SHADER_CACHE_HPP
+
+#pragma once
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fmt/format.h>
+
+#include "shader_program.hpp"
+#include "shader_watcher.hpp"
+
+// Owns one compiled program per permutation, keyed by the shader path and its sorted set of defines.
+// Programs live at stable addresses, so passes can hold references to them for the whole run.
+class shader_cache {
+public:
+    explicit shader_cache(shader_watcher* watcher = nullptr): watcher(watcher) {}
+
+    shader_program& get(const std::string& path, std::vector<std::string> defines = {}) {
+        std::sort(defines.begin(), defines.end());
+        defines.erase(std::unique(defines.begin(), defines.end()), defines.end());
+        auto key = permutation_key(path, defines);
+        auto entry = programs.find(key);
+        if (entry != programs.end()) {
+            return *entry->second;
+        }
+        fmt::print("Compiling shader permutation: {}\n", key);
+        auto program = std::make_unique<shader_program>(
+            fmt::format("{}_vertex.glsl", path),
+            fmt::format("{}_fragment.glsl", path),
+            std::move(defines)
+        );
+        if (watcher) {
+            watcher->watch(*program);
+        }
+        return *programs.emplace(key, std::move(program)).first->second;
+    }
+
+    [[nodiscard]]
+    size_t size() const {
+        return programs.size();
+    }
+
+private:
+    static std::string permutation_key(const std::string& path, const std::vector<std::string>& defines) {
+        auto key = path;
+        for (const auto& define: defines) {
+            key += '|';
+            key += define;
+        }
+        return key;
+    }
+
+    std::map<std::string, std::unique_ptr<shader_program>> programs;
+    shader_watcher* watcher;
+};
+
+#endif
@@ -1,9 +1,18 @@
 #include "shader_program.hpp"
+#include "gl_state.hpp"
 
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <utility>
+#include <cstring>
+#include <filesystem>
+#include <algorithm>
+#include <optional>
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
 
 namespace {
     std::string read_shader_code(const std::string& filename) {
@@ -17,75 +26,247 @@ namespace {
         }
         std::terminate();
     }
+
+    std::optional<std::string> parse_include(const std::string& line) {
+        auto start = line.find_first_not_of(" \t");
+        if (start == std::string::npos || line.compare(start, 8, "#include") != 0) {
+            return std::nullopt;
+        }
+        auto open = line.find('"', start + 8);
+        auto close = open == std::string::npos ? open : line.find('"', open + 1);
+        if (close == std::string::npos) {
+            std::cerr << "Malformed shader include: " << line << std::endl;
+            return std::nullopt;
+        }
+        return line.substr(open + 1, close - open - 1);
+    }
+
+    void preprocess(
+        const std::string& path,
+        const std::vector<std::string>& defines,
+        std::vector<std::string>& included,
+        std::string& output
+    ) {
+        auto normalized = std::filesystem::path(path).lexically_normal().generic_string();
+        if (std::find(included.begin(), included.end(), normalized) != included.end()) {
+            return;
+        }
+        const auto file_index = included.size();
+        const auto is_root = file_index == 0;
+        included.push_back(normalized);
+        if (!is_root) {
+            output += fmt::format("#line 1 {}\n", file_index);
+        }
+        std::istringstream input(read_shader_code(normalized));
+        std::string line;
+        int line_number = 0;
+        while (std::getline(input, line)) {
+            line_number += 1;
+            if (auto include = parse_include(line)) {
+                auto include_path = std::filesystem::path(normalized).parent_path() / *include;
+                if (!std::filesystem::exists(include_path)) {
+                    std::cerr << "Shader include not found: " << include_path.generic_string() << " (from " << normalized << ")" << std::endl;
+                }
+                preprocess(include_path.string(), defines, included, output);
+                output += fmt::format("#line {} {}\n", line_number + 1, file_index);
+                continue;
+            }
+            output += line;
+            output += '\n';
+            if (is_root && line.rfind("#version", 0) == 0) {
+                for (const auto& define: defines) {
+                    output += fmt::format("#define {}\n", define);
+                }
+                output += fmt::format("#line {} {}\n", line_number + 1, file_index);
+            }
+        }
+    }
+
+    std::string preprocess(const std::string& path, const std::vector<std::string>& defines, std::vector<std::string>& dependencies) {
+        std::vector<std::string> included;
+        std::string output;
+        preprocess(path, defines, included, output);
+        for (auto& file: included) {
+            if (std::find(dependencies.begin(), dependencies.end(), file) == dependencies.end()) {
+                dependencies.push_back(std::move(file));
+            }
+        }
+        return output;
+    }
+
+    bool has_parallel_shader_compile() {
+        static const bool supported = []() {
+            GLint count = 0;
+            glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+            for (GLint index = 0; index < count; index += 1) {
+                auto name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, index));
+                if (std::strcmp(name, "GL_KHR_parallel_shader_compile") == 0 ||
+                    std::strcmp(name, "GL_ARB_parallel_shader_compile") == 0) {
+                    return true;
+                }
+            }
+            return false;
+        }();
+        return supported;
+    }
 }
 
-shader_program::shader_program(std::string  vertex_shader_path, std::string  fragment_shader_path):
-    vertex_shader_path(std::move(vertex_shader_path)), fragment_shader_path(std::move(fragment_shader_path)) {
-    reload();
+shader_sources load_shader_sources(
+    const std::string& vertex_path,
+    const std::string& fragment_path,
+    const std::vector<std::string>& defines
+) {
+    shader_sources sources;
+    sources.vertex_code = preprocess(vertex_path, defines, sources.dependencies);
+    sources.fragment_code = preprocess(fragment_path, defines, sources.dependencies);
+    return sources;
 }
 
-void shader_program::reload() {
-    const auto vertex_code = read_shader_code(vertex_shader_path);
-    const auto fragment_code = read_shader_code(fragment_shader_path);
-    compile(vertex_code, fragment_code);
-    link();
+shader_program::shader_program(std::string  vertex_shader_path, std::string  fragment_shader_path, std::vector<std::string> defines):
+    vertex_shader_path(std::move(vertex_shader_path)), fragment_shader_path(std::move(fragment_shader_path)),
+    defines(std::move(defines)) {
+    auto sources = load_shader_sources(this->vertex_shader_path, this->fragment_shader_path, this->defines);
+    program_id = link(sources.vertex_code, sources.fragment_code);
+    dependencies = std::move(sources.dependencies);
+    check_linking_error(program_id);
+}
+
+shader_program::shader_program(shader_program&& other) noexcept:
+    program_id(std::exchange(other.program_id, 0)), pending_program_id(std::exchange(other.pending_program_id, 0)),
+    pending_frames(other.pending_frames), vertex_shader_path(std::move(other.vertex_shader_path)),
+    fragment_shader_path(std::move(other.fragment_shader_path)), defines(std::move(other.defines)),
+    dependencies(std::move(other.dependencies)), uniforms(std::move(other.uniforms)) {}
+
+shader_program& shader_program::operator=(shader_program&& other) noexcept {
+    if (this != &other) {
+        gl_state::forget_program(program_id);
+        glDeleteProgram(program_id);
+        glDeleteProgram(pending_program_id);
+        program_id = std::exchange(other.program_id, 0);
+        pending_program_id = std::exchange(other.pending_program_id, 0);
+        pending_frames = other.pending_frames;
+        vertex_shader_path = std::move(other.vertex_shader_path);
+        fragment_shader_path = std::move(other.fragment_shader_path);
+        defines = std::move(other.defines);
+        dependencies = std::move(other.dependencies);
+        uniforms = std::move(other.uniforms);
+    }
+    return *this;
 }
 
 shader_program::~shader_program() {
+    if (pending_program_id != 0) {
+        glDeleteProgram(pending_program_id);
+    }
+    if (program_id != 0) {
+        gl_state::forget_program(program_id);
+        glDeleteProgram(program_id);
+    }
+}
+
+void shader_program::reload() {
+    auto sources = load_shader_sources(vertex_shader_path, fragment_shader_path, defines);
+    auto new_program_id = link(sources.vertex_code, sources.fragment_code);
+    if (!check_linking_error(new_program_id)) {
+        glDeleteProgram(new_program_id);
+        return;
+    }
+    gl_state::forget_program(program_id);
+    glDeleteProgram(program_id);
+    program_id = new_program_id;
+    uniforms.clear();
+    dependencies = std::move(sources.dependencies);
 }
 
-void shader_program::compile(const std::string& vertex_code, const std::string& fragment_code)
-{
-    const char* vcode = vertex_code.c_str();
-    vertex_id = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex_id, 1, &vcode, NULL);
-    glCompileShader(vertex_id);
-
-    const char* fcode = fragment_code.c_str();
-    fragment_id = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment_id, 1, &fcode, NULL);
-    glCompileShader(fragment_id);
-    check_compile_error();
+void shader_program::begin_reload(const shader_sources& sources) {
+    if (pending_program_id != 0) {
+        glDeleteProgram(pending_program_id);
+    }
+    pending_program_id = link(sources.vertex_code, sources.fragment_code);
+    pending_frames = 0;
+    dependencies = sources.dependencies;
 }
 
-void shader_program::link() {
-    program_id = glCreateProgram();
-    glAttachShader(program_id, vertex_id);
-    glAttachShader(program_id, fragment_id);
-    glLinkProgram(program_id);
-    check_linking_error();
+bool shader_program::finish_reload() {
+    if (pending_program_id == 0) {
+        return false;
+    }
+    if (has_parallel_shader_compile()) {
+        GLint completed = GL_FALSE;
+        glGetProgramiv(pending_program_id, GL_COMPLETION_STATUS_KHR, &completed);
+        if (completed != GL_TRUE) {
+            return false;
+        }
+    } else if (pending_frames++ < 1) {
+        // Without the extension give the driver one frame before the status query blocks on it.
+        return false;
+    }
+    auto new_program_id = std::exchange(pending_program_id, 0);
+    if (!check_linking_error(new_program_id)) {
+        glDeleteProgram(new_program_id);
+        return false;
+    }
+    gl_state::forget_program(program_id);
+    glDeleteProgram(program_id);
+    program_id = new_program_id;
+    uniforms.clear();
+    fmt::print("Reloaded shader program: {} {}\n", vertex_shader_path, fragment_shader_path);
+    return true;
+}
+
+GLuint shader_program::compile(GLenum type, const std::string& code) {
+    const char* source = code.c_str();
+    auto shader_id = glCreateShader(type);
+    glShaderSource(shader_id, 1, &source, NULL);
+    glCompileShader(shader_id);
+    return shader_id;
+}
+
+GLuint shader_program::link(const std::string& vertex_code, const std::string& fragment_code) {
+    auto vertex_id = compile(GL_VERTEX_SHADER, vertex_code);
+    auto fragment_id = compile(GL_FRAGMENT_SHADER, fragment_code);
+    auto new_program_id = glCreateProgram();
+    glAttachShader(new_program_id, vertex_id);
+    glAttachShader(new_program_id, fragment_id);
+    glLinkProgram(new_program_id);
+    // Shaders stay attached (and queryable) until the program itself is deleted.
     glDeleteShader(vertex_id);
     glDeleteShader(fragment_id);
+    return new_program_id;
 }
 
 void shader_program::use() {
-    glUseProgram(program_id);
+    gl_state::use_program(program_id);
 }
 
-void shader_program::check_compile_error() {
+bool shader_program::check_compile_error(GLuint shader_id, const char* stage) {
     int success;
     char infoLog[1024];
-    glGetShaderiv(vertex_id, GL_COMPILE_STATUS, &success);
+    glGetShaderiv(shader_id, GL_COMPILE_STATUS, &success);
     if (!success)
     {
-        glGetShaderInfoLog(vertex_id, 1024, NULL, infoLog);
-        std::cerr << "Error compiling Vertex shader_t:\n" << infoLog << std::endl;
-    }
-    glGetShaderiv(fragment_id, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(fragment_id, 1024, NULL, infoLog);
-        std::cerr << "Error compiling Fragment shader_t:\n" << infoLog << std::endl;
+        glGetShaderInfoLog(shader_id, 1024, NULL, infoLog);
+        std::cerr << "Error compiling " << stage << " shader_t:\n" << infoLog << std::endl;
     }
+    return success;
 }
 
-void shader_program::check_linking_error() {
+bool shader_program::check_linking_error(GLuint program_id) {
     int success;
     char infoLog[1024];
     glGetProgramiv(program_id, GL_LINK_STATUS, &success);
     if (!success)
     {
+        GLsizei count = 0;
+        GLuint shaders[2];
+        glGetAttachedShaders(program_id, 2, &count, shaders);
+        for (GLsizei index = 0; index < count; index += 1) {
+            GLint type = 0;
+            glGetShaderiv(shaders[index], GL_SHADER_TYPE, &type);
+            check_compile_error(shaders[index], type == GL_VERTEX_SHADER ? "Vertex" : "Fragment");
+        }
         glGetProgramInfoLog(program_id, 1024, NULL, infoLog);
         std::cerr << "Error Linking shader_t Program:\n" << infoLog << std::endl;
     }
+    return success;
 }
@@ -1,6 +1,7 @@
 #include <GL/glew.h>
 #include <glm/glm.hpp>
 #include "shader_program.hpp"
+#include "gl_state.hpp"
 
 namespace simple_cube {
     inline const float vertices[] = {
@@ -52,11 +53,12 @@ namespace simple_cube {
         GLuint vbo;
         glGenVertexArrays(1, &vao);
         glGenBuffers(1, &vbo);
-        glBindVertexArray(vao);
+        gl_state::bind_vertex_array(vao);
         glBindBuffer(GL_ARRAY_BUFFER, vbo);
         glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), &vertices, GL_STATIC_DRAW);
         glEnableVertexAttribArray(0);
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), nullptr);
+        gl_state::bind_vertex_array(0);
         return std::make_tuple(vao, vbo);
     }
 
@@ -71,8 +73,7 @@ namespace simple_cube {
         shader.set_uniform("model", model);
         shader.set_uniform("view", view);
         shader.set_uniform("projection", projection);
-        glBindVertexArray(vao);
+        gl_state::bind_vertex_array(vao);
         glDrawArrays(GL_TRIANGLES, 0, 36);
-        glBindVertexArray(0);
     }
 }
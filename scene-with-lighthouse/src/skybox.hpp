@@ -10,6 +10,7 @@
 #include <tuple>
 #include <fmt/format.h>
 #include "shader_program.hpp"
+#include "gl_state.hpp"
 
 namespace skybox {
     static float vertices[] = {
@@ -59,7 +60,7 @@ namespace skybox {
     inline GLuint load_cubemap(std::vector<std::string> faces) {
         unsigned int texture_id;
         glGenTextures(1, &texture_id);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, texture_id);
+        gl_state::bind_texture(GL_TEXTURE_CUBE_MAP, texture_id);
 
         int width;
         int height;
@@ -100,31 +101,30 @@ namespace skybox {
         GLuint vbo;
         glGenVertexArrays(1, &vao);
         glGenBuffers(1, &vbo);
-        glBindVertexArray(vao);
+        gl_state::bind_vertex_array(vao);
         glBindBuffer(GL_ARRAY_BUFFER, vbo);
         glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), &vertices, GL_STATIC_DRAW);
         glEnableVertexAttribArray(0);
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), nullptr);
+        gl_state::bind_vertex_array(0);
         auto texture = load_skybox_textures(directory, format);
         shader_program shader(
             "shaders/skybox_vertex.glsl",
             "shaders/skybox_fragment.glsl"
         );
-        return std::make_tuple(vao, vbo, texture, shader);
+        return std::make_tuple(vao, vbo, texture, std::move(shader));
     }
 
     inline void draw(GLuint skybox_vao, GLuint skybox_texture, shader_program& skybox_shader, glm::mat4 view, glm::mat4 projection) {
-        glDepthFunc(GL_LEQUAL);
+        gl_state::depth_func(GL_LEQUAL);
         skybox_shader.use();
         skybox_shader.set_uniform("view", view);
         skybox_shader.set_uniform("projection", projection);
         skybox_shader.set_uniform("water", 0);
-        glBindVertexArray(skybox_vao);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, skybox_texture);
+        gl_state::bind_vertex_array(skybox_vao);
+        gl_state::bind_texture(0, GL_TEXTURE_CUBE_MAP, skybox_texture);
         glDrawArrays(GL_TRIANGLES, 0, 36);
-        glBindVertexArray(0);
-        glDepthFunc(GL_LESS);
+        gl_state::depth_func(GL_LESS);
     }
 }
 
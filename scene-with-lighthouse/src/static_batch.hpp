@@ -0,0 +1,154 @@
+#ifndef STATIC_BATCH_HPP
+#define STATIC_BATCH_HPP
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <fmt/core.h>
+
+#include "frustum.hpp"
+#include "mesh.hpp"
+#include "model.hpp"
+#include "render_queue.hpp"
+#include "shader_program.hpp"
+
+// Merges models that never move into meshes that are already in world space: one mesh per material and
+// square chunk of the ground plane, so that the static world is drawn with a few large draws and every chunk
+// can still be culled on its own. Meshes share a material when they have the same textures and, for layered
+// models, the same texture array layer. A mesh goes to the chunk of its center and is never split.
+class static_batch {
+public:
+    struct chunk {
+        aabb bounds;
+        // Meshes of the merged model in the chunk.
+        std::vector<uint32_t> meshes;
+    };
+
+    explicit static_batch(float chunk_size): chunk_size(chunk_size) {}
+
+    // All sources must share a layout, which the merged model keeps. Sources are only read by build().
+    void add(model& source, const glm::mat4& transform) {
+        if (!sources.empty() && sources.front().target->get_layout() != source.get_layout()) {
+            throw std::runtime_error("static batch sources must share a layout");
+        }
+        sources.push_back({&source, transform});
+    }
+
+    void build() {
+        if (sources.empty()) {
+            return;
+        }
+        const auto layout = sources.front().target->get_layout();
+        // Chunk cell, then material: textures and layer.
+        using merge_key = std::tuple<int, int, std::vector<GLuint>, int>;
+        std::map<merge_key, std::vector<std::pair<const source*, size_t>>> merged;
+        for (const auto& entry: sources) {
+            auto& meshes = entry.target->get_meshes();
+            for (size_t index = 0; index < meshes.size(); index += 1) {
+                auto bounds = aabb{meshes[index].min_values, meshes[index].max_values}.transformed(entry.transform);
+                auto center = (bounds.min + bounds.max) * 0.5f;
+                std::vector<GLuint> texture_set;
+                for (const auto& texture: meshes[index].textures) {
+                    texture_set.push_back(texture.id);
+                }
+                merge_key key = {
+                    (int)std::floor(center.x / chunk_size),
+                    (int)std::floor(center.z / chunk_size),
+                    std::move(texture_set),
+                    entry.target->get_mesh_layer(index)
+                };
+                merged[key].emplace_back(&entry, index);
+                source_mesh_count += 1;
+            }
+        }
+
+        std::vector<mesh> meshes;
+        std::vector<int> layers;
+        std::map<std::pair<int, int>, size_t> chunk_indices;
+        for (const auto& [key, parts]: merged) {
+            std::vector<vertex> vertices;
+            std::vector<GLuint> indices;
+            for (const auto& [entry, index]: parts) {
+                const auto& part = entry->target->get_meshes()[index];
+                auto normal_matrix = glm::transpose(glm::inverse(entry->transform));
+                auto base = (GLuint)vertices.size();
+                for (auto transformed: part.vertices) {
+                    transformed.position = glm::vec3(entry->transform * glm::vec4(transformed.position, 1.0f));
+                    transformed.normal = glm::normalize(glm::vec3(normal_matrix * glm::vec4(transformed.normal, 0.0f)));
+                    vertices.push_back(transformed);
+                }
+                for (auto vertex_index: part.indices) {
+                    indices.push_back(base + vertex_index);
+                }
+            }
+            const auto& first = parts.front().first->target->get_meshes()[parts.front().second];
+            meshes.emplace_back(std::move(vertices), std::move(indices), first.textures, layout == model_layout::separate);
+            layers.push_back(std::get<3>(key));
+            auto cell = std::make_pair(std::get<0>(key), std::get<1>(key));
+            auto found = chunk_indices.try_emplace(cell, chunks.size());
+            if (found.second) {
+                chunks.emplace_back();
+            }
+            auto& target_chunk = chunks[found.first->second];
+            target_chunk.bounds.extend({meshes.back().min_values, meshes.back().max_values});
+            target_chunk.meshes.push_back((uint32_t)meshes.size() - 1);
+        }
+        sources.clear();
+        mesh_count = meshes.size();
+        merged_model.emplace(std::move(meshes), layout, layout == model_layout::layered ? std::move(layers) : std::vector<int>());
+        // Unlike its sources the merged model is always drawn, its geometry goes to the GPU right away.
+        merged_model->upload();
+        fmt::print(
+            "Static batch: {} meshes merged into {} in {} chunks\n",
+            source_mesh_count,
+            mesh_count,
+            chunks.size()
+        );
+    }
+
+    // Submits the merged meshes of a chunk, which are in world space already.
+    void submit_chunk(render_queue& queue, size_t pass, shader_program& shader, size_t index) {
+        for (auto mesh_index: chunks[index].meshes) {
+            queue.submit(pass, shader, *merged_model, mesh_index, glm::mat4(1.0f));
+        }
+    }
+
+    [[nodiscard]]
+    const std::vector<chunk>& get_chunks() const {
+        return chunks;
+    }
+
+    [[nodiscard]]
+    size_t get_source_mesh_count() const {
+        return source_mesh_count;
+    }
+
+    [[nodiscard]]
+    size_t get_mesh_count() const {
+        return mesh_count;
+    }
+
+private:
+    struct source {
+        model* target;
+        glm::mat4 transform;
+    };
+
+    float chunk_size;
+    std::vector<source> sources;
+    std::vector<chunk> chunks;
+    std::optional<model> merged_model;
+    size_t source_mesh_count = 0;
+    size_t mesh_count = 0;
+};
+
+#endif
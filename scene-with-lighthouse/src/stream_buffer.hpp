@@ -0,0 +1,170 @@
+#ifndef STREAM_BUFFER_HPP
+#define STREAM_BUFFER_HPP
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <GL/glew.h>
+
+// Ring of frames_in_flight regions for data the CPU writes once per frame and the GPU reads in the same frame:
+// uniform ranges, instance matrices, streamed vertices. Every frame allocates from its own region by bumping
+// an offset, and a fence placed after the frame's draws tells when the region can be written again, so the
+// CPU only waits for the GPU when it wraps around to a region the GPU has not finished reading.
+// With ARB_buffer_storage the whole buffer is mapped once, persistently and coherently; otherwise the unused
+// tail of the current region is mapped unsynchronized on the first allocation after a flush. A persistent mapping
+// the driver refuses falls back on the unsynchronized one, and a region that can not be mapped fails its allocations.
+class stream_buffer {
+public:
+    static constexpr size_t frames_in_flight = 3;
+
+    struct allocation {
+        void* data;
+        // Byte offset in the buffer, to bind or draw the allocation from.
+        GLintptr offset;
+    };
+
+    struct frame_stats {
+        size_t allocated = 0;
+        size_t failed = 0;
+        // Whether begin_frame() had to wait for the GPU to release the region.
+        bool waited = false;
+    };
+
+    explicit stream_buffer(size_t frame_size):
+        frame_size(frame_size), persistent(GLEW_ARB_buffer_storage)
+    {
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        const auto size = (GLsizeiptr)(frame_size * frames_in_flight);
+        if (persistent) {
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, flags);
+            mapped = (uint8_t*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags);
+            if (mapped == nullptr) {
+                // Immutable storage can not be respecified, the fallback needs a buffer of its own.
+                glDeleteBuffers(1, &buffer);
+                glGenBuffers(1, &buffer);
+                glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+                persistent = false;
+            }
+        }
+        if (!persistent) {
+            glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        }
+    }
+
+    stream_buffer(const stream_buffer& other) = delete;
+
+    stream_buffer& operator=(const stream_buffer& other) = delete;
+
+    ~stream_buffer() {
+        for (auto& fence: fences) {
+            if (fence != nullptr) {
+                glDeleteSync(fence);
+            }
+        }
+        if (mapped != nullptr) {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+            glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        }
+        glDeleteBuffers(1, &buffer);
+    }
+
+    // Moves on to the next region, waiting only if the GPU still reads it from frames_in_flight frames ago.
+    void begin_frame() {
+        region = (region + 1) % frames_in_flight;
+        head = region * frame_size;
+        stats = {};
+        auto& fence = fences[region];
+        if (fence == nullptr) {
+            return;
+        }
+        if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+            stats.waited = true;
+            while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED) {
+            }
+        }
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+
+    // `size` bytes at an offset that is a multiple of `alignment`, or nothing once the frame's region is used up or
+    // can not be mapped.
+    // The data has to be written before flush() and drawn from before end_frame().
+    std::optional<allocation> allocate(size_t size, size_t alignment = 16) {
+        const auto end = (region + 1) * frame_size;
+        const auto offset = (head + alignment - 1) / alignment * alignment;
+        if (offset + size > end) {
+            stats.failed += 1;
+            return std::nullopt;
+        }
+        if (!persistent && mapped == nullptr) {
+            // Nothing in the region after head is read by the GPU, it can be mapped without synchronizing.
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_FLUSH_EXPLICIT_BIT;
+            mapped = (uint8_t*)glMapBufferRange(GL_COPY_WRITE_BUFFER, head, end - head, flags);
+            if (mapped == nullptr) {
+                stats.failed += 1;
+                return std::nullopt;
+            }
+            mapped_begin = head;
+        }
+        head = offset + size;
+        stats.allocated += size;
+        return allocation{mapped + (offset - mapped_begin), (GLintptr)offset};
+    }
+
+    // Makes what was written visible to the GPU; call before drawing from allocations made since the last flush.
+    void flush() {
+        if (persistent || mapped == nullptr) {
+            return;
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glFlushMappedBufferRange(GL_COPY_WRITE_BUFFER, 0, head - mapped_begin);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        mapped = nullptr;
+    }
+
+    // Fences the region after the last draw reading from it was issued.
+    void end_frame() {
+        flush();
+        fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    [[nodiscard]]
+    GLuint get_id() const {
+        return buffer;
+    }
+
+    [[nodiscard]]
+    bool is_persistent() const {
+        return persistent;
+    }
+
+    [[nodiscard]]
+    size_t get_frame_size() const {
+        return frame_size;
+    }
+
+    [[nodiscard]]
+    const frame_stats& get_stats() const {
+        return stats;
+    }
+
+private:
+    GLuint buffer = 0;
+    size_t frame_size;
+    bool persistent;
+    uint8_t* mapped = nullptr;
+    // Buffer offset `mapped` points at, 0 for the persistent mapping.
+    size_t mapped_begin = 0;
+    // Region of the current frame and the next free byte in it.
+    size_t region = frames_in_flight - 1;
+    size_t head = 0;
+    std::array<GLsync, frames_in_flight> fences = {};
+    frame_stats stats;
+};
+
+#endif
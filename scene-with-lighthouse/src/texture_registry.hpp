@@ -0,0 +1,315 @@
+#ifndef TEXTURE_REGISTRY_HPP
+#define TEXTURE_REGISTRY_HPP
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+#include <GL/glew.h>
+#include <fmt/core.h>
+
+#include "file_io.hpp"
+#include "gl_state.hpp"
+
+// 2D textures of image files shared by everything in the process that asks for them, so that an image two models,
+// or a model and the terrain, use is decoded and uploaded once. Images are found by their canonical path and, for a
+// path seen for the first time, by their contents: files of the same size are hashed and compared, which catches
+// copies under other names without hashing every file. Files are hashed without holding the registry's lock, so
+// that a thread asking for the usage does not wait for them. Images filtered as sRGB and as data are different textures.
+// A texture stays registered while references to it are held and after that until evict_unused() deletes it.
+namespace texture_registry {
+    struct entry {
+        GLuint id = 0;
+        // The rest belongs to the registry and is only read and written under its lock.
+        bool gamma = true;
+        // Canonical paths the texture was asked for with, the first one is the file it was loaded from.
+        std::vector<std::string> paths;
+        uint64_t file_size = 0;
+        // Hash of the file, computed once another file of the same size shows up; `hashed` tells that it was tried.
+        bool hashed = false;
+        std::optional<uint64_t> hash;
+        // GPU memory of all levels, as the driver reports it.
+        size_t bytes = 0;
+    };
+
+    // Keeps a texture of the registry from being evicted; copies are cheap and may be dropped on any thread.
+    using reference = std::shared_ptr<const entry>;
+
+    // The GL texture of a reference, 0 for a null one.
+    [[nodiscard]]
+    inline GLuint id_of(const reference& target) {
+        return target == nullptr ? 0 : target->id;
+    }
+
+    struct usage {
+        size_t textures = 0;
+        size_t bytes = 0;
+        // Textures without references, which evict_unused() deletes.
+        size_t unused = 0;
+        size_t unused_bytes = 0;
+        // Images that were asked for again and shared instead of loaded, by path and by contents under another path.
+        size_t path_hits = 0;
+        size_t content_hits = 0;
+        size_t loads = 0;
+    };
+
+    namespace details {
+        struct state {
+            std::mutex mutex;
+            std::vector<std::shared_ptr<entry>> entries;
+            std::map<std::pair<std::string, bool>, std::weak_ptr<entry>> by_path;
+            usage counts;
+        };
+
+        inline state& get_state() {
+            static state registry;
+            return registry;
+        }
+
+        inline std::string canonical(const std::string& path) {
+            std::error_code error;
+            auto result = std::filesystem::weakly_canonical(path, error);
+            return error ? path : result.string();
+        }
+
+        // GPU memory of the levels of a 2D texture, as the driver reports their sizes.
+        inline size_t texture_bytes(GLuint id) {
+            gl_state::bind_texture(GL_TEXTURE_2D, id);
+            size_t bytes = 0;
+            for (GLint level = 0; level < 32; level += 1) {
+                GLint width = 0;
+                GLint height = 0;
+                glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_WIDTH, &width);
+                glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_HEIGHT, &height);
+                if (width == 0 || height == 0) {
+                    break;
+                }
+                GLint compressed = GL_FALSE;
+                glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED, &compressed);
+                if (compressed) {
+                    GLint size = 0;
+                    glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+                    bytes += (size_t)size;
+                    continue;
+                }
+                GLint bits = 0;
+                for (GLenum component: {GL_TEXTURE_RED_SIZE, GL_TEXTURE_GREEN_SIZE, GL_TEXTURE_BLUE_SIZE, GL_TEXTURE_ALPHA_SIZE}) {
+                    GLint component_bits = 0;
+                    glGetTexLevelParameteriv(GL_TEXTURE_2D, level, component, &component_bits);
+                    bits += component_bits;
+                }
+                bytes += (size_t)width * height * (size_t)((bits + 7) / 8);
+            }
+            return bytes;
+        }
+
+        // The texture registered for the canonical path, or for a file with the same contents, which the path is then
+        // remembered for. Null when there is none. Called with the lock held; lets go of it while it reads files and
+        // checks again what it found before once it has it back.
+        inline std::shared_ptr<entry> find(state& registry, std::unique_lock<std::mutex>& lock, const std::string& path, bool gamma, bool& by_contents) {
+            by_contents = false;
+            std::optional<uint64_t> file_size;
+            std::optional<uint64_t> hash;
+            bool hashed = false;
+            while (true) {
+                auto found = registry.by_path.find({path, gamma});
+                if (found != registry.by_path.end()) {
+                    return found->second.lock();
+                }
+                if (!file_size.has_value()) {
+                    lock.unlock();
+                    std::error_code error;
+                    const auto size = (uint64_t)std::filesystem::file_size(path, error);
+                    lock.lock();
+                    if (error) {
+                        return nullptr;
+                    }
+                    file_size = size;
+                    continue;
+                }
+                if (hashed && !hash.has_value()) {
+                    return nullptr;
+                }
+                // Registered files of the same size; held while they are hashed, which keeps them from being evicted.
+                std::vector<std::pair<std::shared_ptr<entry>, std::string>> unhashed;
+                bool compared = false;
+                for (const auto& target: registry.entries) {
+                    if (target->gamma != gamma || target->file_size != *file_size) {
+                        continue;
+                    }
+                    if (!target->hashed) {
+                        unhashed.emplace_back(target, target->paths.front());
+                        continue;
+                    }
+                    compared = true;
+                    if (hash.has_value() && target->hash == hash) {
+                        target->paths.push_back(path);
+                        registry.by_path[{path, gamma}] = target;
+                        by_contents = true;
+                        return target;
+                    }
+                }
+                const bool hash_path = !hashed && (compared || !unhashed.empty());
+                if (!hash_path && unhashed.empty()) {
+                    return nullptr;
+                }
+                lock.unlock();
+                if (hash_path) {
+                    hash = file_io::hash_file(path);
+                    hashed = true;
+                }
+                std::vector<std::optional<uint64_t>> hashes;
+                for (const auto& [target, source]: unhashed) {
+                    hashes.push_back(file_io::hash_file(source));
+                }
+                lock.lock();
+                for (size_t index = 0; index < unhashed.size(); index += 1) {
+                    auto& target = *unhashed[index].first;
+                    if (!target.hashed) {
+                        target.hashed = true;
+                        target.hash = hashes[index];
+                    }
+                }
+            }
+        }
+    }
+
+    // References to the textures of the images at `paths`, null for the ones that can not be loaded. `gamma` tells
+    // for every path whether the image holds sRGB colors, all of them do when it is empty. Images already registered
+    // are shared; the others are loaded with `load(paths, gamma)`, which returns a texture id for every path it gets,
+    // 0 for failures, and registered. An image another thread registered while this one loaded it is shared as well
+    // and the second upload deleted. `load` runs without the lock, so loads on different threads overlap.
+    template <typename F>
+    std::vector<reference> acquire(const std::vector<std::string>& paths, const std::vector<bool>& gamma, F&& load) {
+        auto& registry = details::get_state();
+        std::vector<reference> result(paths.size());
+        std::vector<std::string> keys;
+        for (const auto& path: paths) {
+            keys.push_back(details::canonical(path));
+        }
+        std::vector<size_t> missing;
+        {
+            std::unique_lock<std::mutex> lock(registry.mutex);
+            for (size_t index = 0; index < paths.size(); index += 1) {
+                bool by_contents;
+                result[index] = details::find(registry, lock, keys[index], gamma.empty() || gamma[index], by_contents);
+                if (result[index] == nullptr) {
+                    missing.push_back(index);
+                } else if (by_contents) {
+                    registry.counts.content_hits += 1;
+                } else {
+                    registry.counts.path_hits += 1;
+                }
+            }
+        }
+        if (missing.empty()) {
+            return result;
+        }
+        std::vector<std::string> missing_paths;
+        std::vector<bool> missing_gamma;
+        for (auto index: missing) {
+            missing_paths.push_back(paths[index]);
+            missing_gamma.push_back(gamma.empty() || gamma[index]);
+        }
+        std::vector<GLuint> ids = load(missing_paths, missing_gamma);
+        std::vector<uint64_t> file_sizes(missing.size());
+        std::vector<size_t> bytes(missing.size());
+        for (size_t at = 0; at < missing.size(); at += 1) {
+            if (ids[at] != 0) {
+                std::error_code error;
+                file_sizes[at] = (uint64_t)std::filesystem::file_size(keys[missing[at]], error);
+                bytes[at] = details::texture_bytes(ids[at]);
+            }
+        }
+        std::unique_lock<std::mutex> lock(registry.mutex);
+        for (size_t at = 0; at < missing.size(); at += 1) {
+            const auto index = missing[at];
+            if (ids[at] == 0) {
+                continue;
+            }
+            bool by_contents;
+            auto existing = details::find(registry, lock, keys[index], missing_gamma[at], by_contents);
+            if (existing != nullptr) {
+                glDeleteTextures(1, &ids[at]);
+                gl_state::forget_texture(ids[at]);
+                result[index] = existing;
+                continue;
+            }
+            auto created = std::make_shared<entry>();
+            created->id = ids[at];
+            created->gamma = missing_gamma[at];
+            created->paths.push_back(keys[index]);
+            created->file_size = file_sizes[at];
+            created->bytes = bytes[at];
+            registry.entries.push_back(created);
+            registry.by_path[{keys[index], created->gamma}] = created;
+            registry.counts.loads += 1;
+            result[index] = created;
+        }
+        return result;
+    }
+
+    // Deletes the textures nothing references any more and returns how many. Call on the thread that renders while
+    // nothing is loading: other contexts keep their bindings of deleted textures and could mistake a new texture
+    // with the same name for the one they have bound.
+    inline size_t evict_unused() {
+        auto& registry = details::get_state();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        size_t evicted = 0;
+        auto& entries = registry.entries;
+        for (auto target = entries.begin(); target != entries.end();) {
+            if (target->use_count() > 1) {
+                ++target;
+                continue;
+            }
+            glDeleteTextures(1, &(*target)->id);
+            gl_state::forget_texture((*target)->id);
+            for (const auto& path: (*target)->paths) {
+                registry.by_path.erase({path, (*target)->gamma});
+            }
+            target = entries.erase(target);
+            evicted += 1;
+        }
+        return evicted;
+    }
+
+    [[nodiscard]]
+    inline usage get_usage() {
+        auto& registry = details::get_state();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        auto result = registry.counts;
+        for (const auto& target: registry.entries) {
+            result.textures += 1;
+            result.bytes += target->bytes;
+            if (target.use_count() == 1) {
+                result.unused += 1;
+                result.unused_bytes += target->bytes;
+            }
+        }
+        return result;
+    }
+
+    inline void print_usage() {
+        const auto current = get_usage();
+        fmt::print(
+            "Texture registry: {} textures in {:.1f} MB, {} unused; {} loaded, {} shared by path, {} by contents\n",
+            current.textures,
+            (float)current.bytes / (1 << 20),
+            current.unused,
+            current.loads,
+            current.path_hits,
+            current.content_hits
+        );
+    }
+}
+
+#endif
@@ -0,0 +1,263 @@
+#ifndef VEGETATION_HPP
+#define VEGETATION_HPP
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <fmt/core.h>
+
+#include "frustum.hpp"
+#include "heightmap.hpp"
+#include "job_system.hpp"
+#include "model.hpp"
+#include "render_queue.hpp"
+#include "shader_program.hpp"
+#include "stb_image_wrapper.hpp"
+
+// Values in [0, 1] over the terrain telling how likely a plant is to grow there.
+class density_map {
+public:
+    // A grayscale image stretched over the whole terrain.
+    static density_map load(const std::string& path) {
+        int width = 0;
+        int height = 0;
+        int components = 0;
+        auto data = stbi_load(path.c_str(), &width, &height, &components, 1);
+        if (!data) {
+            fmt::print("Failed to load density map at path: {}\n", path);
+            throw std::runtime_error(fmt::format("Failed to load density map at path: {}", path));
+        }
+        density_map map(width, height);
+        for (size_t index = 0; index < map.values.size(); index += 1) {
+            map.values[index] = data[index] / 255.0f;
+        }
+        stbi_image_free(data);
+        return map;
+    }
+
+    // Patches of forest and clearings from a few octaves of value noise, for terrains without a painted map.
+    static density_map generate(int size, uint32_t seed, int octaves = 4) {
+        density_map map(size, size);
+        std::mt19937 random(seed);
+        std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
+        const int lattice = 8 << octaves;
+        std::vector<float> noise(lattice * lattice);
+        for (auto& value: noise) {
+            value = distribution(random);
+        }
+        const auto sample = [&](float x, float y) -> float {
+            auto x0 = (int)std::floor(x);
+            auto y0 = (int)std::floor(y);
+            auto t = glm::smoothstep(glm::vec2(0.0f), glm::vec2(1.0f), glm::vec2(x - x0, y - y0));
+            const auto at = [&](int column, int row) {
+                return noise[(row % lattice) * lattice + column % lattice];
+            };
+            return glm::mix(glm::mix(at(x0, y0), at(x0 + 1, y0), t.x), glm::mix(at(x0, y0 + 1), at(x0 + 1, y0 + 1), t.x), t.y);
+        };
+        for (int row = 0; row < size; row += 1) {
+            for (int column = 0; column < size; column += 1) {
+                float value = 0.0f;
+                float amplitude = 0.5f;
+                float frequency = 4.0f;
+                for (int octave = 0; octave < octaves; octave += 1) {
+                    value += amplitude * sample(frequency * column / size, frequency * row / size);
+                    amplitude *= 0.5f;
+                    frequency *= 2.0f;
+                }
+                // Sharpen the transition so that clearings are really empty.
+                map.values[row * size + column] = glm::smoothstep(0.35f, 0.65f, value);
+            }
+        }
+        return map;
+    }
+
+    // Density at u/v in [0, 1], nearest texel.
+    [[nodiscard]]
+    float at(float u, float v) const {
+        auto column = std::clamp((int)(u * width), 0, width - 1);
+        auto row = std::clamp((int)(v * height), 0, height - 1);
+        return values[row * width + column];
+    }
+
+private:
+    density_map(int width, int height): width(width), height(height), values(width * height) {}
+
+    int width;
+    int height;
+    std::vector<float> values;
+};
+
+// Where plants may grow and how they look.
+struct scatter_rules {
+    size_t instance_count = 100000;
+    // World space heights, the water surface is at 0.
+    float min_height = 0.005f;
+    float max_height = 0.1f;
+    // Smallest normal.y accepted, 1 only allows flat ground.
+    float min_normal_y = 0.7f;
+    float min_scale = 0.002f;
+    float max_scale = 0.005f;
+    uint32_t seed = 1;
+    // The terrain is split into cells_per_side x cells_per_side cells, each drawn with one instanced call per mesh.
+    size_t cells_per_side = 16;
+    // Cells further than this from the eye are not drawn.
+    float draw_distance = 0.5f;
+};
+
+// A model scattered over the terrain at load and drawn by cells. Can be made on the streaming thread.
+class vegetation {
+public:
+    vegetation(model& plant, const terrain_sampler& terrain, const density_map& density, scatter_rules rules, job_system& jobs): rules(rules) {
+        auto start = std::chrono::steady_clock::now();
+        auto placements = scatter(plant, terrain, density, jobs);
+        auto scattered = std::chrono::steady_clock::now();
+        for (auto& cell: placements) {
+            if (cell.transforms.empty()) {
+                continue;
+            }
+            instance_count += cell.transforms.size();
+            cells.push_back({cell.bounds, model_instances(plant, cell.transforms)});
+        }
+        auto uploaded = std::chrono::steady_clock::now();
+        fmt::print(
+            "Scattered {} instances into {} cells: {} ms on {} threads, {} ms upload\n",
+            instance_count,
+            cells.size(),
+            std::chrono::duration_cast<std::chrono::milliseconds>(scattered - start).count(),
+            jobs.size(),
+            std::chrono::duration_cast<std::chrono::milliseconds>(uploaded - scattered).count()
+        );
+    }
+
+    // Submits the cell when it is within draw distance of the eye, returns whether it was submitted.
+    // The queue still drops it when it is outside the view of the pass.
+    bool submit_cell(render_queue& queue, size_t pass, shader_program& shader, size_t index, glm::vec3 eye) {
+        auto& cell = cells[index];
+        auto closest = glm::clamp(eye, cell.bounds.min, cell.bounds.max);
+        if (glm::distance(closest, eye) > rules.draw_distance) {
+            return false;
+        }
+        queue.submit_instanced(pass, shader, cell.instances, cell.bounds);
+        return true;
+    }
+
+    [[nodiscard]]
+    const aabb& get_cell_bounds(size_t index) const {
+        return cells[index].bounds;
+    }
+
+    [[nodiscard]]
+    size_t get_instance_count() const {
+        return instance_count;
+    }
+
+    [[nodiscard]]
+    size_t get_cell_count() const {
+        return cells.size();
+    }
+
+private:
+    struct cell {
+        aabb bounds;
+        model_instances instances;
+    };
+
+    struct placement_cell {
+        aabb bounds;
+        std::vector<glm::mat4> transforms;
+    };
+
+    // Chance of a plant growing at u/v: the density where the ground is suitable, 0 elsewhere.
+    float suitability(const terrain_sampler& terrain, const density_map& density, glm::vec2 position, glm::vec2 uv) const {
+        auto height = terrain.height_at(position.x, position.y);
+        if (height < rules.min_height || height > rules.max_height) {
+            return 0.0f;
+        }
+        if (terrain.normal_at(position.x, position.y).y < rules.min_normal_y) {
+            return 0.0f;
+        }
+        return density.at(uv.x, uv.y);
+    }
+
+    // Every strip of cells along z is scattered by one job with its own seed, so the result
+    // does not depend on the number of threads. Jobs write to disjoint cells and need no locking.
+    std::vector<placement_cell> scatter(const model& plant, const terrain_sampler& terrain, const density_map& density, job_system& jobs) const {
+        const auto strips = rules.cells_per_side;
+        const auto terrain_min = glm::vec2(terrain.get_min_corner().x, terrain.get_min_corner().z);
+        const auto terrain_size = glm::vec2(terrain.get_max_corner().x, terrain.get_max_corner().z) - terrain_min;
+        // The plant stands on the middle of the bottom of its bounding box.
+        const auto root = glm::vec3((plant.min_values.x + plant.max_values.x) / 2.0f, plant.min_values.y, (plant.min_values.z + plant.max_values.z) / 2.0f);
+        const auto plant_min = plant.min_values - root;
+        const auto plant_max = plant.max_values - root;
+        const auto radius = std::max({std::abs(plant_min.x), std::abs(plant_min.z), std::abs(plant_max.x), std::abs(plant_max.z)});
+
+        // Strips get a share of the instances matching how much of them can grow plants, estimated on a coarse grid.
+        // The share also tells how many candidates a strip has to try, mostly water strips stay empty.
+        const size_t samples_x = 64;
+        const size_t samples_z = 4;
+        std::vector<float> acceptance(strips);
+        float total_acceptance = 0.0f;
+        for (size_t strip = 0; strip < strips; strip += 1) {
+            for (size_t row = 0; row < samples_z; row += 1) {
+                for (size_t column = 0; column < samples_x; column += 1) {
+                    auto uv = glm::vec2((column + 0.5f) / samples_x, (strip + (row + 0.5f) / samples_z) / strips);
+                    acceptance[strip] += suitability(terrain, density, terrain_min + uv * terrain_size, uv);
+                }
+            }
+            acceptance[strip] /= samples_x * samples_z;
+            total_acceptance += acceptance[strip];
+        }
+
+        std::vector<placement_cell> placements(strips * strips);
+        jobs.parallel_for(strips, 1, [&](size_t strip, size_t) {
+            if (acceptance[strip] <= 0.0f) {
+                return;
+            }
+            std::mt19937 random(rules.seed * 7919u + (uint32_t)strip);
+            std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+            const auto wanted = (size_t)std::round(rules.instance_count * acceptance[strip] / total_acceptance);
+            // Four times the expected number of candidates, the estimate misses small features.
+            const auto attempts = (size_t)(4.0f * wanted / acceptance[strip]);
+            size_t placed = 0;
+            for (size_t attempt = 0; attempt < attempts && placed < wanted; attempt += 1) {
+                auto uv = glm::vec2(unit(random), (strip + unit(random)) / strips);
+                auto position = terrain_min + uv * terrain_size;
+                if (unit(random) >= suitability(terrain, density, position, uv)) {
+                    continue;
+                }
+                auto height = terrain.height_at(position.x, position.y);
+                auto scale = glm::mix(rules.min_scale, rules.max_scale, unit(random));
+                auto rotation = unit(random) * glm::two_pi<float>();
+                auto ground = glm::vec3(position.x, height, position.y);
+                auto transform = glm::translate(glm::mat4(1.0f), ground);
+                transform = glm::rotate(transform, rotation, glm::vec3(0.0f, 1.0f, 0.0f));
+                transform = glm::scale(transform, glm::vec3(scale));
+                transform = glm::translate(transform, -root);
+
+                auto column = std::min((size_t)(uv.x * strips), strips - 1);
+                auto& cell = placements[strip * strips + column];
+                cell.transforms.push_back(transform);
+                // Rotation around y keeps the plant within its radius around the root.
+                cell.bounds.extend({ground + glm::vec3(-radius, plant_min.y, -radius) * scale, ground + glm::vec3(radius, plant_max.y, radius) * scale});
+                placed += 1;
+            }
+        });
+        return placements;
+    }
+
+    scatter_rules rules;
+    std::vector<cell> cells;
+    size_t instance_count = 0;
+};
+
+#endif
@@ -2,21 +2,47 @@
 layout (location = 0) in vec3 ipos;
 layout (location = 1) in vec3 inormal;
 layout (location = 2) in vec2 itexcoord;
+#ifdef INSTANCED
+layout (location = 4) in mat4 instance_model;
+#endif
+#ifdef TEXTURE_ARRAY
+layout (location = 3) in vec3 icolor;
+layout (location = 8) in float ilayer;
+#endif
 
 out vec2 texcoord;
 out vec3 normal;
 out vec3 vertex_position;
+#ifdef TEXTURE_ARRAY
+out vec3 material_color;
+flat out float layer;
+#endif
+#ifndef NO_SHADOW
 out vec4 FragPosLightSpace;
+#endif
 
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+#ifndef NO_SHADOW
 uniform mat4 lightSpaceMatrix;
+#endif
 
 void main() {
+#ifdef INSTANCED
+    mat4 object_model = model * instance_model;
+#else
+    mat4 object_model = model;
+#endif
     texcoord = itexcoord;
-    normal = mat3(transpose(inverse(model))) * inormal;
-    vertex_position = vec3(model * vec4(ipos, 1.0));
+#ifdef TEXTURE_ARRAY
+    material_color = icolor;
+    layer = ilayer;
+#endif
+    normal = mat3(transpose(inverse(object_model))) * inormal;
+    vertex_position = vec3(object_model * vec4(ipos, 1.0));
+#ifndef NO_SHADOW
     FragPosLightSpace = lightSpaceMatrix * vec4(vertex_position, 1.0);
-    gl_Position = projection * view * model * vec4(ipos, 1.0);
+#endif
+    gl_Position = projection * view * vec4(vertex_position, 1.0);
 }
@@ -0,0 +1,30 @@
+// Global light shared by the terrain, water and object shaders.
+uniform vec3 camera_position;
+
+uniform vec3 global_light_position;
+uniform vec3 global_light_color;
+uniform float global_light_ambient_strength;
+uniform float global_light_directional_strength;
+
+struct light_terms {
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+light_terms calc_global_light_terms(vec3 position, vec3 normal, vec3 object_color) {
+    light_terms terms;
+    vec3 _normal = normalize(normal);
+    // ambient
+    terms.ambient = global_light_ambient_strength * object_color;
+    // diffuse
+    vec3 light_direction = normalize(global_light_position - position);
+    float diff = max(dot(light_direction, _normal), 0.0);
+    terms.diffuse = diff * global_light_color;
+    // specular
+    vec3 view_direction = normalize(camera_position - position);
+    vec3 halfway_direction = normalize(light_direction + view_direction);
+    float spec = pow(max(dot(_normal, halfway_direction), 0.0), 86.0);
+    terms.specular = spec * global_light_color;
+    return terms;
+}
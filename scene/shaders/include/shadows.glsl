@@ -0,0 +1,34 @@
+// Shadow map lookup, compiled out for passes built with NO_SHADOW.
+#ifndef NO_SHADOW
+in vec4 FragPosLightSpace;
+
+uniform sampler2D shadow_map;
+
+float ShadowCalculation(vec4 fragPosLightSpace) {
+    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
+    projCoords = projCoords * 0.5 + 0.5;
+    float currentDepth = projCoords.z;
+    float bias = 0.00001;
+    float shadow = 0.0;
+    vec2 texelSize = 1.0 / (textureSize(shadow_map, 0));
+    for(int x = -1; x <= 1; x += 1) {
+        for(int y = -1; y <= 1; y += 1) {
+            float pcfDepth = texture(shadow_map, projCoords.xy + vec2(x, y) * texelSize).r;
+            shadow += (currentDepth - bias) > pcfDepth  ? 1.0 : 0.0;
+        }
+    }
+    shadow /= 10.0;
+    if(projCoords.z > 1.0) {
+        shadow = 0.0;
+    }
+    return shadow;
+}
+
+float calc_shadow() {
+    return ShadowCalculation(FragPosLightSpace);
+}
+#else
+float calc_shadow() {
+    return 0.0;
+}
+#endif
@@ -6,14 +6,18 @@ layout (location = 2) in vec2 itexcoord;
 out vec2 texcoord;
 out vec3 normal;
 out vec3 vertex_position;
+#ifndef NO_SHADOW
 out vec4 FragPosLightSpace;
+#endif
 out vec3 camera_world_position;
 
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 uniform vec4 clipping_plane;
+#ifndef NO_SHADOW
 uniform mat4 lightSpaceMatrix;
+#endif
 uniform vec3 camera_position;
 
 void main() {
@@ -23,6 +27,8 @@ void main() {
     vertex_position = vec3(model * vec4(ipos, 1.0));
     camera_world_position = camera_position - vertex_position.xyz;
     gl_ClipDistance[0] = dot(vec4(vertex_position, 1.0), clipping_plane);
+#ifndef NO_SHADOW
     FragPosLightSpace = lightSpaceMatrix * vec4(vertex_position, 1.0);
+#endif
     gl_Position = projection * view * model * vec4(ipos, 1.0);
 }
@@ -20,31 +20,11 @@ const float water_reflection_value = 1.3;
 const float near = 0.001f;
 const float far = 1000.0f;
 
-uniform vec3 camera_position;
-
-uniform vec3 global_light_position;
-uniform vec3 global_light_color;
-uniform float global_light_ambient_strength;
-uniform float global_light_directional_strength;
+#include "include/lighting.glsl"
 
 vec4 calc_global_light(vec3 normal, vec3 object_color) {
-    vec3 _normal = normalize(normal);
-    // ambient
-    vec3 ambient = global_light_ambient_strength * object_color;
-    // diffuse
-    vec3 light_direction = normalize(global_light_position - vertex_position);
-    float diff = max(dot(light_direction, _normal), 0.0);
-    vec3 diffuse = diff * global_light_color;
-    // specular
-    vec3 view_direction = normalize(camera_position - vertex_position);
-    float spec = 0.0;
-    vec3 halfway_direction = normalize(light_direction + view_direction);
-    spec = pow(max(dot(_normal, halfway_direction), 0.0), 86.0);
-    vec3 specular = spec * global_light_color;
-    // calculate shadow
-//    float shadow = ShadowCalculation(FragPosLightSpace);
-    //    vec3 lighting = (ambient + (1.0 - shadow) * (diffuse + specular)) * object_color;
-    vec3 result = (ambient + (diffuse + specular)) * object_color;
+    light_terms light = calc_global_light_terms(vertex_position, normal, object_color);
+    vec3 result = (light.ambient + (light.diffuse + light.specular)) * object_color;
     return vec4(result, 1.0);
 }
 
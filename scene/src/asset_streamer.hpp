@@ -0,0 +1,206 @@
+#ifndef ASSET_STREAMER_HPP
+#define ASSET_STREAMER_HPP
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <fmt/core.h>
+
+#include "job_system.hpp"
+
+// Loads assets in the background so that the window renders from the first frame on.
+// Loaders run one after another, in the order they were requested, on a thread with a hidden GL context shared
+// with the window's: they read, decode and upload, spreading the CPU work over `jobs`, and later loaders
+// may use what earlier ones made. A fence after every loader tells when the GPU has its uploads. Every frame,
+// update() hands the finished assets to their `ready` callbacks on the main thread, which put them into the scene,
+// until the frame's budget is used up. Vertex arrays are not shared between contexts, drawing code makes its own.
+// The thread has its own deque in the job system, so the main thread waiting for its frame's jobs does not pick up
+// a loader's long ones, nor the other way round.
+class asset_streamer {
+public:
+    struct stats {
+        size_t requested = 0;
+        size_t ready = 0;
+        size_t failed = 0;
+        // Time the ready callbacks took in the last update().
+        float integration_ms = 0.0f;
+        // From construction until the last requested asset was ready, zero while some are still loading.
+        float total_ms = 0.0f;
+    };
+
+    asset_streamer(GLFWwindow* window, job_system& jobs, float frame_budget_ms): jobs(jobs), frame_budget_ms(frame_budget_ms) {
+        // The window hints of the shared window are still in effect, the context only has to stay hidden.
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        context = glfwCreateWindow(1, 1, "Streaming", nullptr, window);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+        if (context == nullptr) {
+            throw std::runtime_error("Failed to create the streaming context");
+        }
+        worker = std::thread([this]() {
+            work();
+        });
+    }
+
+    asset_streamer(const asset_streamer& other) = delete;
+
+    asset_streamer& operator=(const asset_streamer& other) = delete;
+
+    // Waits for the loader that is running, the queued ones are dropped.
+    ~asset_streamer() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        worker.join();
+        for (auto& target: requests) {
+            if (target->fence != nullptr) {
+                glDeleteSync(target->fence);
+            }
+        }
+        glfwDestroyWindow(context);
+    }
+
+    // Queues `loader` for the streaming thread and returns the id of the asset. `ready` is called on the main thread
+    // once the loader has finished and its uploads are done; it is not called when the loader throws.
+    // What the loader fills in may only be touched from the main thread once `ready` was called.
+    size_t load(std::string name, std::function<void()> loader, std::function<void()> ready) {
+        size_t id;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            id = requests.size();
+            requests.push_back(std::make_unique<request>(request{std::move(name), std::move(loader), std::move(ready)}));
+            queued.push_back(id);
+        }
+        streaming_stats.requested += 1;
+        streaming_stats.total_ms = 0.0f;
+        wake.notify_one();
+        return id;
+    }
+
+    // Runs the ready callbacks of finished assets in request order, until one is not finished or the budget is used up.
+    // At least one callback runs per call, so a callback above the budget still gets its frame.
+    void update() {
+        const auto start = std::chrono::steady_clock::now();
+        streaming_stats.integration_ms = 0.0f;
+        while (streaming_stats.integration_ms < frame_budget_ms) {
+            request* target;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (finished.empty()) {
+                    break;
+                }
+                target = requests[finished.front()].get();
+            }
+            if (target->fence != nullptr) {
+                if (glClientWaitSync(target->fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+                    break;
+                }
+                glDeleteSync(target->fence);
+                target->fence = nullptr;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                finished.pop_front();
+            }
+            if (target->failed) {
+                streaming_stats.failed += 1;
+            } else {
+                target->ready();
+                target->integrated = true;
+                streaming_stats.ready += 1;
+                fmt::print("Streamed {}: {:.1f} ms loading\n", target->name, target->load_ms);
+            }
+            const auto now = std::chrono::steady_clock::now();
+            streaming_stats.integration_ms = std::chrono::duration<float, std::milli>(now - start).count();
+            if (streaming_stats.ready + streaming_stats.failed == streaming_stats.requested) {
+                streaming_stats.total_ms = std::chrono::duration<float, std::milli>(now - created).count();
+            }
+        }
+    }
+
+    // Whether the ready callback of the asset has run. Main thread only.
+    [[nodiscard]]
+    bool is_ready(size_t id) const {
+        return requests[id]->integrated;
+    }
+
+    [[nodiscard]]
+    const stats& get_stats() const {
+        return streaming_stats;
+    }
+
+private:
+    struct request {
+        std::string name;
+        std::function<void()> loader;
+        std::function<void()> ready;
+        // Written by the streaming thread before the request is finished.
+        GLsync fence = nullptr;
+        bool failed = false;
+        float load_ms = 0.0f;
+        // Main thread only.
+        bool integrated = false;
+    };
+
+    void work() {
+        jobs.attach_thread();
+        glfwMakeContextCurrent(context);
+        while (true) {
+            request* target;
+            size_t id;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]() { return stopping || !queued.empty(); });
+                if (stopping) {
+                    break;
+                }
+                id = queued.front();
+                queued.pop_front();
+                target = requests[id].get();
+            }
+            const auto start = std::chrono::steady_clock::now();
+            try {
+                target->loader();
+                target->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                // The fence has to reach the GPU before another context can wait for it.
+                glFlush();
+            } catch (const std::exception& error) {
+                fmt::print("Failed to load {}: {}\n", target->name, error.what());
+                target->failed = true;
+            }
+            target->load_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+            std::lock_guard<std::mutex> lock(mutex);
+            finished.push_back(id);
+        }
+        glfwMakeContextCurrent(nullptr);
+    }
+
+    job_system& jobs;
+    GLFWwindow* context = nullptr;
+    float frame_budget_ms;
+    const std::chrono::steady_clock::time_point created = std::chrono::steady_clock::now();
+    // Guards the request list and both queues; a request's fields belong to whichever thread has its id.
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::vector<std::unique_ptr<request>> requests;
+    std::deque<size_t> queued;
+    std::deque<size_t> finished;
+    stats streaming_stats;
+    std::thread worker;
+};
+
+#endif
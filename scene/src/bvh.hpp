@@ -0,0 +1,298 @@
+#ifndef BVH_HPP
+#define BVH_HPP
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <utility>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "frustum.hpp"
+
+// Bounding volume hierarchy over object boxes; objects are the indices of the boxes passed to build().
+// Moving objects are handled by refit(), which keeps the topology and only grows or shrinks the boxes
+// above the object. When objects have moved far from where they were built, rebuild() restores the quality.
+class bvh {
+public:
+    struct ray_hit {
+        uint32_t object;
+        float distance;
+    };
+
+    struct query_stats {
+        size_t visited_nodes = 0;
+        size_t tested_objects = 0;
+    };
+
+    static constexpr uint32_t max_leaf_objects = 4;
+
+    bvh() = default;
+
+    explicit bvh(std::vector<aabb> bounds) {
+        build(std::move(bounds));
+    }
+
+    void build(std::vector<aabb> bounds) {
+        object_bounds = std::move(bounds);
+        rebuild();
+    }
+
+    void rebuild() {
+        nodes.clear();
+        objects.resize(object_bounds.size());
+        leaves.resize(object_bounds.size());
+        centers.resize(object_bounds.size());
+        for (uint32_t object = 0; object < objects.size(); object += 1) {
+            objects[object] = object;
+            centers[object] = (object_bounds[object].min + object_bounds[object].max) * 0.5f;
+        }
+        if (objects.empty()) {
+            return;
+        }
+        nodes.reserve(2 * objects.size() / max_leaf_objects + 1);
+        nodes.push_back({});
+        split(0, 0, (uint32_t)objects.size());
+    }
+
+    // Moves an object to new bounds and updates the boxes of the nodes above it.
+    void refit(uint32_t object, const aabb& bounds) {
+        object_bounds[object] = bounds;
+        auto index = leaves[object];
+        while (true) {
+            auto& current = nodes[index];
+            auto previous = current.bounds;
+            current.bounds = aabb();
+            if (current.is_leaf()) {
+                for (auto at = current.first; at < current.first + current.count; at += 1) {
+                    current.bounds.extend(object_bounds[objects[at]]);
+                }
+            } else {
+                current.bounds.extend(nodes[current.left].bounds);
+                current.bounds.extend(nodes[current.left + 1].bounds);
+            }
+            if (index == 0 || (previous.min == current.bounds.min && previous.max == current.bounds.max)) {
+                return;
+            }
+            index = current.parent;
+        }
+    }
+
+    // Calls visit(object) for every object whose box intersects the frustum.
+    // Subtrees entirely inside the frustum are reported without testing their objects.
+    template <typename F>
+    query_stats query(const frustum& view, F&& visit) const {
+        query_stats stats;
+        traverse(stats, [&](const node& current) {
+            if (!view.intersects(current.bounds)) {
+                return false;
+            }
+            if (view.contains(current.bounds)) {
+                for (auto at = current.first; at < current.first + current.count; at += 1) {
+                    visit(objects[at]);
+                }
+                return false;
+            }
+            if (current.is_leaf()) {
+                for (auto at = current.first; at < current.first + current.count; at += 1) {
+                    stats.tested_objects += 1;
+                    if (view.intersects(object_bounds[objects[at]])) {
+                        visit(objects[at]);
+                    }
+                }
+            }
+            return true;
+        });
+        return stats;
+    }
+
+    // Calls visit(object) for every object whose box is within radius of center.
+    template <typename F>
+    query_stats query(glm::vec3 center, float radius, F&& visit) const {
+        query_stats stats;
+        const auto overlaps = [&](const aabb& box) {
+            auto closest = glm::clamp(center, box.min, box.max);
+            auto offset = closest - center;
+            return glm::dot(offset, offset) <= radius * radius;
+        };
+        traverse(stats, [&](const node& current) {
+            if (!overlaps(current.bounds)) {
+                return false;
+            }
+            if (current.is_leaf()) {
+                for (auto at = current.first; at < current.first + current.count; at += 1) {
+                    stats.tested_objects += 1;
+                    if (overlaps(object_bounds[objects[at]])) {
+                        visit(objects[at]);
+                    }
+                }
+            }
+            return true;
+        });
+        return stats;
+    }
+
+    // The object whose box the ray enters first, nodes are visited front to back and pruned by the closest hit so far.
+    std::optional<ray_hit> raycast(glm::vec3 origin, glm::vec3 direction, float max_distance = std::numeric_limits<float>::max(), query_stats* stats = nullptr) const {
+        if (nodes.empty()) {
+            return std::nullopt;
+        }
+        const auto inverse_direction = 1.0f / direction;
+        std::optional<ray_hit> closest;
+        auto limit = max_distance;
+        std::vector<std::pair<uint32_t, float>> stack;
+        auto root_distance = intersect(nodes[0].bounds, origin, inverse_direction, limit);
+        if (root_distance.has_value()) {
+            stack.emplace_back(0, *root_distance);
+        }
+        while (!stack.empty()) {
+            auto [index, entry] = stack.back();
+            stack.pop_back();
+            if (entry > limit) {
+                continue;
+            }
+            const auto& current = nodes[index];
+            if (stats != nullptr) {
+                stats->visited_nodes += 1;
+            }
+            if (current.is_leaf()) {
+                for (auto at = current.first; at < current.first + current.count; at += 1) {
+                    if (stats != nullptr) {
+                        stats->tested_objects += 1;
+                    }
+                    auto distance = intersect(object_bounds[objects[at]], origin, inverse_direction, limit);
+                    if (distance.has_value()) {
+                        limit = *distance;
+                        closest = ray_hit{objects[at], *distance};
+                    }
+                }
+                continue;
+            }
+            auto near = intersect(nodes[current.left].bounds, origin, inverse_direction, limit);
+            auto far = intersect(nodes[current.left + 1].bounds, origin, inverse_direction, limit);
+            auto near_index = current.left;
+            auto far_index = current.left + 1;
+            if (far.has_value() && (!near.has_value() || *far < *near)) {
+                std::swap(near, far);
+                std::swap(near_index, far_index);
+            }
+            // The nearer child goes on top of the stack.
+            if (far.has_value()) {
+                stack.emplace_back(far_index, *far);
+            }
+            if (near.has_value()) {
+                stack.emplace_back(near_index, *near);
+            }
+        }
+        return closest;
+    }
+
+    [[nodiscard]]
+    const aabb& get_bounds(uint32_t object) const {
+        return object_bounds[object];
+    }
+
+    [[nodiscard]]
+    size_t size() const {
+        return object_bounds.size();
+    }
+
+    [[nodiscard]]
+    size_t node_count() const {
+        return nodes.size();
+    }
+
+private:
+    // Children of an inner node are stored next to each other at left and left + 1.
+    // Every node covers objects[first, first + count), so a subtree can be reported without walking it.
+    struct node {
+        aabb bounds;
+        uint32_t first = 0;
+        uint32_t count = 0;
+        uint32_t left = 0;
+        uint32_t parent = 0;
+
+        [[nodiscard]]
+        bool is_leaf() const {
+            return left == 0;
+        }
+    };
+
+    // Splits at the median center along the axis where the centers spread the most.
+    void split(uint32_t index, uint32_t first, uint32_t count) {
+        aabb bounds;
+        aabb center_bounds;
+        for (auto at = first; at < first + count; at += 1) {
+            bounds.extend(object_bounds[objects[at]]);
+            center_bounds.extend({centers[objects[at]], centers[objects[at]]});
+        }
+        nodes[index].bounds = bounds;
+        nodes[index].first = first;
+        nodes[index].count = count;
+        if (count <= max_leaf_objects) {
+            for (auto at = first; at < first + count; at += 1) {
+                leaves[objects[at]] = index;
+            }
+            return;
+        }
+        auto extent = center_bounds.max - center_bounds.min;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        auto middle = first + count / 2;
+        std::nth_element(objects.begin() + first, objects.begin() + middle, objects.begin() + first + count, [&](uint32_t a, uint32_t b) {
+            return centers[a][axis] < centers[b][axis];
+        });
+        auto left = (uint32_t)nodes.size();
+        nodes[index].left = left;
+        nodes.push_back({});
+        nodes.push_back({});
+        nodes[left].parent = index;
+        nodes[left + 1].parent = index;
+        split(left, first, middle - first);
+        split(left + 1, middle, first + count - middle);
+    }
+
+    // Depth first walk, enter(node) returns whether to descend into the node's children.
+    template <typename F>
+    void traverse(query_stats& stats, F&& enter) const {
+        if (nodes.empty()) {
+            return;
+        }
+        uint32_t stack[64];
+        size_t top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const auto& current = nodes[stack[--top]];
+            stats.visited_nodes += 1;
+            if (enter(current) && !current.is_leaf()) {
+                stack[top++] = current.left + 1;
+                stack[top++] = current.left;
+            }
+        }
+    }
+
+    // Distance at which the ray enters the box (0 when it starts inside), nothing when it misses or enters beyond limit.
+    static std::optional<float> intersect(const aabb& box, glm::vec3 origin, glm::vec3 inverse_direction, float limit) {
+        auto t0 = (box.min - origin) * inverse_direction;
+        auto t1 = (box.max - origin) * inverse_direction;
+        auto near = glm::min(t0, t1);
+        auto far = glm::max(t0, t1);
+        auto enter = std::max(std::max(near.x, near.y), std::max(near.z, 0.0f));
+        auto exit = std::min(std::min(far.x, far.y), std::min(far.z, limit));
+        if (enter > exit) {
+            return std::nullopt;
+        }
+        return enter;
+    }
+
+    std::vector<node> nodes;
+    std::vector<uint32_t> objects;
+    std::vector<aabb> object_bounds;
+    std::vector<glm::vec3> centers;
+    // Leaf node holding each object, where refits start.
+    std::vector<uint32_t> leaves;
+};
+
+#endif
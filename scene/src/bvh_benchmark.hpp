@@ -0,0 +1,140 @@
+#ifndef BVH_BENCHMARK_HPP
+#define BVH_BENCHMARK_HPP
+
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <fmt/core.h>
+
+#include "bvh.hpp"
+#include "frustum.hpp"
+
+// Query cost of the BVH against a linear scan over the same boxes, run with `--bvh-benchmark`.
+// Boxes are spread over a wide flat area like scene objects, views, rays and spheres are random.
+namespace bvh_benchmark {
+    namespace details {
+        template <typename F>
+        double measure_microseconds(size_t repeats, F&& body) {
+            auto start = std::chrono::steady_clock::now();
+            for (size_t index = 0; index < repeats; index += 1) {
+                body(index);
+            }
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            return std::chrono::duration<double, std::micro>(elapsed).count() / repeats;
+        }
+    }
+
+    inline int run() {
+        const size_t queries = 64;
+        std::mt19937 random(7);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        fmt::print("{:>8} {:>10} | {:>22} | {:>22} | {:>22} | {:>10}\n",
+            "objects", "build ms", "frustum bvh/linear us", "ray bvh/linear us", "sphere bvh/linear us", "refit us");
+        for (size_t count: {10000u, 100000u, 1000000u}) {
+            // Constant density: the area grows with the number of objects.
+            const auto side = std::sqrt((float)count) * 2.0f;
+            std::vector<aabb> boxes;
+            aabb_batch batch;
+            for (size_t index = 0; index < count; index += 1) {
+                auto center = glm::vec3(unit(random) - 0.5f, unit(random) * 0.05f, unit(random) - 0.5f) * side;
+                auto extent = glm::vec3(0.2f + unit(random), 0.2f + 2.0f * unit(random), 0.2f + unit(random));
+                boxes.push_back({center - extent, center + extent});
+                batch.push_back(boxes.back());
+            }
+
+            auto build_start = std::chrono::steady_clock::now();
+            bvh tree(boxes);
+            auto build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - build_start).count();
+
+            std::vector<frustum> views;
+            std::vector<std::pair<glm::vec3, glm::vec3>> rays;
+            std::vector<glm::vec3> centers;
+            for (size_t index = 0; index < queries; index += 1) {
+                auto eye = glm::vec3(unit(random) - 0.5f, 0.05f, unit(random) - 0.5f) * side + glm::vec3(0.0f, 5.0f, 0.0f);
+                auto angle = unit(random) * 6.2831853f;
+                auto forward = glm::vec3(std::cos(angle), -0.2f, std::sin(angle));
+                views.emplace_back(glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 100.0f) * glm::lookAt(eye, eye + forward, glm::vec3(0.0f, 1.0f, 0.0f)));
+                rays.emplace_back(eye, glm::normalize(forward));
+                centers.push_back(eye);
+            }
+
+            size_t bvh_visible = 0;
+            size_t linear_visible = 0;
+            auto frustum_bvh = details::measure_microseconds(queries, [&](size_t index) {
+                tree.query(views[index], [&](uint32_t) { bvh_visible += 1; });
+            });
+            std::vector<uint8_t> visibility(count);
+            auto frustum_linear = details::measure_microseconds(queries, [&](size_t index) {
+                views[index].cull(batch, 0, count, visibility.data());
+                for (auto visible: visibility) {
+                    linear_visible += visible;
+                }
+            });
+
+            size_t ray_mismatches = 0;
+            std::vector<float> bvh_ray_distances(queries, -1.0f);
+            auto ray_bvh = details::measure_microseconds(queries, [&](size_t index) {
+                auto hit = tree.raycast(rays[index].first, rays[index].second);
+                if (hit.has_value()) {
+                    bvh_ray_distances[index] = hit->distance;
+                }
+            });
+            auto ray_linear = details::measure_microseconds(queries, [&](size_t index) {
+                float closest = -1.0f;
+                auto inverse_direction = 1.0f / rays[index].second;
+                for (const auto& box: boxes) {
+                    auto t0 = (box.min - rays[index].first) * inverse_direction;
+                    auto t1 = (box.max - rays[index].first) * inverse_direction;
+                    auto near = glm::min(t0, t1);
+                    auto far = glm::max(t0, t1);
+                    auto enter = std::max(std::max(near.x, near.y), std::max(near.z, 0.0f));
+                    auto exit = std::min(std::min(far.x, far.y), far.z);
+                    if (enter <= exit && (closest < 0.0f || enter < closest)) {
+                        closest = enter;
+                    }
+                }
+                ray_mismatches += closest != bvh_ray_distances[index];
+            });
+
+            size_t bvh_in_range = 0;
+            size_t linear_in_range = 0;
+            const auto radius = 10.0f;
+            auto sphere_bvh = details::measure_microseconds(queries, [&](size_t index) {
+                tree.query(centers[index], radius, [&](uint32_t) { bvh_in_range += 1; });
+            });
+            auto sphere_linear = details::measure_microseconds(queries, [&](size_t index) {
+                for (const auto& box: boxes) {
+                    auto offset = glm::clamp(centers[index], box.min, box.max) - centers[index];
+                    linear_in_range += glm::dot(offset, offset) <= radius * radius;
+                }
+            });
+
+            // One object in a hundred moves a little every frame, like boats among static props.
+            const auto moving = count / 100;
+            auto refit = details::measure_microseconds(1, [&](size_t) {
+                for (uint32_t object = 0; object < moving; object += 1) {
+                    auto box = tree.get_bounds(object * 100);
+                    auto offset = glm::vec3(0.1f, 0.0f, 0.1f);
+                    tree.refit(object * 100, {box.min + offset, box.max + offset});
+                }
+            });
+
+            fmt::print("{:>8} {:>10.1f} | {:>10.1f} {:>11.1f} | {:>10.1f} {:>11.1f} | {:>10.1f} {:>11.1f} | {:>10.1f}\n",
+                count, build_ms, frustum_bvh, frustum_linear, ray_bvh, ray_linear, sphere_bvh, sphere_linear, refit);
+            if (bvh_visible != linear_visible || bvh_in_range != linear_in_range || ray_mismatches != 0) {
+                fmt::print("Results differ: {} / {} visible, {} / {} in range, {} rays\n",
+                    bvh_visible, linear_visible, bvh_in_range, linear_in_range, ray_mismatches);
+                return 1;
+            }
+        }
+        return 0;
+    }
+}
+
+#endif
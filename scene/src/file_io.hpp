@@ -0,0 +1,205 @@
+#ifndef FILE_IO_HPP
+#define FILE_IO_HPP
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+// Names the renderer uses for its own variables.
+#undef near
+#undef far
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Reading files the caches are made of and the sources they are made from: mappings, bounds checked reads out of
+// them, and hashes and stamps that tell whether a source changed since a cache was written for it.
+namespace file_io {
+    // Read-only mapping of a whole file, empty when the file can not be mapped.
+    class mapped_file {
+    public:
+        explicit mapped_file(const std::string& path) {
+#ifdef _WIN32
+            file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (file == INVALID_HANDLE_VALUE) {
+                return;
+            }
+            LARGE_INTEGER file_size;
+            if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+                return;
+            }
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping == nullptr) {
+                return;
+            }
+            bytes = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            length = bytes != nullptr ? (size_t)file_size.QuadPart : 0;
+#else
+            descriptor = open(path.c_str(), O_RDONLY);
+            if (descriptor < 0) {
+                return;
+            }
+            struct stat status;
+            if (fstat(descriptor, &status) != 0 || status.st_size == 0) {
+                return;
+            }
+            auto address = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+            if (address == MAP_FAILED) {
+                return;
+            }
+            bytes = (const uint8_t*)address;
+            length = (size_t)status.st_size;
+#endif
+        }
+
+        mapped_file(const mapped_file& other) = delete;
+
+        mapped_file& operator=(const mapped_file& other) = delete;
+
+        ~mapped_file() {
+#ifdef _WIN32
+            if (bytes != nullptr) {
+                UnmapViewOfFile(bytes);
+            }
+            if (mapping != nullptr) {
+                CloseHandle(mapping);
+            }
+            if (file != INVALID_HANDLE_VALUE) {
+                CloseHandle(file);
+            }
+#else
+            if (bytes != nullptr) {
+                munmap((void*)bytes, length);
+            }
+            if (descriptor >= 0) {
+                close(descriptor);
+            }
+#endif
+        }
+
+        [[nodiscard]]
+        const uint8_t* data() const {
+            return bytes;
+        }
+
+        [[nodiscard]]
+        size_t size() const {
+            return length;
+        }
+
+    private:
+#ifdef _WIN32
+        HANDLE file = INVALID_HANDLE_VALUE;
+        HANDLE mapping = nullptr;
+#else
+        int descriptor = -1;
+#endif
+        const uint8_t* bytes = nullptr;
+        size_t length = 0;
+    };
+
+    // Bounds checked reads from a mapping; every read fails once one has run past the end.
+    struct reader {
+        const uint8_t* at;
+        const uint8_t* end;
+
+        template <typename T>
+        bool read(T& value) {
+            if ((size_t)(end - at) < sizeof(T)) {
+                at = end;
+                return false;
+            }
+            std::memcpy(&value, at, sizeof(T));
+            at += sizeof(T);
+            return true;
+        }
+
+        bool read(std::string& value) {
+            uint32_t length = 0;
+            if (!read(length) || (size_t)(end - at) < length) {
+                at = end;
+                return false;
+            }
+            value.assign((const char*)at, length);
+            at += length;
+            return true;
+        }
+
+        // Start of `count` items of T, nullptr when they do not fit.
+        template <typename T>
+        const T* take(size_t count) {
+            if ((size_t)(end - at) / sizeof(T) < count) {
+                at = end;
+                return nullptr;
+            }
+            auto first = (const T*)at;
+            at += count * sizeof(T);
+            return first;
+        }
+    };
+
+    // FNV-1a of the whole file.
+    inline std::optional<uint64_t> hash_file(const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            return std::nullopt;
+        }
+        uint64_t hash = 14695981039346656037ull;
+        char buffer[1 << 16];
+        while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0) {
+            for (std::streamsize index = 0; index < file.gcount(); index += 1) {
+                hash = (hash ^ (uint8_t)buffer[index]) * 1099511628211ull;
+            }
+        }
+        return hash;
+    }
+
+    // Size and modification time of the source, which tell most changes without reading it.
+    inline std::optional<std::pair<uint64_t, int64_t>> stamp(const std::string& path) {
+        std::error_code error;
+        auto size = std::filesystem::file_size(path, error);
+        if (error) {
+            return std::nullopt;
+        }
+        auto time = std::filesystem::last_write_time(path, error);
+        if (error) {
+            return std::nullopt;
+        }
+        return std::make_pair((uint64_t)size, (int64_t)time.time_since_epoch().count());
+    }
+
+    // Whether a cache written for the source with this size, time and hash still belongs to it. `time` is updated
+    // and `touched` set when only the time of the source moved.
+    inline bool matches_source(const std::string& source, uint64_t size, int64_t& time, uint64_t hash, bool& touched) {
+        auto current = stamp(source);
+        if (!current.has_value() || size != current->first) {
+            return false;
+        }
+        if (time != current->second) {
+            // A checkout or a copy moves the time and keeps the contents.
+            auto current_hash = hash_file(source);
+            if (!current_hash.has_value() || *current_hash != hash) {
+                return false;
+            }
+            time = current->second;
+            touched = true;
+        }
+        return true;
+    }
+}
+
+#endif
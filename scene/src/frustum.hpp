@@ -0,0 +1,218 @@
+#ifndef FRUSTUM_HPP
+#define FRUSTUM_HPP
+
+#pragma once
+
+#include <array>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <glm/glm.hpp>
+
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+// The 8 wide cull: always there in builds with AVX, otherwise compiled for AVX on its own where GCC and Clang can,
+// and only run on CPUs that have it.
+#if defined(__AVX__)
+#define FRUSTUM_AVX_CULL
+#define FRUSTUM_AVX_TARGET
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define FRUSTUM_AVX_CULL
+#define FRUSTUM_AVX_TARGET __attribute__((target("avx")))
+#endif
+
+// Axis aligned bounding box.
+struct aabb {
+    glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 max = glm::vec3(std::numeric_limits<float>::lowest());
+
+    void extend(const aabb& other) {
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+
+    [[nodiscard]]
+    bool empty() const {
+        return min.x > max.x;
+    }
+
+    // The box around this one after the transform, it only grows under rotation.
+    [[nodiscard]]
+    aabb transformed(const glm::mat4& transform) const {
+        aabb result;
+        result.min = glm::vec3(transform[3]);
+        result.max = glm::vec3(transform[3]);
+        for (int column = 0; column < 3; column += 1) {
+            for (int row = 0; row < 3; row += 1) {
+                auto a = transform[column][row] * min[column];
+                auto b = transform[column][row] * max[column];
+                result.min[row] += std::min(a, b);
+                result.max[row] += std::max(a, b);
+            }
+        }
+        return result;
+    }
+};
+
+// Boxes stored one coordinate per array, so that several of them are tested against a plane at once.
+struct aabb_batch {
+    std::vector<float> min_x, min_y, min_z;
+    std::vector<float> max_x, max_y, max_z;
+
+    void push_back(const aabb& box) {
+        min_x.push_back(box.min.x);
+        min_y.push_back(box.min.y);
+        min_z.push_back(box.min.z);
+        max_x.push_back(box.max.x);
+        max_y.push_back(box.max.y);
+        max_z.push_back(box.max.z);
+    }
+
+    void clear() {
+        for (auto* values: {&min_x, &min_y, &min_z, &max_x, &max_y, &max_z}) {
+            values->clear();
+        }
+    }
+
+    [[nodiscard]]
+    size_t size() const {
+        return min_x.size();
+    }
+};
+
+// The six planes of a view volume, normals pointing inside.
+class frustum {
+public:
+    frustum() = default;
+
+    // Planes of any projection * view matrix, perspective or orthographic.
+    explicit frustum(const glm::mat4& view_projection) {
+        // Rows of the matrix, glm stores columns.
+        std::array<glm::vec4, 4> rows;
+        for (int row = 0; row < 4; row += 1) {
+            rows[row] = glm::vec4(view_projection[0][row], view_projection[1][row], view_projection[2][row], view_projection[3][row]);
+        }
+        for (int axis = 0; axis < 3; axis += 1) {
+            planes[axis * 2] = rows[3] + rows[axis];
+            planes[axis * 2 + 1] = rows[3] - rows[axis];
+        }
+        for (auto& plane: planes) {
+            plane /= glm::length(glm::vec3(plane));
+        }
+    }
+
+    [[nodiscard]]
+    bool intersects(const aabb& box) const {
+        for (const auto& plane: planes) {
+            // The corner furthest along the plane normal.
+            auto corner = glm::vec3(
+                plane.x >= 0.0f ? box.max.x : box.min.x,
+                plane.y >= 0.0f ? box.max.y : box.min.y,
+                plane.z >= 0.0f ? box.max.z : box.min.z
+            );
+            if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // True when the whole box is inside, everything in it is visible without further tests.
+    [[nodiscard]]
+    bool contains(const aabb& box) const {
+        for (const auto& plane: planes) {
+            // The corner furthest against the plane normal.
+            auto corner = glm::vec3(
+                plane.x >= 0.0f ? box.min.x : box.max.x,
+                plane.y >= 0.0f ? box.min.y : box.max.y,
+                plane.z >= 0.0f ? box.min.z : box.max.z
+            );
+            if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Writes 1 to visible[index - first] for every box in [first, last) that intersects the frustum, 0 otherwise.
+    // Boxes are tested 8 at a time on CPUs with AVX, 4 at a time with SSE; the tail goes through intersects().
+    void cull(const aabb_batch& boxes, size_t first, size_t last, uint8_t* visible) const {
+        auto index = first;
+#if defined(FRUSTUM_AVX_CULL)
+        if (has_avx()) {
+            index = cull_avx(boxes, first, last, visible);
+        }
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+        for (; index + 4 <= last; index += 4) {
+            auto outside = _mm_setzero_ps();
+            for (const auto& plane: planes) {
+                auto x = _mm_loadu_ps((plane.x >= 0.0f ? boxes.max_x : boxes.min_x).data() + index);
+                auto y = _mm_loadu_ps((plane.y >= 0.0f ? boxes.max_y : boxes.min_y).data() + index);
+                auto z = _mm_loadu_ps((plane.z >= 0.0f ? boxes.max_z : boxes.min_z).data() + index);
+                auto distance = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane.x)), _mm_mul_ps(y, _mm_set1_ps(plane.y))),
+                    _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w))
+                );
+                outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, _mm_setzero_ps()));
+            }
+            auto mask = _mm_movemask_ps(outside);
+            for (int lane = 0; lane < 4; lane += 1) {
+                visible[index - first + lane] = (mask >> lane & 1) == 0;
+            }
+        }
+#endif
+        for (; index < last; index += 1) {
+            auto box = aabb{
+                glm::vec3(boxes.min_x[index], boxes.min_y[index], boxes.min_z[index]),
+                glm::vec3(boxes.max_x[index], boxes.max_y[index], boxes.max_z[index])
+            };
+            visible[index - first] = intersects(box);
+        }
+    }
+
+private:
+#if defined(FRUSTUM_AVX_CULL)
+    static bool has_avx() {
+#if defined(__AVX__)
+        return true;
+#else
+        static const bool supported = __builtin_cpu_supports("avx");
+        return supported;
+#endif
+    }
+
+    // Culls the boxes from `first` on 8 at a time and returns the first one it left.
+    FRUSTUM_AVX_TARGET
+    size_t cull_avx(const aabb_batch& boxes, size_t first, size_t last, uint8_t* visible) const {
+        auto index = first;
+        for (; index + 8 <= last; index += 8) {
+            auto outside = _mm256_setzero_ps();
+            for (const auto& plane: planes) {
+                auto x = _mm256_loadu_ps((plane.x >= 0.0f ? boxes.max_x : boxes.min_x).data() + index);
+                auto y = _mm256_loadu_ps((plane.y >= 0.0f ? boxes.max_y : boxes.min_y).data() + index);
+                auto z = _mm256_loadu_ps((plane.z >= 0.0f ? boxes.max_z : boxes.min_z).data() + index);
+                auto distance = _mm256_add_ps(
+                    _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(plane.x)), _mm256_mul_ps(y, _mm256_set1_ps(plane.y))),
+                    _mm256_add_ps(_mm256_mul_ps(z, _mm256_set1_ps(plane.z)), _mm256_set1_ps(plane.w))
+                );
+                outside = _mm256_or_ps(outside, _mm256_cmp_ps(distance, _mm256_setzero_ps(), _CMP_LT_OQ));
+            }
+            auto mask = _mm256_movemask_ps(outside);
+            for (int lane = 0; lane < 8; lane += 1) {
+                visible[index - first + lane] = (mask >> lane & 1) == 0;
+            }
+        }
+        return index;
+    }
+#endif
+
+    // Left, right, bottom, top, near, far.
+    std::array<glm::vec4, 6> planes = {};
+};
+
+#endif
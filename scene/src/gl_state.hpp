@@ -0,0 +1,221 @@
+#ifndef GL_STATE_HPP
+#define GL_STATE_HPP
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <utility>
+#include <GL/glew.h>
+
+// Shadow copy of the GL state the renderer touches every frame.
+// Calls that would not change the tracked state are dropped before reaching the driver.
+// Code that changes the same state behind the cache's back must call invalidate() afterwards.
+namespace gl_state {
+    struct call_stats {
+        size_t requested = 0;
+        size_t issued = 0;
+    };
+
+    namespace details {
+        // Value that never matches a real GL name or enum, forces the next call through.
+        inline constexpr GLuint unknown = ~0u;
+        inline constexpr size_t texture_units = 32;
+
+        struct state {
+            GLuint program = unknown;
+            GLuint vertex_array = unknown;
+            GLuint draw_framebuffer = unknown;
+            GLuint read_framebuffer = unknown;
+            GLuint active_texture_unit = unknown;
+            // GL_TEXTURE_2D, GL_TEXTURE_CUBE_MAP and GL_TEXTURE_2D_ARRAY bindings for every unit.
+            std::array<std::array<GLuint, 3>, texture_units> textures;
+            std::array<GLint, 4> viewport = {-1, -1, -1, -1};
+            GLenum depth_func = unknown;
+            GLenum cull_face = unknown;
+            std::pair<GLenum, GLenum> blend_func = {unknown, unknown};
+            // GL_DEPTH_TEST, GL_BLEND, GL_CULL_FACE, GL_CLIP_DISTANCE0: 0 disabled, 1 enabled, unknown.
+            std::array<GLuint, 4> capabilities;
+
+            state() {
+                for (auto& unit: textures) {
+                    unit.fill(unknown);
+                }
+                capabilities.fill(unknown);
+            }
+        };
+
+        // Bindings belong to a context and a context is current on one thread, so every thread tracks its own.
+        inline thread_local state current;
+        inline thread_local call_stats frame_stats;
+
+        // Counts the request and returns true when the cached value has to be updated.
+        template <typename T>
+        bool update(T& cached, const T& value) {
+            frame_stats.requested += 1;
+            if (cached == value) {
+                return false;
+            }
+            cached = value;
+            frame_stats.issued += 1;
+            return true;
+        }
+
+        inline int texture_target_index(GLenum target) {
+            switch (target) {
+                case GL_TEXTURE_2D: return 0;
+                case GL_TEXTURE_CUBE_MAP: return 1;
+                case GL_TEXTURE_2D_ARRAY: return 2;
+                default: return -1;
+            }
+        }
+
+        inline int capability_index(GLenum capability) {
+            switch (capability) {
+                case GL_DEPTH_TEST: return 0;
+                case GL_BLEND: return 1;
+                case GL_CULL_FACE: return 2;
+                case GL_CLIP_DISTANCE0: return 3;
+                default: return -1;
+            }
+        }
+    }
+
+    // Forgets everything, the next call of every kind reaches the driver.
+    inline void invalidate() {
+        details::current = details::state();
+    }
+
+    inline call_stats reset_stats() {
+        return std::exchange(details::frame_stats, call_stats());
+    }
+
+    inline void use_program(GLuint program) {
+        if (details::update(details::current.program, program)) {
+            glUseProgram(program);
+        }
+    }
+
+    // Called on deletion: a deleted name may be handed out again for a new object.
+    inline void forget_program(GLuint program) {
+        if (details::current.program == program) {
+            details::current.program = details::unknown;
+        }
+    }
+
+    inline void forget_texture(GLuint texture) {
+        for (auto& unit: details::current.textures) {
+            for (auto& binding: unit) {
+                if (binding == texture) {
+                    binding = details::unknown;
+                }
+            }
+        }
+    }
+
+    inline void bind_vertex_array(GLuint vertex_array) {
+        if (details::update(details::current.vertex_array, vertex_array)) {
+            glBindVertexArray(vertex_array);
+        }
+    }
+
+    inline void bind_framebuffer(GLenum target, GLuint framebuffer) {
+        if (target == GL_FRAMEBUFFER) {
+            details::frame_stats.requested += 1;
+            if (details::current.draw_framebuffer == framebuffer && details::current.read_framebuffer == framebuffer) {
+                return;
+            }
+            details::current.draw_framebuffer = framebuffer;
+            details::current.read_framebuffer = framebuffer;
+            details::frame_stats.issued += 1;
+            glBindFramebuffer(target, framebuffer);
+        } else if (details::update(target == GL_DRAW_FRAMEBUFFER ? details::current.draw_framebuffer : details::current.read_framebuffer, framebuffer)) {
+            glBindFramebuffer(target, framebuffer);
+        }
+    }
+
+    inline void viewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+        if (details::update(details::current.viewport, std::array<GLint, 4>{x, y, width, height})) {
+            glViewport(x, y, width, height);
+        }
+    }
+
+    inline void active_texture(GLuint unit) {
+        if (details::update(details::current.active_texture_unit, unit)) {
+            glActiveTexture(GL_TEXTURE0 + unit);
+        }
+    }
+
+    // Binds the texture to the given unit, switching the active unit only when the binding changes.
+    inline void bind_texture(GLuint unit, GLenum target, GLuint texture) {
+        auto target_index = details::texture_target_index(target);
+        if (unit >= details::texture_units || target_index < 0) {
+            details::current.active_texture_unit = details::unknown;
+            details::frame_stats.requested += 2;
+            details::frame_stats.issued += 2;
+            glActiveTexture(GL_TEXTURE0 + unit);
+            glBindTexture(target, texture);
+            return;
+        }
+        if (details::update(details::current.textures[unit][target_index], texture)) {
+            active_texture(unit);
+            glBindTexture(target, texture);
+        } else {
+            // Unfiltered code would have selected the unit as well.
+            details::frame_stats.requested += 1;
+        }
+    }
+
+    // Binds to whatever unit is active, for texture creation and uploads.
+    inline void bind_texture(GLenum target, GLuint texture) {
+        auto unit = details::current.active_texture_unit;
+        if (unit == details::unknown) {
+            active_texture(0);
+            unit = 0;
+        }
+        bind_texture(unit, target, texture);
+    }
+
+    inline void set_enabled(GLenum capability, bool enabled) {
+        auto index = details::capability_index(capability);
+        if (index < 0) {
+            details::frame_stats.requested += 1;
+            details::frame_stats.issued += 1;
+        } else if (!details::update(details::current.capabilities[index], (GLuint)enabled)) {
+            return;
+        }
+        if (enabled) {
+            glEnable(capability);
+        } else {
+            glDisable(capability);
+        }
+    }
+
+    inline void enable(GLenum capability) {
+        set_enabled(capability, true);
+    }
+
+    inline void disable(GLenum capability) {
+        set_enabled(capability, false);
+    }
+
+    inline void depth_func(GLenum func) {
+        if (details::update(details::current.depth_func, func)) {
+            glDepthFunc(func);
+        }
+    }
+
+    inline void cull_face(GLenum mode) {
+        if (details::update(details::current.cull_face, mode)) {
+            glCullFace(mode);
+        }
+    }
+
+    inline void blend_func(GLenum source, GLenum destination) {
+        if (details::update(details::current.blend_func, std::make_pair(source, destination))) {
+            glBlendFunc(source, destination);
+        }
+    }
+}
+
+#endif
@@ -3,16 +3,20 @@
 
 #pragma once
 
+#include <algorithm>
 #include <vector>
 #include <tuple>
 #include <string>
 #include <glm/glm.hpp>
 #include <fmt/core.h>
 #include <cmath>
+#include <limits>
 
+#include "job_system.hpp"
 #include "stb_image_wrapper.hpp"
 #include "mesh.hpp"
 #include "model.hpp"
+#include "texture_registry.hpp"
 
 namespace {
     inline auto load_raw_image(const std::string& path) {
@@ -55,6 +59,8 @@ public:
 
 
     const float inct = 100.0f;
+    // Rows of the mesh built by one job.
+    static constexpr size_t rows_per_job = 32;
 
     inline float calc_height(int x, int z) const {
         auto red = (int)data[x * components + 0 + z * components * width];
@@ -64,73 +70,192 @@ public:
         return miny + std::abs(maxy - miny) * ((float)rgb / (float)(255 * 255 * 255));
     }
 
-    void calc_normals(std::vector<vertex>& vertices) const {
-        for (int row = 0; row < height; row += 1) {
-            for (int column = 0; column < width; column += 1) {
-                auto normal = glm::vec3(0.0f);
-                if (row > 0 && row < height -1 && column > 0 && column < width -1) {
-                    auto v0 = vertices[row * width + column].position;
-                    auto v1 = vertices[row * width + (column - 1)].position - v0;
-                    auto v2 = vertices[(row + 1) * width + column].position - v0;
-                    auto v3 = vertices[row * width + (column + 1)].position - v0;
-                    auto v4 = vertices[(row - 1) * width + column].position - v0;
-                    normal = glm::normalize(
-                        glm::normalize(glm::cross(v1, v2)) +
-                        glm::normalize(glm::cross(v2, v3)) +
-                        glm::normalize(glm::cross(v3, v4)) +
-                        glm::normalize(glm::cross(v4, v1))
-                    );
-                } else {
-                    normal = glm::vec3(0, 1, 0);
+    // Rows are independent, they are split over the jobs.
+    void calc_normals(std::vector<vertex>& vertices, job_system& jobs) const {
+        jobs.parallel_for(height, rows_per_job, [&](size_t first_row, size_t last_row) {
+            for (int row = (int)first_row; row < (int)last_row; row += 1) {
+                for (int column = 0; column < width; column += 1) {
+                    auto normal = glm::vec3(0.0f);
+                    if (row > 0 && row < height -1 && column > 0 && column < width -1) {
+                        auto v0 = vertices[row * width + column].position;
+                        auto v1 = vertices[row * width + (column - 1)].position - v0;
+                        auto v2 = vertices[(row + 1) * width + column].position - v0;
+                        auto v3 = vertices[row * width + (column + 1)].position - v0;
+                        auto v4 = vertices[(row - 1) * width + column].position - v0;
+                        normal = glm::normalize(
+                            glm::normalize(glm::cross(v1, v2)) +
+                            glm::normalize(glm::cross(v2, v3)) +
+                            glm::normalize(glm::cross(v3, v4)) +
+                            glm::normalize(glm::cross(v4, v1))
+                        );
+                    } else {
+                        normal = glm::vec3(0, 1, 0);
+                    }
+                    vertices[row * width + column].normal = glm::normalize(normal);
                 }
-                vertices[row * width + column].normal = glm::normalize(normal);
             }
-        }
+        });
     }
 
-    auto create_mesh() {
+    // Every row writes its own vertices and the indices of the quads below it, in the same order as a serial loop.
+    auto create_mesh(job_system& jobs) const {
         const float incx = std::abs(startx * 2.0f) / width;
         const float incz = std::abs(startz * 2.0f) / height;
-        std::vector<vertex> vertices;
-        std::vector<GLuint> indices;
-        for (int row = 0; row < height; row++) {
-            for (int column = 0; column < width; column++) {
-                //fmt::print("{}\n", calc_height(column, row));
-                vertices.emplace_back(
-                    glm::vec3(startx + column * incx, calc_height(column, row), startz + row * incz),
-                    glm::vec3(0),
-                    glm::vec2(inct * (float)column / (float)width, inct * (float)row / (float)width)
-                );
-                if (column < width - 1 && row < height - 1) {
-                    int leftTop = row * width + column;
-                    int leftBottom = (row + 1) * width + column;
-                    int rightBottom = (row + 1) * width + column + 1;
-                    int rightTop = row * width + column + 1;
-
-                    indices.push_back(leftTop);
-                    indices.push_back(leftBottom);
-                    indices.push_back(rightTop);
-
-                    indices.push_back(rightTop);
-                    indices.push_back(leftBottom);
-                    indices.push_back(rightBottom);
+        std::vector<vertex> vertices((size_t)width * height, vertex(glm::vec3(0)));
+        std::vector<GLuint> indices((size_t)std::max(width - 1, 0) * std::max(height - 1, 0) * 6);
+        jobs.parallel_for(height, rows_per_job, [&](size_t first_row, size_t last_row) {
+            for (int row = (int)first_row; row < (int)last_row; row++) {
+                for (int column = 0; column < width; column++) {
+                    vertices[row * width + column] = vertex(
+                        glm::vec3(startx + column * incx, calc_height(column, row), startz + row * incz),
+                        glm::vec3(0),
+                        glm::vec2(inct * (float)column / (float)width, inct * (float)row / (float)width)
+                    );
+                    if (column < width - 1 && row < height - 1) {
+                        int leftTop = row * width + column;
+                        int leftBottom = (row + 1) * width + column;
+                        int rightBottom = (row + 1) * width + column + 1;
+                        int rightTop = row * width + column + 1;
+
+                        auto quad = indices.begin() + ((size_t)row * (width - 1) + column) * 6;
+                        quad[0] = leftTop;
+                        quad[1] = leftBottom;
+                        quad[2] = rightTop;
+
+                        quad[3] = rightTop;
+                        quad[4] = leftBottom;
+                        quad[5] = rightBottom;
+                    }
                 }
             }
-        }
+        });
         return std::make_tuple(vertices, indices);
     }
 };
 
-inline mesh create_terrain(const std::string& path) {
-    heightmap_loader loader("assets/heightmap/heightmap.png");
-    auto [vertices, indices] = loader.create_mesh();
-    loader.calc_normals(vertices);
-    return mesh(vertices, indices, {
-        texture(details::load_texture("assets/heightmap/p1.jpg"), "texture_diffuse"),
-        texture(details::load_texture("assets/heightmap/p2.jpg"), "texture_diffuse"),
-        texture(details::load_texture("assets/heightmap/rock.jpg"), "texture_diffuse"),
-        texture(details::load_texture("assets/heightmap/detail.jpg"), "texture_diffuse")
+inline mesh create_terrain(const heightmap_loader& loader, job_system& jobs) {
+    auto [vertices, indices] = loader.create_mesh(jobs);
+    loader.calc_normals(vertices, jobs);
+    auto references = texture_registry::acquire({
+        "assets/heightmap/p1.jpg",
+        "assets/heightmap/p2.jpg",
+        "assets/heightmap/rock.jpg",
+        "assets/heightmap/detail.jpg"
+    }, {}, [&](const std::vector<std::string>& paths, const std::vector<bool>& gamma) {
+        return details::load_textures(paths, jobs, gamma);
     });
+    std::vector<texture> textures;
+    for (const auto& reference: references) {
+        textures.emplace_back(texture_registry::id_of(reference), "texture_diffuse", GL_TEXTURE_2D, reference);
+    }
+    return mesh(vertices, indices, textures);
+}
+
+inline mesh create_terrain(const std::string& path, job_system& jobs) {
+    return create_terrain(heightmap_loader(path), jobs);
 }
 
+// Height and normal lookups between the vertices of the terrain mesh, for placing things on the ground.
+// Positions are in the terrain's world space: its local space moved by `offset`.
+class terrain_sampler {
+public:
+    terrain_sampler(const heightmap_loader& loader, glm::vec3 offset, job_system& jobs): width(loader.width), height(loader.height), offset(offset) {
+        auto [vertices, indices] = loader.create_mesh(jobs);
+        loader.calc_normals(vertices, jobs);
+        positions.reserve(vertices.size());
+        normals.reserve(vertices.size());
+        for (const auto& vertex: vertices) {
+            positions.push_back(vertex.position);
+            normals.push_back(vertex.normal);
+        }
+        min_corner = glm::vec3(std::numeric_limits<float>::max());
+        max_corner = glm::vec3(std::numeric_limits<float>::lowest());
+        for (const auto& position: positions) {
+            min_corner = glm::min(min_corner, position + offset);
+            max_corner = glm::max(max_corner, position + offset);
+        }
+    }
+
+    // Bilinear height at the given world x/z, clamped to the terrain's extent.
+    [[nodiscard]]
+    float height_at(float x, float z) const {
+        auto [index, weights] = locate(x, z);
+        return interpolate(index, weights, [&](size_t at) { return positions[at].y; }) + offset.y;
+    }
+
+    [[nodiscard]]
+    glm::vec3 normal_at(float x, float z) const {
+        auto [index, weights] = locate(x, z);
+        return glm::normalize(interpolate(index, weights, [&](size_t at) { return normals[at]; }));
+    }
+
+    // A coarse grid of resolution x resolution quads that stays below the terrain, for occlusion culling.
+    // Every vertex takes the lowest height around it within one coarse quad, so the quads never poke out.
+    [[nodiscard]]
+    std::tuple<std::vector<glm::vec3>, std::vector<uint32_t>> create_occluder(size_t resolution) const {
+        std::vector<glm::vec3> vertices;
+        std::vector<uint32_t> indices;
+        const auto reach_x = (width - 1) / resolution + 1;
+        const auto reach_z = (height - 1) / resolution + 1;
+        for (size_t row = 0; row <= resolution; row += 1) {
+            for (size_t column = 0; column <= resolution; column += 1) {
+                auto center_x = column * (width - 1) / resolution;
+                auto center_z = row * (height - 1) / resolution;
+                auto lowest = std::numeric_limits<float>::max();
+                for (auto z = center_z > reach_z ? center_z - reach_z : 0; z <= std::min(height - 1, center_z + reach_z); z += 1) {
+                    for (auto x = center_x > reach_x ? center_x - reach_x : 0; x <= std::min(width - 1, center_x + reach_x); x += 1) {
+                        lowest = std::min(lowest, positions[z * width + x].y);
+                    }
+                }
+                auto position = positions[center_z * width + center_x];
+                vertices.push_back(glm::vec3(position.x, lowest, position.z) + offset);
+                if (row < resolution && column < resolution) {
+                    auto top_left = (uint32_t)(row * (resolution + 1) + column);
+                    auto bottom_left = top_left + (uint32_t)(resolution + 1);
+                    indices.insert(indices.end(), {top_left, bottom_left, top_left + 1, top_left + 1, bottom_left, bottom_left + 1});
+                }
+            }
+        }
+        return std::make_tuple(vertices, indices);
+    }
+
+    [[nodiscard]]
+    glm::vec3 get_min_corner() const {
+        return min_corner;
+    }
+
+    [[nodiscard]]
+    glm::vec3 get_max_corner() const {
+        return max_corner;
+    }
+
+private:
+    // Index of the top-left vertex of the quad under x/z and the position inside that quad.
+    [[nodiscard]]
+    std::tuple<size_t, glm::vec2> locate(float x, float z) const {
+        auto cell = (glm::vec2(x, z) - glm::vec2(min_corner.x, min_corner.z)) /
+            (glm::vec2(max_corner.x, max_corner.z) - glm::vec2(min_corner.x, min_corner.z)) *
+            glm::vec2(width - 1, height - 1);
+        cell = glm::clamp(cell, glm::vec2(0.0f), glm::vec2(width - 1, height - 1) - 0.001f);
+        auto column = (size_t)cell.x;
+        auto row = (size_t)cell.y;
+        return std::make_tuple(row * width + column, cell - glm::vec2(column, row));
+    }
+
+    template <typename F>
+    auto interpolate(size_t index, glm::vec2 weights, F value) const -> decltype(value(index)) {
+        auto top = glm::mix(value(index), value(index + 1), weights.x);
+        auto bottom = glm::mix(value(index + width), value(index + width + 1), weights.x);
+        return glm::mix(top, bottom, weights.y);
+    }
+
+    size_t width;
+    size_t height;
+    glm::vec3 offset;
+    glm::vec3 min_corner;
+    glm::vec3 max_corner;
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> normals;
+};
+
 #endif
\ No newline at end of file
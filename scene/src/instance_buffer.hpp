@@ -0,0 +1,67 @@
+#ifndef INSTANCE_BUFFER_HPP
+#define INSTANCE_BUFFER_HPP
+
+#pragma once
+
+#include <utility>
+#include <vector>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+// Per-instance model matrices for instanced draws, kept on the GPU across frames.
+// Meshes read it through attributes first_attribute..first_attribute + 3 (one vec4 column each).
+class instance_buffer {
+public:
+    static constexpr GLuint first_attribute = 4;
+
+    instance_buffer() {
+        glGenBuffers(1, &buffer);
+    }
+
+    explicit instance_buffer(const std::vector<glm::mat4>& transforms): instance_buffer() {
+        update(transforms);
+    }
+
+    instance_buffer(const instance_buffer& other) = delete;
+
+    instance_buffer& operator=(const instance_buffer& other) = delete;
+
+    instance_buffer(instance_buffer&& other) noexcept:
+        buffer(std::exchange(other.buffer, 0)), count(std::exchange(other.count, 0)),
+        capacity(std::exchange(other.capacity, 0)) {}
+
+    ~instance_buffer() {
+        if (buffer != 0) {
+            glDeleteBuffers(1, &buffer);
+        }
+    }
+
+    // Replaces the instances; storage is only reallocated when it has to grow.
+    void update(const std::vector<glm::mat4>& transforms) {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        if (transforms.size() > capacity) {
+            capacity = transforms.size();
+            glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(glm::mat4), transforms.data(), GL_STATIC_DRAW);
+        } else if (!transforms.empty()) {
+            glBufferSubData(GL_ARRAY_BUFFER, 0, transforms.size() * sizeof(glm::mat4), transforms.data());
+        }
+        count = transforms.size();
+    }
+
+    [[nodiscard]]
+    GLuint get_id() const {
+        return buffer;
+    }
+
+    [[nodiscard]]
+    size_t size() const {
+        return count;
+    }
+
+private:
+    GLuint buffer = 0;
+    size_t count = 0;
+    size_t capacity = 0;
+};
+
+#endif
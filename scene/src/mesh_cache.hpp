@@ -0,0 +1,186 @@
+#ifndef MESH_CACHE_HPP
+#define MESH_CACHE_HPP
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <vector>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <fmt/core.h>
+
+#include "file_io.hpp"
+#include "mesh.hpp"
+
+// Meshes of a model file the way the model reads them from Assimp, kept in a binary file next to the source
+// (`<source>.meshcache`) so that later runs skip the importer. The cache is mapped and the vertices and indices are
+// copied straight out of the mapping. It belongs to one version of this format, one vertex layout and one state of the
+// source: its size and modification time, or failing those, a hash of its contents. Material libraries the source
+// refers to are not tracked, delete the cache after changing them.
+//
+// Layout, native byte order: a header, then for every mesh its counts and bounds, its diffuse and normal texture
+// names (32 bit length, then the bytes), padding to 4 bytes, the vertices and the 32 bit indices.
+namespace mesh_cache {
+    // Bump whenever the layout or the way models process meshes changes.
+    inline constexpr uint32_t version = 3;
+    inline constexpr uint32_t magic = 0x4853454d;
+
+    struct cached_mesh {
+        std::vector<vertex> vertices;
+        std::vector<GLuint> indices;
+        glm::vec3 min_values = glm::vec3(std::numeric_limits<float>::max());
+        glm::vec3 max_values = glm::vec3(std::numeric_limits<float>::lowest());
+        // Texture file names relative to the model's directory, as the material lists them.
+        std::vector<std::string> diffuse_textures;
+        std::vector<std::string> normal_textures;
+    };
+
+    namespace details {
+        struct header {
+            uint32_t magic;
+            uint32_t version;
+            uint32_t vertex_size;
+            uint32_t mesh_count;
+            uint64_t source_size;
+            int64_t source_time;
+            uint64_t source_hash;
+        };
+
+        struct mesh_header {
+            uint32_t vertex_count;
+            uint32_t index_count;
+            uint32_t diffuse_count;
+            uint32_t normal_count;
+            float bounds[6];
+        };
+
+        inline std::string cache_path(const std::string& source) {
+            return source + ".meshcache";
+        }
+
+        // Reads the meshes of a mapped cache; `touched` tells that only the time of the source moved.
+        inline std::optional<std::vector<cached_mesh>> read_meshes(const file_io::mapped_file& file, const std::string& source, header& cache_header, bool& touched) {
+            if (file.data() == nullptr) {
+                return std::nullopt;
+            }
+            file_io::reader input{file.data(), file.data() + file.size()};
+            if (!input.read(cache_header) || cache_header.magic != magic || cache_header.version != version || cache_header.vertex_size != sizeof(vertex)) {
+                return std::nullopt;
+            }
+            if (!file_io::matches_source(source, cache_header.source_size, cache_header.source_time, cache_header.source_hash, touched)) {
+                return std::nullopt;
+            }
+            std::vector<cached_mesh> meshes(cache_header.mesh_count);
+            for (auto& target: meshes) {
+                mesh_header counts;
+                if (!input.read(counts)) {
+                    return std::nullopt;
+                }
+                target.min_values = glm::vec3(counts.bounds[0], counts.bounds[1], counts.bounds[2]);
+                target.max_values = glm::vec3(counts.bounds[3], counts.bounds[4], counts.bounds[5]);
+                target.diffuse_textures.resize(counts.diffuse_count);
+                target.normal_textures.resize(counts.normal_count);
+                for (auto& name: target.diffuse_textures) {
+                    input.read(name);
+                }
+                for (auto& name: target.normal_textures) {
+                    input.read(name);
+                }
+                input.take<uint8_t>((4 - (size_t)(input.at - file.data()) % 4) % 4);
+                auto vertices = input.take<vertex>(counts.vertex_count);
+                auto indices = input.take<GLuint>(counts.index_count);
+                if (vertices == nullptr || indices == nullptr) {
+                    return std::nullopt;
+                }
+                target.vertices.assign(vertices, vertices + counts.vertex_count);
+                target.indices.assign(indices, indices + counts.index_count);
+            }
+            return meshes;
+        }
+    }
+
+    // The cached meshes of the source, or nothing when there is no cache or it is stale.
+    inline std::optional<std::vector<cached_mesh>> read(const std::string& source) {
+        const auto path = details::cache_path(source);
+        details::header cache_header;
+        bool touched = false;
+        std::optional<std::vector<cached_mesh>> meshes;
+        {
+            file_io::mapped_file file(path);
+            meshes = details::read_meshes(file, source, cache_header, touched);
+        }
+        if (meshes.has_value() && touched) {
+            // The next run can trust the time again, the file is rewritten once it is no longer mapped.
+            std::fstream update(path, std::ios::binary | std::ios::in | std::ios::out);
+            update.write((const char*)&cache_header, sizeof(cache_header));
+        }
+        return meshes;
+    }
+
+    // Replaces the cache of the source; a cache that can not be written is only reported.
+    inline void write(const std::string& source, const std::vector<cached_mesh>& meshes) {
+        auto current = file_io::stamp(source);
+        auto hash = file_io::hash_file(source);
+        if (!current.has_value() || !hash.has_value()) {
+            return;
+        }
+        const auto path = details::cache_path(source);
+        const auto temporary = path + ".tmp";
+        {
+            std::ofstream output(temporary, std::ios::binary | std::ios::trunc);
+            const details::header cache_header = {magic, version, (uint32_t)sizeof(vertex), (uint32_t)meshes.size(), current->first, current->second, *hash};
+            output.write((const char*)&cache_header, sizeof(cache_header));
+            size_t written = sizeof(cache_header);
+            const auto write_string = [&](const std::string& value) {
+                auto length = (uint32_t)value.size();
+                output.write((const char*)&length, sizeof(length));
+                output.write(value.data(), length);
+                written += sizeof(length) + length;
+            };
+            for (const auto& target: meshes) {
+                const details::mesh_header counts = {
+                    (uint32_t)target.vertices.size(),
+                    (uint32_t)target.indices.size(),
+                    (uint32_t)target.diffuse_textures.size(),
+                    (uint32_t)target.normal_textures.size(),
+                    {
+                        target.min_values.x, target.min_values.y, target.min_values.z,
+                        target.max_values.x, target.max_values.y, target.max_values.z
+                    }
+                };
+                output.write((const char*)&counts, sizeof(counts));
+                written += sizeof(counts);
+                for (const auto& name: target.diffuse_textures) {
+                    write_string(name);
+                }
+                for (const auto& name: target.normal_textures) {
+                    write_string(name);
+                }
+                const char padding[4] = {};
+                output.write(padding, (std::streamsize)((4 - written % 4) % 4));
+                written += (4 - written % 4) % 4;
+                output.write((const char*)target.vertices.data(), (std::streamsize)(target.vertices.size() * sizeof(vertex)));
+                output.write((const char*)target.indices.data(), (std::streamsize)(target.indices.size() * sizeof(GLuint)));
+                written += target.vertices.size() * sizeof(vertex) + target.indices.size() * sizeof(GLuint);
+            }
+            if (!output) {
+                fmt::print("Failed to write mesh cache {}\n", temporary);
+                return;
+            }
+        }
+        std::error_code error;
+        std::filesystem::rename(temporary, path, error);
+        if (error) {
+            fmt::print("Failed to write mesh cache {}: {}\n", path, error.message());
+            std::filesystem::remove(temporary, error);
+        }
+    }
+}
+
+#endif
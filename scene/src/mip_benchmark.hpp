@@ -0,0 +1,115 @@
+#ifndef MIP_BENCHMARK_HPP
+#define MIP_BENCHMARK_HPP
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+#include <fmt/core.h>
+
+#include "gl_state.hpp"
+#include "job_system.hpp"
+#include "mip_chain.hpp"
+#include "stb_image_wrapper.hpp"
+
+// Mip chains of the lighthouse textures built by mip_chain against glGenerateMipmap, run with `--mip-benchmark`.
+// Both sides include uploading the image and wait for the GPU, so the driver can not defer its work past the clock.
+// The last column is how far the driver's first level is from the sRGB correct one, in 8 bit steps per channel.
+namespace mip_benchmark {
+    namespace details {
+        template <typename F>
+        double measure_milliseconds(F&& body) {
+            auto start = std::chrono::steady_clock::now();
+            body();
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        inline double mean_difference(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b) {
+            double sum = 0.0;
+            for (size_t index = 0; index < a.size(); index += 1) {
+                sum += std::abs((int)a[index] - (int)b[index]);
+            }
+            return a.empty() ? 0.0 : sum / (double)a.size();
+        }
+    }
+
+    // Needs a current GL context.
+    inline int run(job_system& jobs) {
+        const std::string directory = "assets/models/lighthouse";
+        std::vector<std::string> paths;
+        std::error_code error;
+        for (const auto& entry: std::filesystem::directory_iterator(directory, error)) {
+            if (entry.path().filename().string().find("_BaseColor") != std::string::npos) {
+                paths.push_back(entry.path().string());
+            }
+        }
+        if (paths.empty()) {
+            fmt::print("No textures in {}\n", directory);
+            return 1;
+        }
+        std::sort(paths.begin(), paths.end());
+        fmt::print("{} threads, {}\n", jobs.size(), (const char*)glGetString(GL_RENDERER));
+        fmt::print("{:>20} {:>13} | {:>8} {:>8} | {:>8} {:>8} | {:>10}\n",
+            "texture", "size", "mips ms", "cpu ms", "gl ms", "speedup", "difference");
+        double total_cpu_ms = 0.0;
+        double total_gl_ms = 0.0;
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (const auto& path: paths) {
+            int width, height, components;
+            std::unique_ptr<unsigned char, void (*)(void*)> pixels(stbi_load(path.c_str(), &width, &height, &components, 4), stbi_image_free);
+            if (!pixels) {
+                fmt::print("Failed to load {}\n", path);
+                return 1;
+            }
+            GLuint textures[2];
+            glGenTextures(2, textures);
+
+            gl_state::bind_texture(GL_TEXTURE_2D, textures[0]);
+            auto gl_ms = details::measure_milliseconds([&]() {
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.get());
+                glGenerateMipmap(GL_TEXTURE_2D);
+                glFinish();
+            });
+            std::vector<uint8_t> driver_level;
+            if (width > 1 || height > 1) {
+                driver_level.resize((size_t)std::max(1, width / 2) * std::max(1, height / 2) * 4);
+                glGetTexImage(GL_TEXTURE_2D, 1, GL_RGBA, GL_UNSIGNED_BYTE, driver_level.data());
+            }
+
+            std::vector<mip_chain::level> levels;
+            double mips_ms = 0.0;
+            gl_state::bind_texture(GL_TEXTURE_2D, textures[1]);
+            auto cpu_ms = details::measure_milliseconds([&]() {
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.get());
+                mips_ms = details::measure_milliseconds([&]() {
+                    levels = mip_chain::generate(pixels.get(), width, height, 4, true, jobs);
+                });
+                for (size_t index = 0; index < levels.size(); index += 1) {
+                    const auto& level = levels[index];
+                    glTexImage2D(GL_TEXTURE_2D, (GLint)index + 1, GL_RGBA8, level.width, level.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, level.pixels.data());
+                }
+                glFinish();
+            });
+
+            gl_state::forget_texture(textures[0]);
+            gl_state::forget_texture(textures[1]);
+            glDeleteTextures(2, textures);
+            total_cpu_ms += cpu_ms;
+            total_gl_ms += gl_ms;
+            fmt::print("{:>20} {:>5} x {:<5} | {:>8.1f} {:>8.1f} | {:>8.1f} {:>7.1f}x | {:>10.2f}\n",
+                std::filesystem::path(path).filename().string(), width, height, mips_ms, cpu_ms, gl_ms, gl_ms / cpu_ms,
+                levels.empty() ? 0.0 : details::mean_difference(levels.front().pixels, driver_level));
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        fmt::print("{:>20} {:>13} | {:>8} {:>8.1f} | {:>8.1f} {:>7.1f}x |\n", "total", "", "", total_cpu_ms, total_gl_ms, total_gl_ms / total_cpu_ms);
+        return 0;
+    }
+}
+
+#endif
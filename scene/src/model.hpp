@@ -15,79 +15,635 @@
 #include <assimp/postprocess.h>
 #include <fmt/format.h>
 #include "stb_image_wrapper.hpp"
+#include "gl_state.hpp"
+#include "mesh_cache.hpp"
+#include "obj_loader.hpp"
 #include <map>
 #include <limits>
+#include <tuple>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include "job_system.hpp"
+#include "compressed_texture.hpp"
+#include "mip_chain.hpp"
+#include "texture_registry.hpp"
 
 namespace details {
-    GLuint load_texture(const std::string& path, bool gamma = true) {
-        std::cout << path << std::endl;
-        GLuint textureID;
-        glGenTextures(1, &textureID);
+    // Pixels of an image decoded by stb_image, which also frees them.
+    struct decoded_image {
+        std::unique_ptr<unsigned char, void (*)(void*)> pixels{nullptr, stbi_image_free};
+        int width = 0;
+        int height = 0;
+        // Components per pixel in `pixels`.
+        int components = 0;
+        float decode_ms = 0.0f;
+    };
 
-        int width, height, nrComponents;
-        auto data = stbi_load(path.c_str(), &width, &height, &nrComponents, 0);
-        if (!data) {
-            std::cout << "Texture failed to load at path: " << path << std::endl;
-            stbi_image_free(data);
-            return 0;
+    // Time spent decoding images, against the time the same decodes take one after another.
+    struct decode_stats {
+        size_t images = 0;
+        float elapsed_ms = 0.0f;
+        float serial_ms = 0.0f;
+        // Block compressed images only: cache reads and transcodes one after another, of which `serial_ms` is decoding;
+        // how many came from the texture cache, and their size against RGBA8.
+        float load_ms = 0.0f;
+        size_t cached = 0;
+        size_t compressed_bytes = 0;
+        size_t uncompressed_bytes = 0;
+    };
+
+    // Decodes to the image's own components, or to `desired_components` when it is not 0. Safe to call from any thread.
+    inline decoded_image decode_image(const std::string& path, int desired_components = 0) {
+        decoded_image image;
+        auto start = std::chrono::steady_clock::now();
+        image.pixels.reset(stbi_load(path.c_str(), &image.width, &image.height, &image.components, desired_components));
+        image.decode_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (desired_components != 0) {
+            image.components = desired_components;
         }
+        return image;
+    }
+
+    // Decodes all images at once, one job per image. Images that fail to decode have no pixels.
+    inline std::vector<decoded_image> decode_images(const std::vector<std::string>& paths, job_system& jobs, decode_stats& stats, int desired_components = 0) {
+        std::vector<decoded_image> images(paths.size());
+        auto start = std::chrono::steady_clock::now();
+        jobs.parallel_for(paths.size(), 1, [&](size_t index, size_t) {
+            images[index] = decode_image(paths[index], desired_components);
+        });
+        stats.elapsed_ms += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        stats.images += images.size();
+        for (const auto& image: images) {
+            stats.serial_ms += image.decode_ms;
+        }
+        return images;
+    }
+
+    inline void print_decode_stats(const decode_stats& stats, const job_system& jobs) {
+        if (stats.load_ms == 0.0f) {
+            fmt::print(
+                "Decoded {} images in {:.1f} ms on {} threads, {:.1f} ms one after another\n",
+                stats.images,
+                stats.elapsed_ms,
+                jobs.size(),
+                stats.serial_ms
+            );
+        } else {
+            fmt::print(
+                "Loaded {} images in {:.1f} ms on {} threads, {:.1f} ms one after another of which {:.1f} ms decoding\n",
+                stats.images,
+                stats.elapsed_ms,
+                jobs.size(),
+                stats.load_ms,
+                stats.serial_ms
+            );
+            fmt::print(
+                "  {} from the texture cache, {:.1f} MB compressed instead of {:.1f} MB\n",
+                stats.cached,
+                (float)stats.compressed_bytes / (1 << 20),
+                (float)stats.uncompressed_bytes / (1 << 20)
+            );
+        }
+    }
+
+    // Uploads the image with its mip chain, filtered on the CPU; with `gamma` its colors are sRGB.
+    inline GLuint upload_texture(const decoded_image& image, bool gamma, job_system& jobs) {
         GLenum format;
-        if (nrComponents == 1) {
+        if (image.components == 1) {
             format = GL_RED;
         }
-        else if (nrComponents == 3) {
+        else if (image.components == 3) {
             format = GL_RGB;
         }
-        else if (nrComponents == 4) {
+        else if (image.components == 4) {
             format = GL_RGBA;
         }
 
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        GLuint textureID;
+        glGenTextures(1, &textureID);
+        gl_state::bind_texture(GL_TEXTURE_2D, textureID);
+        // Rows of RGB and single channel images, and of the small levels, are not 4 byte aligned.
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.pixels.get());
+        auto levels = mip_chain::generate(image.pixels.get(), image.width, image.height, image.components, gamma, jobs);
+        for (size_t index = 0; index < levels.size(); index += 1) {
+            const auto& level = levels[index];
+            glTexImage2D(GL_TEXTURE_2D, (GLint)index + 1, format, level.width, level.height, 0, format, GL_UNSIGNED_BYTE, level.pixels.data());
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)levels.size());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 
         return textureID;
     }
+
+    GLuint load_texture(const std::string& path, job_system& jobs, bool gamma = true) {
+        std::cout << path << std::endl;
+        auto image = decode_image(path);
+        if (!image.pixels) {
+            std::cout << "Texture failed to load at path: " << path << std::endl;
+            return 0;
+        }
+        return upload_texture(image, gamma, jobs);
+    }
+
+    // Block compressed textures of all paths, read from the texture cache or transcoded into it in parallel, and
+    // uploaded in order on the calling thread; 0 for the ones that fail. `gamma` is the same as for load_textures().
+    inline std::vector<GLuint> load_compressed_textures(const std::vector<std::string>& paths, job_system& jobs, const std::vector<bool>& gamma = {}) {
+        decode_stats stats;
+        std::vector<compressed_texture::image> images(paths.size());
+        auto start = std::chrono::steady_clock::now();
+        jobs.parallel_for(paths.size(), 1, [&](size_t index, size_t) {
+            images[index] = compressed_texture::load(paths[index], gamma.empty() || gamma[index], jobs);
+        });
+        stats.elapsed_ms += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        stats.images += images.size();
+        std::vector<GLuint> textures;
+        for (size_t index = 0; index < paths.size(); index += 1) {
+            std::cout << paths[index] << std::endl;
+            const auto& image = images[index];
+            stats.load_ms += image.load_ms;
+            stats.serial_ms += image.decode_ms;
+            if (image.levels.empty()) {
+                std::cout << "Texture failed to load at path: " << paths[index] << std::endl;
+                textures.push_back(0);
+                continue;
+            }
+            stats.cached += image.cached;
+            stats.compressed_bytes += compressed_texture::compressed_size(image);
+            stats.uncompressed_bytes += compressed_texture::uncompressed_size(image);
+            textures.push_back(compressed_texture::upload(image));
+        }
+        print_decode_stats(stats, jobs);
+        return textures;
+    }
+
+    // Textures of all paths, decoded in parallel and uploaded in order on the calling thread; 0 for the ones that fail.
+    // Block compressed where the GPU can sample it. `gamma` tells for every path whether the image holds sRGB colors
+    // rather than data such as normals; all of them do when it is empty.
+    inline std::vector<GLuint> load_textures(const std::vector<std::string>& paths, job_system& jobs, const std::vector<bool>& gamma = {}) {
+        if (compressed_texture::supported()) {
+            return load_compressed_textures(paths, jobs, gamma);
+        }
+        decode_stats stats;
+        auto images = decode_images(paths, jobs, stats);
+        std::vector<GLuint> textures;
+        for (size_t index = 0; index < paths.size(); index += 1) {
+            std::cout << paths[index] << std::endl;
+            if (!images[index].pixels) {
+                std::cout << "Texture failed to load at path: " << paths[index] << std::endl;
+                textures.push_back(0);
+                continue;
+            }
+            textures.push_back(upload_texture(images[index], gamma.empty() || gamma[index], jobs));
+        }
+        print_decode_stats(stats, jobs);
+        return textures;
+    }
+
+    // Bilinear resize of RGBA pixels.
+    inline std::vector<unsigned char> resize_rgba(const unsigned char* pixels, int width, int height, int new_width, int new_height) {
+        std::vector<unsigned char> result((size_t)new_width * new_height * 4);
+        for (int y = 0; y < new_height; y += 1) {
+            auto source_y = std::clamp((y + 0.5f) * height / new_height - 0.5f, 0.0f, (float)(height - 1));
+            auto y0 = (int)source_y;
+            auto y1 = std::min(y0 + 1, height - 1);
+            auto fy = source_y - y0;
+            for (int x = 0; x < new_width; x += 1) {
+                auto source_x = std::clamp((x + 0.5f) * width / new_width - 0.5f, 0.0f, (float)(width - 1));
+                auto x0 = (int)source_x;
+                auto x1 = std::min(x0 + 1, width - 1);
+                auto fx = source_x - x0;
+                for (int channel = 0; channel < 4; channel += 1) {
+                    const auto at = [&](int column, int row) {
+                        return (float)pixels[((size_t)row * width + column) * 4 + channel];
+                    };
+                    auto top = at(x0, y0) + (at(x1, y0) - at(x0, y0)) * fx;
+                    auto bottom = at(x0, y1) + (at(x1, y1) - at(x0, y1)) * fx;
+                    result[((size_t)y * new_width + x) * 4 + channel] = (unsigned char)(top + (bottom - top) * fy + 0.5f);
+                }
+            }
+        }
+        return result;
+    }
+
+    // A layer of a block compressed texture array at its size and format: the texture cache of the image when it holds
+    // them, otherwise the image transcoded into the cache. An image of another size is resized first and not cached,
+    // its cache stays that of the image. Safe to call from jobs.
+    inline compressed_texture::image load_compressed_layer(const std::string& path, int width, int height, GLenum format, job_system& jobs) {
+        const auto start = std::chrono::steady_clock::now();
+        auto result = compressed_texture::details::read(path, true);
+        if (!result.has_value() || result->format != format || result->width != width || result->height != height) {
+            auto image = decode_image(path, 4);
+            if (!image.pixels) {
+                return {};
+            }
+            const unsigned char* pixels = image.pixels.get();
+            std::vector<unsigned char> resized;
+            if (image.width != width || image.height != height) {
+                resized = resize_rgba(image.pixels.get(), image.width, image.height, width, height);
+                pixels = resized.data();
+            }
+            result = compressed_texture::details::encode(pixels, width, height, 4, format, true, jobs);
+            result->decode_ms = image.decode_ms;
+            if (resized.empty()) {
+                compressed_texture::details::write(path, true, *result);
+            }
+        }
+        result->load_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return std::move(*result);
+    }
+
+    // One GL_TEXTURE_2D_ARRAY with a layer per image, all at the most common size of the images; the others are resized to it.
+    // Block compressed like 2D textures where the GPU can sample it: BC1 unless an image has alpha.
+    // Returns the texture and the layer of every path, -1 for images that can not be loaded.
+    inline std::tuple<GLuint, std::vector<int>> load_texture_array(const std::vector<std::string>& paths, job_system& jobs) {
+        std::vector<int> layers(paths.size(), -1);
+        std::map<std::pair<int, int>, size_t> sizes;
+        int layer_count = 0;
+        bool alpha = false;
+        for (size_t index = 0; index < paths.size(); index += 1) {
+            int width, height, components;
+            if (!stbi_info(paths[index].c_str(), &width, &height, &components)) {
+                std::cout << "Texture failed to load at path: " << paths[index] << std::endl;
+                continue;
+            }
+            sizes[{width, height}] += 1;
+            layers[index] = layer_count++;
+            alpha = alpha || components == 2 || components == 4;
+        }
+        if (layer_count == 0) {
+            return {0, layers};
+        }
+        auto [width, height] = std::max_element(sizes.begin(), sizes.end(), [](const auto& a, const auto& b) {
+            return a.second < b.second;
+        })->first;
+        // Images are loaded in batches of one per thread, so only that many of them are in memory at once.
+        std::vector<size_t> readable;
+        for (size_t index = 0; index < paths.size(); index += 1) {
+            if (layers[index] >= 0) {
+                readable.push_back(index);
+            }
+        }
+        GLuint texture_id;
+        glGenTextures(1, &texture_id);
+        gl_state::bind_texture(GL_TEXTURE_2D_ARRAY, texture_id);
+        const auto level_count = (GLint)mip_chain::level_count(width, height);
+        decode_stats stats;
+        if (compressed_texture::supported()) {
+            const GLenum format = alpha ? compressed_texture::details::alpha_format() : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+            for (GLint level = 0, level_width = width, level_height = height; level < level_count; level += 1) {
+                const auto size = compressed_texture::details::level_size(format, level_width, level_height) * layer_count;
+                glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, format, level_width, level_height, layer_count, 0, (GLsizei)size, nullptr);
+                level_width = std::max(1, level_width / 2);
+                level_height = std::max(1, level_height / 2);
+            }
+            for (size_t first = 0; first < readable.size(); first += jobs.size()) {
+                const auto last = std::min(readable.size(), first + jobs.size());
+                std::vector<compressed_texture::image> images(last - first);
+                auto start = std::chrono::steady_clock::now();
+                jobs.parallel_for(images.size(), 1, [&](size_t at, size_t) {
+                    images[at] = load_compressed_layer(paths[readable[first + at]], width, height, format, jobs);
+                });
+                stats.elapsed_ms += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+                stats.images += images.size();
+                for (auto at = first; at < last; at += 1) {
+                    const auto index = readable[at];
+                    const auto& image = images[at - first];
+                    std::cout << paths[index] << std::endl;
+                    stats.load_ms += image.load_ms;
+                    stats.serial_ms += image.decode_ms;
+                    if (image.levels.empty()) {
+                        continue;
+                    }
+                    stats.cached += image.cached;
+                    stats.compressed_bytes += compressed_texture::compressed_size(image);
+                    stats.uncompressed_bytes += compressed_texture::uncompressed_size(image);
+                    auto level_width = width;
+                    auto level_height = height;
+                    for (size_t level = 0; level < image.levels.size(); level += 1) {
+                        const auto& blocks = image.levels[level];
+                        glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, (GLint)level, 0, 0, layers[index], level_width, level_height, 1, format, (GLsizei)blocks.size(), blocks.data());
+                        level_width = std::max(1, level_width / 2);
+                        level_height = std::max(1, level_height / 2);
+                    }
+                }
+            }
+        } else {
+            for (GLint level = 0, level_width = width, level_height = height; level < level_count; level += 1) {
+                glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, level_width, level_height, layer_count, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+                level_width = std::max(1, level_width / 2);
+                level_height = std::max(1, level_height / 2);
+            }
+            for (size_t first = 0; first < readable.size(); first += jobs.size()) {
+                const auto last = std::min(readable.size(), first + jobs.size());
+                std::vector<std::string> batch;
+                for (auto at = first; at < last; at += 1) {
+                    batch.push_back(paths[readable[at]]);
+                }
+                auto images = decode_images(batch, jobs, stats, 4);
+                for (auto at = first; at < last; at += 1) {
+                    const auto index = readable[at];
+                    const auto& image = images[at - first];
+                    std::cout << paths[index] << std::endl;
+                    if (!image.pixels) {
+                        continue;
+                    }
+                    const unsigned char* pixels = image.pixels.get();
+                    std::vector<unsigned char> resized;
+                    if (image.width != width || image.height != height) {
+                        resized = resize_rgba(image.pixels.get(), image.width, image.height, width, height);
+                        pixels = resized.data();
+                    }
+                    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layers[index], width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+                    auto levels = mip_chain::generate(pixels, width, height, 4, true, jobs);
+                    for (size_t level = 0; level < levels.size(); level += 1) {
+                        const auto& target = levels[level];
+                        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, (GLint)level + 1, 0, 0, layers[index], target.width, target.height, 1, GL_RGBA, GL_UNSIGNED_BYTE, target.pixels.data());
+                    }
+                }
+            }
+        }
+        print_decode_stats(stats, jobs);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        return {texture_id, layers};
+    }
 }
 
+// How the meshes of a model are stored on the GPU.
+enum class model_layout {
+    // Every mesh has its own vertex array and buffers, needed for instancing.
+    separate,
+    // All meshes share one vertex buffer, one index buffer and one vertex array; a mesh is a range of indices
+    // with a base vertex, and meshes sharing a material are drawn together with glMultiDrawElementsBaseVertex.
+    packed,
+    // Packed, and the diffuse textures of all meshes are layers of one texture array. The layer of every vertex is
+    // in attribute layer_attribute (-1 for meshes without one), so the whole model is a single material.
+    // Drawn with programs built with TEXTURE_ARRAY.
+    layered
+};
+
 class model {
 public:
-    explicit model(const std::string& path, const std::string& filename): path(path) {
-        fmt::print("{}/{}\n", path, filename);
-        Assimp::Importer importer;
-        auto scene = importer.ReadFile(fmt::format("{}/{}", path, filename), aiProcess_Triangulate | aiProcess_FlipUVs);
-        if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
-            throw std::runtime_error(importer.GetErrorString());
+    static constexpr GLuint layer_attribute = 8;
+
+    // Textures of all meshes are decoded together on the job system. Meshes come from the mesh cache next to the file
+    // when it is up to date, otherwise from the OBJ loader or Assimp, and the cache is written for the next run.
+    model(const std::string& path, const std::string& filename, job_system& jobs, model_layout layout = model_layout::separate):
+        path(path), layout(layout)
+    {
+        const auto source = fmt::format("{}/{}", path, filename);
+        fmt::print("{}\n", source);
+        const auto start = std::chrono::steady_clock::now();
+        auto cached = mesh_cache::read(source);
+        if (cached.has_value()) {
+            fmt::print("Read {} meshes from the mesh cache in {:.1f} ms\n", cached->size(), milliseconds_since(start));
+        } else {
+            cached = import_meshes(source, jobs);
+            fmt::print("Imported {} meshes in {:.1f} ms\n", cached->size(), milliseconds_since(start));
+            mesh_cache::write(source, *cached);
+        }
+        for (auto& source_mesh: *cached) {
+            meshes.push_back(create_mesh(std::move(source_mesh)));
+        }
+        load_textures(jobs);
+        if (layout == model_layout::layered) {
+            create_texture_array(jobs);
+        }
+        if (layout != model_layout::separate) {
+            pack();
+        }
+    }
+
+    // A model made of meshes built elsewhere, like the merged meshes of a static batch.
+    // Meshes of a separate layout must be uploaded, layers are needed for a layered one.
+    model(std::vector<mesh> source_meshes, model_layout layout, std::vector<int> layers = {}):
+        layout(layout), meshes(std::move(source_meshes)), mesh_layers(std::move(layers))
+    {
+        for (const auto& target: meshes) {
+            min_values = glm::min(min_values, target.min_values);
+            max_values = glm::max(max_values, target.max_values);
+        }
+        if (layout != model_layout::separate) {
+            pack();
         }
-        process_node(scene->mRootNode, scene);
     }
 
     void draw(shader_program& shader) {
+        if (layout != model_layout::separate) {
+            for (const auto& group: material_groups) {
+                draw_packed(shader, group.data(), group.size());
+            }
+            return;
+        }
         for (auto& mesh: meshes) {
             mesh.draw(shader);
         }
     }
 
+    // Draws the given meshes of a packed model in one call, with the textures of the first one.
+    void draw_packed(shader_program& shader, const uint32_t* mesh_indices, size_t count, bool ignore_textures = false) {
+        if (!ignore_textures) {
+            meshes[mesh_indices[0]].bind_textures(shader);
+        }
+        if (packed_vbo == 0) {
+            upload();
+        }
+        if (packed_vao == 0) {
+            create_vertex_array();
+        }
+        draw_counts.clear();
+        draw_offsets.clear();
+        draw_base_vertices.clear();
+        for (size_t index = 0; index < count; index += 1) {
+            const auto& range = ranges[mesh_indices[index]];
+            draw_counts.push_back(range.count);
+            draw_offsets.push_back((const void*)(range.first_index * sizeof(GLuint)));
+            draw_base_vertices.push_back(range.base_vertex);
+        }
+        gl_state::bind_vertex_array(packed_vao);
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, draw_counts.data(), GL_UNSIGNED_INT, draw_offsets.data(), (GLsizei)count, draw_base_vertices.data());
+    }
+
+    // Geometry goes to the GPU on the first draw, so a model that only feeds a static batch never uploads its own copy.
+    // Models loaded in the background upload here ahead of time instead, buffers are shared between contexts.
+    void upload() {
+        if (layout == model_layout::separate || packed_vbo != 0) {
+            return;
+        }
+        std::vector<vertex> vertices;
+        std::vector<GLuint> indices;
+        for (const auto& target: meshes) {
+            vertices.insert(vertices.end(), target.vertices.begin(), target.vertices.end());
+            indices.insert(indices.end(), target.indices.begin(), target.indices.end());
+        }
+        glGenBuffers(1, &packed_vbo);
+        glGenBuffers(1, &packed_ebo);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, packed_vbo);
+        glBufferData(GL_COPY_WRITE_BUFFER, vertices.size() * sizeof(vertex), vertices.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, packed_ebo);
+        glBufferData(GL_COPY_WRITE_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+        if (layout == model_layout::layered) {
+            std::vector<float> layers;
+            for (size_t index = 0; index < meshes.size(); index += 1) {
+                layers.insert(layers.end(), meshes[index].vertices.size(), (float)mesh_layers[index]);
+            }
+            glGenBuffers(1, &packed_layers);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, packed_layers);
+            glBufferData(GL_COPY_WRITE_BUFFER, layers.size() * sizeof(float), layers.data(), GL_STATIC_DRAW);
+        }
+        fmt::print("Packed {} meshes into {} vertices, {} indices, {} materials\n", meshes.size(), vertices.size(), indices.size(), material_groups.size());
+    }
+
+    std::vector<mesh>& get_meshes() {
+        return meshes;
+    }
+
+    [[nodiscard]]
+    bool is_packed() const {
+        return layout != model_layout::separate;
+    }
+
+    [[nodiscard]]
+    model_layout get_layout() const {
+        return layout;
+    }
+
+    // Identifies a packed model to the render queue for the whole run.
+    [[nodiscard]]
+    uint64_t get_render_id() const {
+        return render_id;
+    }
+
+    // Texture array layer of a mesh of a layered model, -1 for other models and meshes without a diffuse texture.
+    [[nodiscard]]
+    int get_mesh_layer(size_t index) const {
+        return index < mesh_layers.size() ? mesh_layers[index] : -1;
+    }
+
     glm::vec3 min_values = glm::vec3(std::numeric_limits<float>::max());
-    glm::vec3 max_values = glm::vec3(std::numeric_limits<float>::min());
+    glm::vec3 max_values = glm::vec3(std::numeric_limits<float>::lowest());
 
 private:
+    struct mesh_range {
+        GLsizei count;
+        size_t first_index;
+        GLint base_vertex;
+    };
+
     std::string path;
+    model_layout layout;
     std::vector<mesh> meshes;
-    std::map<std::string, texture> texture_cache;
+    struct texture_request {
+        std::string path;
+        std::string type;
+    };
+    // Textures every mesh asked for while the model was read, in order.
+    std::vector<std::vector<texture_request>> texture_requests;
+    GLuint packed_vao = 0;
+    GLuint packed_vbo = 0;
+    GLuint packed_ebo = 0;
+    GLuint packed_layers = 0;
+    std::vector<mesh_range> ranges;
+    // Diffuse texture of every mesh of a layered model until the texture array is created, then its layer.
+    std::vector<std::string> diffuse_paths;
+    std::vector<int> mesh_layers;
+    // Meshes with the same textures, in the order they were loaded.
+    std::vector<std::vector<uint32_t>> material_groups;
+    // Reused argument arrays of the multi-draw call.
+    std::vector<GLsizei> draw_counts;
+    std::vector<const void*> draw_offsets;
+    std::vector<GLint> draw_base_vertices;
+    uint64_t render_id = next_render_id();
+
+    // Lays the meshes out in the shared buffers; mesh indices stay relative to the mesh, its base vertex offsets them.
+    void pack() {
+        size_t vertex_count = 0;
+        size_t index_count = 0;
+        std::map<std::vector<GLuint>, size_t> groups;
+        for (uint32_t index = 0; index < meshes.size(); index += 1) {
+            const auto& target = meshes[index];
+            ranges.push_back({(GLsizei)target.indices.size(), index_count, (GLint)vertex_count});
+            vertex_count += target.vertices.size();
+            index_count += target.indices.size();
+            std::vector<GLuint> texture_set;
+            for (const auto& texture: target.textures) {
+                texture_set.push_back(texture.id);
+            }
+            auto group = groups.try_emplace(texture_set, material_groups.size());
+            if (group.second) {
+                material_groups.emplace_back();
+            }
+            material_groups[group.first->second].push_back(index);
+        }
+    }
+
+    // Vertex arrays are not shared between contexts, the one that draws makes it.
+    void create_vertex_array() {
+        glGenVertexArrays(1, &packed_vao);
+        gl_state::bind_vertex_array(packed_vao);
+        mesh::bind_vertex_attributes(packed_vbo, packed_ebo);
+        if (layout == model_layout::layered) {
+            glBindBuffer(GL_ARRAY_BUFFER, packed_layers);
+            glEnableVertexAttribArray(layer_attribute);
+            glVertexAttribPointer(layer_attribute, 1, GL_FLOAT, GL_FALSE, sizeof(float), nullptr);
+        }
+        gl_state::bind_vertex_array(0);
+    }
+
+    // Puts the diffuse textures into one texture array and makes it the first texture of every mesh.
+    void create_texture_array(job_system& jobs) {
+        std::vector<std::string> paths;
+        std::map<std::string, size_t> path_indices;
+        for (const auto& diffuse_path: diffuse_paths) {
+            if (!diffuse_path.empty() && path_indices.try_emplace(diffuse_path, paths.size()).second) {
+                paths.push_back(diffuse_path);
+            }
+        }
+        auto [texture_array, layers] = details::load_texture_array(paths, jobs);
+        for (size_t index = 0; index < meshes.size(); index += 1) {
+            auto found = path_indices.find(diffuse_paths[index]);
+            mesh_layers.push_back(found != path_indices.end() ? layers[found->second] : -1);
+            auto& textures = meshes[index].textures;
+            textures.insert(textures.begin(), texture(texture_array, "texture_diffuse_array", GL_TEXTURE_2D_ARRAY));
+        }
+        fmt::print("Created texture array with {} layers for {} meshes\n", paths.size(), meshes.size());
+    }
+
+    static float milliseconds_since(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
 
-    void process_node(aiNode* node, const aiScene* scene) {
+    // OBJ files go through the native loader, everything else through Assimp.
+    std::vector<mesh_cache::cached_mesh> import_meshes(const std::string& source, job_system& jobs) {
+        if (obj_loader::is_obj(source)) {
+            return obj_loader::load(source, jobs);
+        }
+        Assimp::Importer importer;
+        auto scene = importer.ReadFile(source, aiProcess_Triangulate | aiProcess_FlipUVs);
+        if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
+            throw std::runtime_error(importer.GetErrorString());
+        }
+        std::vector<mesh_cache::cached_mesh> result;
+        process_node(scene->mRootNode, scene, result);
+        return result;
+    }
+
+    void process_node(aiNode* node, const aiScene* scene, std::vector<mesh_cache::cached_mesh>& result) {
         for (size_t mesh_index = 0; mesh_index < node->mNumMeshes; mesh_index += 1) {
             aiMesh* mesh = scene->mMeshes[node->mMeshes[mesh_index]];
-            meshes.push_back(process_mesh(mesh, scene));
+            result.push_back(process_mesh(mesh, scene));
         }
         for (size_t index = 0; index < node->mNumChildren; index += 1) {
-            process_node(node->mChildren[index], scene);
+            process_node(node->mChildren[index], scene, result);
         }
     }
 
@@ -98,43 +654,56 @@ private:
         return glm::vec2(0, 0);
     }
 
-    mesh process_mesh(const aiMesh* raw_mesh, const aiScene* raw_scene) {
-        std::vector<vertex> vertices;
+    // Everything the model needs from Assimp, which is also what the mesh cache keeps.
+    mesh_cache::cached_mesh process_mesh(const aiMesh* raw_mesh, const aiScene* raw_scene) {
+        mesh_cache::cached_mesh result;
         for (size_t vertex_index = 0; vertex_index < raw_mesh->mNumVertices; vertex_index += 1) {
             auto vertex = glm::vec3(
                 raw_mesh->mVertices[vertex_index].x,
                 raw_mesh->mVertices[vertex_index].y,
                 raw_mesh->mVertices[vertex_index].z
             );
-            min_values = glm::min(min_values, vertex);
-            max_values = glm::max(max_values, vertex);
+            result.min_values = glm::min(result.min_values, vertex);
+            result.max_values = glm::max(result.max_values, vertex);
             auto color = glm::vec3(0.1f, 1.0f, 0.0f);
             if (raw_mesh->mMaterialIndex >= 0) {
                 color = get_color_for_vertex(raw_scene->mMaterials[raw_mesh->mMaterialIndex], vertex_index);
             }
-            vertices.emplace_back(
+            result.vertices.emplace_back(
                 vertex,
                 glm::vec3(raw_mesh->mNormals[vertex_index].x, raw_mesh->mNormals[vertex_index].y,raw_mesh->mNormals[vertex_index].z),
                 get_texture_corrdinats_for_vertex(raw_mesh, vertex_index),
                 color
             );
         }
-        std::vector<GLuint> indices;
         for (size_t face_index = 0; face_index < raw_mesh->mNumFaces; face_index += 1) {
             auto face = raw_mesh->mFaces[face_index];
             for (size_t index = 0; index < face.mNumIndices; index += 1) {
-                indices.push_back(face.mIndices[index]);
+                result.indices.push_back(face.mIndices[index]);
             }
         }
-        std::vector<texture> textures;
         if (raw_mesh->mMaterialIndex >= 0) {
             auto material = raw_scene->mMaterials[raw_mesh->mMaterialIndex];
-            auto diffuse = load_material_textures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-            auto normals = load_material_textures(material, aiTextureType_HEIGHT, "texture_normal");
-            textures.insert(textures.end(), diffuse.begin(), diffuse.end());
-            textures.insert(textures.end(), normals.begin(), normals.end());
+            result.diffuse_textures = get_texture_names(material, aiTextureType_DIFFUSE);
+            result.normal_textures = get_texture_names(material, aiTextureType_HEIGHT);
         }
-        return mesh(vertices, indices, textures);
+        return result;
+    }
+
+    // Textures are only asked for here, load_textures() gives them to the meshes.
+    mesh create_mesh(mesh_cache::cached_mesh source) {
+        min_values = glm::min(min_values, source.min_values);
+        max_values = glm::max(max_values, source.max_values);
+        std::vector<texture_request> requests;
+        if (layout == model_layout::layered) {
+            // The first diffuse texture becomes a layer, empty when the material has none.
+            diffuse_paths.push_back(source.diffuse_textures.empty() ? "" : fmt::format("{}/{}", path, source.diffuse_textures.front()));
+        } else {
+            request_textures(source.diffuse_textures, "texture_diffuse", requests);
+        }
+        request_textures(source.normal_textures, "texture_normal", requests);
+        texture_requests.push_back(std::move(requests));
+        return mesh(std::move(source.vertices), std::move(source.indices), {}, layout == model_layout::separate);
     }
 
     static glm::vec3 get_color_for_vertex(const aiMaterial* mat, size_t vertex_index) {
@@ -144,24 +713,91 @@ private:
         return glm::vec3(color.r, color.g, color.b);
     }
 
-    std::vector<texture> load_material_textures(const aiMaterial* mat, aiTextureType type, std::string type_name) {
-        std::vector<texture> textures;
+    // File names of the material's textures of the type, relative to the model's directory.
+    static std::vector<std::string> get_texture_names(const aiMaterial* mat, aiTextureType type) {
+        std::vector<std::string> names;
         for (unsigned int i = 0; i < mat->GetTextureCount(type); i++) {
             aiString str;
             mat->GetTexture(type, i, &str);
-            auto texture_path = fmt::format("{}/{}", path, str.C_Str());
+            names.emplace_back(str.C_Str());
+        }
+        return names;
+    }
+
+    void request_textures(const std::vector<std::string>& names, const std::string& type_name, std::vector<texture_request>& requests) {
+        for (const auto& name: names) {
+            auto texture_path = fmt::format("{}/{}", path, name);
             fmt::print("loading texture: {}\n", texture_path);
-            auto cache_entry = texture_cache.find(texture_path);
-            if (cache_entry != texture_cache.end()) {
-                textures.emplace_back(cache_entry->second);
-            } else {
-                auto actual_texture = texture(details::load_texture(texture_path), type_name);
-                textures.emplace_back(actual_texture);
-                texture_cache.insert_or_assign(texture_path, actual_texture);
+            requests.push_back({texture_path, type_name});
+        }
+    }
+
+    // Gives the meshes the textures they asked for from the texture registry. The ones no model or terrain loaded
+    // before are decoded once, all at the same time. A path keeps the type it was first asked for with.
+    void load_textures(job_system& jobs) {
+        std::vector<std::string> paths;
+        std::vector<std::string> types;
+        std::vector<bool> gamma;
+        for (const auto& requests: texture_requests) {
+            for (const auto& request: requests) {
+                if (std::find(paths.begin(), paths.end(), request.path) == paths.end()) {
+                    paths.push_back(request.path);
+                    types.push_back(request.type);
+                    gamma.push_back(request.type != "texture_normal");
+                }
             }
         }
-        return textures;
+        auto references = texture_registry::acquire(paths, gamma, [&](const std::vector<std::string>& missing, const std::vector<bool>& missing_gamma) {
+            return details::load_textures(missing, jobs, missing_gamma);
+        });
+        for (size_t index = 0; index < meshes.size(); index += 1) {
+            for (const auto& request: texture_requests[index]) {
+                const auto at = (size_t)(std::find(paths.begin(), paths.end(), request.path) - paths.begin());
+                meshes[index].textures.emplace_back(texture_registry::id_of(references[at]), types[at], GL_TEXTURE_2D, references[at]);
+            }
+        }
+        texture_requests.clear();
+    }
+};
+
+// A model placed at every transform of its own instance buffer, drawn with one call per mesh.
+// Like a mesh's, the vertex arrays are made on the first draw by the context that draws, the buffer can be filled
+// by the streaming context.
+struct model_instances {
+    model_instances(model& source, const std::vector<glm::mat4>& transforms): source(&source), instances(transforms),
+        vertex_arrays(source.get_meshes().size(), 0) {}
+
+    model_instances(const model_instances& other) = delete;
+
+    model_instances& operator=(const model_instances& other) = delete;
+
+    model_instances(model_instances&& other) noexcept: source(other.source), instances(std::move(other.instances)),
+        vertex_arrays(std::move(other.vertex_arrays)) {}
+
+    ~model_instances() {
+        if (!vertex_arrays.empty()) {
+            glDeleteVertexArrays((GLsizei)vertex_arrays.size(), vertex_arrays.data());
+        }
+    }
+
+    void draw(shader_program& shader) {
+        auto& meshes = source->get_meshes();
+        for (size_t index = 0; index < meshes.size(); index += 1) {
+            meshes[index].draw_instanced(shader, get_vertex_array(index), instances.size());
+        }
     }
+
+    // The vertex array of the mesh at `index` of the source, made when it is first asked for.
+    GLuint get_vertex_array(size_t index) {
+        if (vertex_arrays[index] == 0) {
+            vertex_arrays[index] = source->get_meshes()[index].create_instanced_vertex_array(instances);
+        }
+        return vertex_arrays[index];
+    }
+
+    model* source;
+    instance_buffer instances;
+    std::vector<GLuint> vertex_arrays;
 };
 
 #endif
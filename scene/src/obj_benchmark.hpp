@@ -0,0 +1,122 @@
+#ifndef OBJ_BENCHMARK_HPP
+#define OBJ_BENCHMARK_HPP
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+#include <fmt/format.h>
+
+#include "job_system.hpp"
+#include "obj_loader.hpp"
+
+// Load time of the OBJ loader against Assimp on generated files, run with `--obj-benchmark [faces]`.
+// Every file is a wavy grid of triangles with positions, texture coordinates and normals shared between neighbouring
+// faces, the way exporters write smooth surfaces. Sizes grow tenfold up to `faces`, ten million by default.
+namespace obj_benchmark {
+    namespace details {
+        // Writes a grid of at least `faces` triangles and returns how many it has.
+        inline size_t write_grid(const std::string& path, size_t faces) {
+            const auto side = (size_t)std::ceil(std::sqrt((double)faces / 2.0)) + 1;
+            std::ofstream output(path, std::ios::binary | std::ios::trunc);
+            fmt::memory_buffer buffer;
+            const auto flush = [&](bool always) {
+                if (always || buffer.size() > (1 << 20)) {
+                    output.write(buffer.data(), (std::streamsize)buffer.size());
+                    buffer.clear();
+                }
+            };
+            fmt::format_to(std::back_inserter(buffer), "# {} x {} grid\ng grid\nusemtl grid\n", side, side);
+            for (size_t row = 0; row < side; row += 1) {
+                for (size_t column = 0; column < side; column += 1) {
+                    auto x = (float)column / (float)side;
+                    auto z = (float)row / (float)side;
+                    auto height = 0.05f * std::sin(x * 40.0f) * std::cos(z * 40.0f);
+                    fmt::format_to(std::back_inserter(buffer), "v {:.6f} {:.6f} {:.6f}\nvt {:.6f} {:.6f}\nvn 0.000000 1.000000 0.000000\n", x, height, z, x, z);
+                    flush(false);
+                }
+            }
+            for (size_t row = 0; row + 1 < side; row += 1) {
+                for (size_t column = 0; column + 1 < side; column += 1) {
+                    auto a = row * side + column + 1;
+                    auto b = a + 1;
+                    auto c = a + side;
+                    auto d = c + 1;
+                    fmt::format_to(std::back_inserter(buffer), "f {0}/{0}/{0} {2}/{2}/{2} {1}/{1}/{1}\nf {1}/{1}/{1} {2}/{2}/{2} {3}/{3}/{3}\n", a, b, c, d);
+                    flush(false);
+                }
+            }
+            flush(true);
+            if (!output) {
+                throw std::runtime_error(fmt::format("Failed to write {}", path));
+            }
+            return 2 * (side - 1) * (side - 1);
+        }
+
+        template <typename F>
+        double measure_milliseconds(F&& body) {
+            auto start = std::chrono::steady_clock::now();
+            body();
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+    }
+
+    inline int run(size_t max_faces) {
+        job_system jobs;
+        const auto path = (std::filesystem::temp_directory_path() / "obj_benchmark.obj").string();
+        fmt::print("{} threads\n", jobs.size());
+        fmt::print("{:>10} {:>8} | {:>10} {:>10} {:>8} | {:>12} {:>12}\n",
+            "faces", "MB", "assimp ms", "native ms", "speedup", "assimp verts", "native verts");
+        int result = 0;
+        for (size_t faces = std::min<size_t>(100000, max_faces); result == 0; faces = std::min(faces * 10, max_faces)) {
+            const auto written = details::write_grid(path, faces);
+            const auto megabytes = (double)std::filesystem::file_size(path) / (1 << 20);
+
+            size_t assimp_vertices = 0;
+            size_t assimp_indices = 0;
+            auto assimp_ms = details::measure_milliseconds([&]() {
+                Assimp::Importer importer;
+                auto scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+                if (scene == nullptr) {
+                    return;
+                }
+                for (unsigned int index = 0; index < scene->mNumMeshes; index += 1) {
+                    assimp_vertices += scene->mMeshes[index]->mNumVertices;
+                    assimp_indices += 3 * (size_t)scene->mMeshes[index]->mNumFaces;
+                }
+            });
+
+            size_t native_vertices = 0;
+            size_t native_indices = 0;
+            auto native_ms = details::measure_milliseconds([&]() {
+                for (const auto& target: obj_loader::load(path, jobs)) {
+                    native_vertices += target.vertices.size();
+                    native_indices += target.indices.size();
+                }
+            });
+
+            fmt::print("{:>10} {:>8.1f} | {:>10.1f} {:>10.1f} {:>7.1f}x | {:>12} {:>12}\n",
+                written, megabytes, assimp_ms, native_ms, assimp_ms / native_ms, assimp_vertices, native_vertices);
+            if (assimp_indices != native_indices || native_indices != 3 * written) {
+                fmt::print("Results differ: {} / {} indices for {} faces\n", assimp_indices, native_indices, written);
+                result = 1;
+            }
+            if (faces == max_faces) {
+                break;
+            }
+        }
+        std::error_code error;
+        std::filesystem::remove(path, error);
+        return result;
+    }
+}
+
+#endif
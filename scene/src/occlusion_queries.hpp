@@ -0,0 +1,194 @@
+#ifndef OCCLUSION_QUERIES_HPP
+#define OCCLUSION_QUERIES_HPP
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "frustum.hpp"
+#include "gl_state.hpp"
+#include "shader_program.hpp"
+#include "stream_buffer.hpp"
+
+// GPU occlusion tests of single meshes: the world box of every tracked mesh is drawn against the depth buffer
+// inside a GL_ANY_SAMPLES_PASSED query. Results are only read once the GPU reports them available, so the frame
+// never waits for them. A mesh whose last finished query saw no samples is skipped, and while a query is still
+// in flight the draw is rendered conditionally on it, which lets the GPU drop it if the answer arrives in time.
+class occlusion_queries {
+public:
+    struct frame_stats {
+        size_t issued = 0;
+        size_t collected = 0;
+        size_t skipped = 0;
+        size_t conditional = 0;
+    };
+
+    occlusion_queries() = default;
+
+    occlusion_queries(const occlusion_queries& other) = delete;
+
+    occlusion_queries& operator=(const occlusion_queries& other) = delete;
+
+    ~occlusion_queries() {
+        for (auto& entry: entries) {
+            if (entry.query != 0) {
+                glDeleteQueries(1, &entry.query);
+            }
+        }
+        if (vertex_array != 0) {
+            glDeleteVertexArrays(1, &vertex_array);
+        }
+    }
+
+    // Starts tracking a mesh and returns its id. It counts as visible until its first query finishes.
+    size_t add() {
+        entries.emplace_back();
+        return entries.size() - 1;
+    }
+
+    // World bounds the next query of the mesh is drawn with, moving meshes update them every frame.
+    void set_bounds(size_t id, const aabb& bounds) {
+        entries[id].bounds = bounds;
+    }
+
+    // Picks up the queries the GPU has finished, without waiting for the rest. Called once per frame before draw_condition().
+    void collect() {
+        stats = {};
+        for (auto& entry: entries) {
+            if (!entry.pending) {
+                continue;
+            }
+            GLuint available = GL_FALSE;
+            glGetQueryObjectuiv(entry.query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available == GL_FALSE) {
+                continue;
+            }
+            GLuint passed = GL_FALSE;
+            glGetQueryObjectuiv(entry.query, GL_QUERY_RESULT, &passed);
+            entry.visible = passed != GL_FALSE;
+            entry.pending = false;
+            stats.collected += 1;
+        }
+    }
+
+    // Nothing when the mesh is known to be hidden, otherwise the query its draw should be conditioned on (0 for none).
+    std::optional<GLuint> draw_condition(size_t id) {
+        const auto& entry = entries[id];
+        if (!entry.visible) {
+            stats.skipped += 1;
+            return std::nullopt;
+        }
+        if (entry.pending) {
+            stats.conditional += 1;
+            return entry.query;
+        }
+        return 0;
+    }
+
+    // Draws the boxes of the meshes without a query in flight against the current depth buffer, writing neither color nor depth.
+    // Called after the occluders are drawn. The boxes are streamed in world space through `stream`, and `shader` transforms
+    // positions at attribute 0 by model, view and projection. Boxes are grown by `margin` so that flat meshes do not lose
+    // the depth test to themselves. When the stream is out of space this frame the queries are issued in the next one.
+    void issue(shader_program& shader, stream_buffer& stream, const glm::mat4& view, const glm::mat4& projection, glm::vec3 eye, float margin) {
+        boxes.clear();
+        for (auto& entry: entries) {
+            if (entry.pending || entry.bounds.empty()) {
+                continue;
+            }
+            auto min = entry.bounds.min - glm::vec3(margin);
+            auto max = entry.bounds.max + glm::vec3(margin);
+            // From inside the box its faces are clipped or behind the mesh, the answer would be wrong.
+            if (glm::clamp(eye, min, max) == eye) {
+                entry.visible = true;
+                continue;
+            }
+            boxes.emplace_back(&entry, aabb{min, max});
+        }
+        if (boxes.empty()) {
+            return;
+        }
+        auto vertices = stream.allocate(boxes.size() * box_indices.size() * sizeof(glm::vec3), sizeof(glm::vec3));
+        if (!vertices) {
+            return;
+        }
+        auto* target = (glm::vec3*)vertices->data;
+        for (const auto& [entry, bounds]: boxes) {
+            for (auto corner: box_indices) {
+                *target++ = glm::vec3(
+                    corner & 1 ? bounds.max.x : bounds.min.x,
+                    corner & 2 ? bounds.max.y : bounds.min.y,
+                    corner & 4 ? bounds.max.z : bounds.min.z
+                );
+            }
+        }
+        stream.flush();
+        if (vertex_array == 0) {
+            glGenVertexArrays(1, &vertex_array);
+            gl_state::bind_vertex_array(vertex_array);
+            glBindBuffer(GL_ARRAY_BUFFER, stream.get_id());
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), nullptr);
+        }
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthMask(GL_FALSE);
+        shader.use();
+        shader.set_uniform("model", glm::mat4(1.0f));
+        shader.set_uniform("view", view);
+        shader.set_uniform("projection", projection);
+        gl_state::bind_vertex_array(vertex_array);
+        auto first = (GLint)(vertices->offset / sizeof(glm::vec3));
+        for (const auto& [entry, bounds]: boxes) {
+            if (entry->query == 0) {
+                glGenQueries(1, &entry->query);
+            }
+            glBeginQuery(GL_ANY_SAMPLES_PASSED, entry->query);
+            glDrawArrays(GL_TRIANGLES, first, (GLsizei)box_indices.size());
+            glEndQuery(GL_ANY_SAMPLES_PASSED);
+            first += (GLint)box_indices.size();
+            entry->pending = true;
+            stats.issued += 1;
+        }
+        glDepthMask(GL_TRUE);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    }
+
+    [[nodiscard]]
+    const frame_stats& get_stats() const {
+        return stats;
+    }
+
+    [[nodiscard]]
+    size_t size() const {
+        return entries.size();
+    }
+
+private:
+    // Corners of the 12 triangles of a box, bit 0 picks max x, bit 1 max y and bit 2 max z.
+    static constexpr std::array<uint8_t, 36> box_indices = {
+        2, 0, 1, 1, 3, 2, 4, 0, 2, 2, 6, 4, 1, 5, 7, 7, 3, 1,
+        4, 6, 7, 7, 5, 4, 2, 3, 7, 7, 6, 2, 0, 4, 1, 1, 4, 5
+    };
+
+    struct entry {
+        aabb bounds;
+        GLuint query = 0;
+        // Issued and not read back yet; such a query is neither read nor issued again until the GPU is done with it.
+        bool pending = false;
+        bool visible = true;
+    };
+
+    std::vector<entry> entries;
+    // Entries queried by the current issue() and their grown boxes.
+    std::vector<std::pair<entry*, aabb>> boxes;
+    // Reads the boxes from the stream buffer, created on the first issue().
+    GLuint vertex_array = 0;
+    frame_stats stats;
+};
+
+#endif
@@ -3,15 +3,49 @@
 
 #pragma once
 
+#include <array>
+#include <cstddef>
+#include <cstring>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 #include <GL/glew.h>
 #include <glm/glm.hpp>
 #include <fmt/format.h>
 
+// Fully preprocessed sources of a program, with every file they were assembled from.
+struct shader_sources {
+    std::string vertex_code;
+    std::string fragment_code;
+    std::vector<std::string> dependencies;
+};
+
+// Resolves `#include "file"` relative to the including file (each file is included once)
+// and injects `#define` lines for the given defines right after `#version`.
+// Defines are either "NAME" or "NAME VALUE". Does no GL calls and is safe to use off the render thread.
+shader_sources load_shader_sources(
+    const std::string& vertex_path,
+    const std::string& fragment_path,
+    const std::vector<std::string>& defines = {}
+);
+
+struct uniform_stats {
+    size_t issued = 0;
+    size_t skipped = 0;
+};
+
 class shader_program {
 public:
-    shader_program(std::string  vertex_code_fname, std::string  fragment_code_fname);
+    shader_program(std::string  vertex_code_fname, std::string  fragment_code_fname, std::vector<std::string> defines = {});
+
+    shader_program(const shader_program& other) = delete;
+
+    shader_program& operator=(const shader_program& other) = delete;
+
+    shader_program(shader_program&& other) noexcept;
+
+    shader_program& operator=(shader_program&& other) noexcept;
 
     ~shader_program();
 
@@ -19,75 +53,180 @@ public:
 
     void reload();
 
+    // Issues compilation of the new sources without waiting for the driver.
+    // The result is picked up by finish_reload() on a later frame.
+    void begin_reload(const shader_sources& sources);
+
+    // Returns true once the pending program has linked and replaced the current one.
+    // A program that failed to link is discarded and the current one is kept.
+    bool finish_reload();
+
+    [[nodiscard]]
+    bool has_pending_reload() const {
+        return pending_program_id != 0;
+    }
+
+    [[nodiscard]]
+    const std::string& get_vertex_shader_path() const {
+        return vertex_shader_path;
+    }
+
+    [[nodiscard]]
+    const std::string& get_fragment_shader_path() const {
+        return fragment_shader_path;
+    }
+
+    [[nodiscard]]
+    const std::vector<std::string>& get_defines() const {
+        return defines;
+    }
+
+    [[nodiscard]]
+    const std::vector<std::string>& get_dependencies() const {
+        return dependencies;
+    }
+
     inline void set_uniform(const std::string& name, int val) {
-        glUniform1i(glGetUniformLocation(program_id, name.c_str()), val);
+        GLint location;
+        if (update_uniform_cache(name, val, location)) {
+            glUniform1i(location, val);
+        }
     }
 
     inline void set_uniform(const std::string& name, bool val) {
-        glUniform1i(glGetUniformLocation(program_id, name.c_str()), val);
+        set_uniform(name, (int)val);
     }
 
     inline void set_uniform(const std::string& name, float val) {
-        glUniform1f(glGetUniformLocation(program_id, name.c_str()), val);
+        GLint location;
+        if (update_uniform_cache(name, val, location)) {
+            glUniform1f(location, val);
+        }
     }
 
     inline void set_uniform(const std::string& name, float val1, float val2) {
-        glUniform2f(glGetUniformLocation(program_id, name.c_str()), val1, val2);
+        set_uniform(name, glm::vec2(val1, val2));
     }
 
     inline void set_uniform(const std::string& name, float val1, float val2, float val3) {
-        glUniform3f(glGetUniformLocation(program_id, name.c_str()), val1, val2, val3);
+        set_uniform(name, glm::vec3(val1, val2, val3));
     }
 
     inline void set_uniform(const std::string& name, float val1, float val2, float val3, float val4) {
-        glUniform4f(glGetUniformLocation(program_id, name.c_str()), val1, val2, val3, val4);
+        set_uniform(name, glm::vec4(val1, val2, val3, val4));
     }
 
     inline void set_uniform(const std::string& name, float* val) {
-        glUniformMatrix4fv(glGetUniformLocation(program_id, name.c_str()), 1, GL_FALSE, val);
+        std::array<float, 16> matrix;
+        std::memcpy(matrix.data(), val, sizeof(matrix));
+        GLint location;
+        if (update_uniform_cache(name, matrix, location)) {
+            glUniformMatrix4fv(location, 1, GL_FALSE, val);
+        }
+    }
+
+    inline void set_uniform(const std::string& name, glm::vec2 value) {
+        GLint location;
+        if (update_uniform_cache(name, value, location)) {
+            glUniform2fv(location, 1, &value[0]);
+        }
     }
 
     inline void set_uniform(const std::string& name, glm::vec3 value) {
-        glUniform3fv(glGetUniformLocation(program_id, name.c_str()), 1, &value[0]);
+        GLint location;
+        if (update_uniform_cache(name, value, location)) {
+            glUniform3fv(location, 1, &value[0]);
+        }
     }
 
     inline void set_uniform(const std::string& name, glm::vec4 value) {
-        glUniform4fv(glGetUniformLocation(program_id, name.c_str()), 1, &value[0]);
+        GLint location;
+        if (update_uniform_cache(name, value, location)) {
+            glUniform4fv(location, 1, &value[0]);
+        }
     }
 
     inline void set_uniform(const std::string &name, const glm::mat2& mat) {
-        glUniformMatrix2fv(glGetUniformLocation(program_id, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        GLint location;
+        if (update_uniform_cache(name, mat, location)) {
+            glUniformMatrix2fv(location, 1, GL_FALSE, &mat[0][0]);
+        }
     }
 
     inline void set_uniform(const std::string &name, const glm::mat3& mat) {
-        glUniformMatrix3fv(glGetUniformLocation(program_id, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        GLint location;
+        if (update_uniform_cache(name, mat, location)) {
+            glUniformMatrix3fv(location, 1, GL_FALSE, &mat[0][0]);
+        }
     }
 
     inline void set_uniform(const std::string &name, const glm::mat4& mat) {
-        glUniformMatrix4fv(glGetUniformLocation(program_id, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        GLint location;
+        if (update_uniform_cache(name, mat, location)) {
+            glUniformMatrix4fv(location, 1, GL_FALSE, &mat[0][0]);
+        }
+    }
+
+    // Counts glUniform* calls issued and skipped by every program since the last reset.
+    static inline uniform_stats frame_uniform_stats;
+
+    static uniform_stats reset_uniform_stats() {
+        return std::exchange(frame_uniform_stats, uniform_stats());
     }
 
 private:
 
-    void check_compile_error();
+    // Last value uploaded to a uniform, uniforms keep their values for the lifetime of the GL program.
+    struct uniform_slot {
+        GLint location = -1;
+        size_t size = 0;
+        std::array<std::byte, sizeof(glm::mat4)> value;
+    };
+
+    // Returns false when the GL call can be skipped: the uniform is inactive or already holds the value.
+    template <typename T>
+    bool update_uniform_cache(const std::string& name, const T& value, GLint& location) {
+        static_assert(sizeof(T) <= sizeof(uniform_slot::value));
+        auto slot = uniforms.find(name);
+        if (slot == uniforms.end()) {
+            uniform_slot new_slot;
+            new_slot.location = glGetUniformLocation(program_id, name.c_str());
+            slot = uniforms.emplace(name, new_slot).first;
+        }
+        location = slot->second.location;
+        if (location < 0 || (slot->second.size == sizeof(T) && std::memcmp(slot->second.value.data(), &value, sizeof(T)) == 0)) {
+            frame_uniform_stats.skipped += 1;
+            return false;
+        }
+        std::memcpy(slot->second.value.data(), &value, sizeof(T));
+        slot->second.size = sizeof(T);
+        frame_uniform_stats.issued += 1;
+        return true;
+    }
+
+    static bool check_compile_error(GLuint shader_id, const char* stage);
 
-    void check_linking_error();
+    static bool check_linking_error(GLuint program_id);
 
-    void compile(const std::string& vertex_code, const std::string& fragment_code);
+    static GLuint compile(GLenum type, const std::string& code);
 
-    void link();
+    static GLuint link(const std::string& vertex_code, const std::string& fragment_code);
 
-    GLuint vertex_id;
-    GLuint fragment_id;
-    GLuint program_id;
+    GLuint program_id = 0;
+    GLuint pending_program_id = 0;
+    int pending_frames = 0;
     std::string vertex_shader_path;
     std::string fragment_shader_path;
+    std::vector<std::string> defines;
+    std::vector<std::string> dependencies;
+    std::unordered_map<std::string, uniform_slot> uniforms;
 };
 
-inline shader_program load_shader(const std::string& path) {
+inline shader_program load_shader(const std::string& path, std::vector<std::string> defines = {}) {
     return shader_program(
         fmt::format("{}_vertex.glsl", path),
-        fmt::format("{}_fragment.glsl", path)
+        fmt::format("{}_fragment.glsl", path),
+        std::move(defines)
     );
 }
 
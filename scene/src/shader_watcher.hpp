@@ -0,0 +1,67 @@
+#ifndef SHADER_WATCHER_HPP
+#define SHADER_WATCHER_HPP
+
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "shader_program.hpp"
+
+// Watches shader directories on a background thread and hot swaps the registered programs.
+// The worker only reads changed sources; all GL calls happen in update() on the render thread.
+class shader_watcher {
+public:
+    explicit shader_watcher(std::vector<std::string> directories);
+
+    shader_watcher(const shader_watcher& other) = delete;
+
+    shader_watcher& operator=(const shader_watcher& other) = delete;
+
+    ~shader_watcher();
+
+    // The program must outlive the watcher.
+    void watch(shader_program& program);
+
+    // Called once per frame: starts compiling freshly changed programs and swaps in finished ones.
+    void update();
+
+private:
+    struct watched_program {
+        shader_program* program;
+        std::string vertex_path;
+        std::string fragment_path;
+        std::vector<std::string> defines;
+        // Every file the program was assembled from, including shared #include files.
+        std::vector<std::string> dependencies;
+    };
+
+    struct pending_sources {
+        shader_program* program;
+        shader_sources sources;
+    };
+
+    void run();
+
+    void wait_for_changes(std::vector<std::string>& changed_files);
+
+    void handle_changes(const std::vector<std::string>& changed_files);
+
+    std::vector<std::string> directories;
+    std::map<int, std::string> watch_descriptors;
+    std::map<std::string, std::filesystem::file_time_type> timestamps;
+    std::vector<watched_program> programs;
+    std::vector<pending_sources> pending;
+    std::vector<shader_program*> compiling;
+    std::mutex mutex;
+    std::atomic<bool> running = true;
+    int inotify_fd = -1;
+    std::thread worker;
+};
+
+#endif
@@ -15,11 +15,11 @@ public:
 
     shadow_framebuffer_controller() {
         glGenFramebuffers(1, &framebuffer);
-        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+        gl_state::bind_framebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
         glDrawBuffer(GL_NONE);
 
         glGenTextures(1, &depth_map);
-        glBindTexture(GL_TEXTURE_2D, depth_map);
+        gl_state::bind_texture(GL_TEXTURE_2D, depth_map);
         glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -31,21 +31,20 @@ public:
         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_map, 0);
         glDrawBuffer(GL_NONE);
         glReadBuffer(GL_NONE);
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        gl_state::bind_framebuffer(GL_FRAMEBUFFER, 0);
     }
 
+    // Draw and read buffers belong to the framebuffer object and were set once in the constructor.
     void bind_framebuffer() {
-        glBindTexture(GL_TEXTURE_2D, 0);
-        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
-        glDrawBuffer(GL_NONE);
-        glReadBuffer(GL_NONE);
+        gl_state::bind_texture(0, GL_TEXTURE_2D, 0);
+        gl_state::bind_framebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
         //fmt::print("{}\n", glCheckFramebufferStatus(framebuffer));
-        glViewport(0, 0, width, height);
+        gl_state::viewport(0, 0, width, height);
     }
 
     void unbind_framebuffer(int width, int height) {
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glViewport(0, 0, width, height);
+        gl_state::bind_framebuffer(GL_FRAMEBUFFER, 0);
+        gl_state::viewport(0, 0, width, height);
     }
 };
 
@@ -8,6 +8,8 @@
 
 #include "mesh.hpp"
 #include "utility.hpp"
+#include "gl_state.hpp"
+#include "job_system.hpp"
 
 mesh create_water() {
     return mesh({
@@ -37,7 +39,7 @@ public:
     GLuint dudv_texture = 0;
     GLuint normal_map_texture = 0;
 
-    explicit water_framebuffers_controller(const GLFWwindow* window) {
+    water_framebuffers_controller(const GLFWwindow* window, job_system& jobs) {
         auto [width, height] = utility::get_window_size(window);
         reflection_framebuffer = create_framebuffer();
         reflection_texture = create_texture_attachment(reflection_width, reflection_height);
@@ -47,8 +49,9 @@ public:
         refraction_texture = create_texture_attachment(refraction_width, refraction_height);
         refraction_depth_texture = create_depth_texture_attachment(refraction_width, refraction_height);
         unbind_current_framebuffer(width, height);
-        dudv_texture = details::load_texture("assets/water/dudv.png");
-        normal_map_texture = details::load_texture("assets/water/normal_map.png");
+        // Both hold vectors rather than colors, their mips are filtered as they are.
+        dudv_texture = details::load_texture("assets/water/dudv.png", jobs, false);
+        normal_map_texture = details::load_texture("assets/water/normal_map.png", jobs, false);
     }
 
     //void init_reflection_framebuffer(int width, int height) {
@@ -74,28 +77,28 @@ public:
     }
 
     static void unbind_current_framebuffer(int width, int height) {
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glViewport(0, 0, width, height);
+        gl_state::bind_framebuffer(GL_FRAMEBUFFER, 0);
+        gl_state::viewport(0, 0, width, height);
     }
 
     static GLuint create_framebuffer() {
         GLuint framebuffer = 0;
         glGenFramebuffers(1, &framebuffer);
-        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        gl_state::bind_framebuffer(GL_FRAMEBUFFER, framebuffer);
         glDrawBuffer(GL_COLOR_ATTACHMENT0);
         return framebuffer;
     }
 
     static void bind_framebuffer(GLuint framebuffer, int width, int height) {
-        glBindTexture(GL_TEXTURE_2D, 0);
-        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-        glViewport(0, 0, width, height);
+        gl_state::bind_texture(0, GL_TEXTURE_2D, 0);
+        gl_state::bind_framebuffer(GL_FRAMEBUFFER, framebuffer);
+        gl_state::viewport(0, 0, width, height);
     }
 
     static GLuint create_texture_attachment(int width, int height) {
         GLuint texture = 0;
         glGenTextures(1, &texture);
-        glBindTexture(GL_TEXTURE_2D, texture);
+        gl_state::bind_texture(GL_TEXTURE_2D, texture);
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -106,7 +109,7 @@ public:
     static GLuint create_depth_texture_attachment(int width, int height) {
         GLuint texture = 0;
         glGenTextures(1, &texture);
-        glBindTexture(GL_TEXTURE_2D, texture);
+        gl_state::bind_texture(GL_TEXTURE_2D, texture);
         glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -124,17 +127,11 @@ public:
     }
 
     void bind_textures() {
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, reflection_texture);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, refraction_texture);
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, dudv_texture);
-        glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_2D, normal_map_texture);
-        glActiveTexture(GL_TEXTURE4);
-        glBindTexture(GL_TEXTURE_2D, refraction_depth_texture);
-        glActiveTexture(GL_TEXTURE0);
+        gl_state::bind_texture(0, GL_TEXTURE_2D, reflection_texture);
+        gl_state::bind_texture(1, GL_TEXTURE_2D, refraction_texture);
+        gl_state::bind_texture(2, GL_TEXTURE_2D, dudv_texture);
+        gl_state::bind_texture(3, GL_TEXTURE_2D, normal_map_texture);
+        gl_state::bind_texture(4, GL_TEXTURE_2D, refraction_depth_texture);
     }
 
     void dispose() {
@@ -144,6 +141,9 @@ public:
         glDeleteFramebuffers(1, &refraction_framebuffer);
         glDeleteTextures(1, &refraction_texture);
         glDeleteTextures(1, &refraction_depth_texture);
+        gl_state::forget_texture(reflection_texture);
+        gl_state::forget_texture(refraction_texture);
+        gl_state::forget_texture(refraction_depth_texture);
     }
 };
 